@@ -0,0 +1,266 @@
+/**
+ * Throughput benchmark of tinywav_read_f and tinywav_write_f over all sample formats, channel formats, a range of
+ * channel counts and block sizes, and three storage backends. Writes are also run with per-channel statistics
+ * (tinywav_set_stats) as "write+stats"; they are accumulated in the conversion loop, channel by channel:
+ *   file    - a file in the working directory (or --dir), i.e. the page cache of a real file system
+ *   tmpfs   - a file in /dev/shm, which avoids the block layer (Linux only)
+ *   memory  - a memory buffer opened with fmemopen, which leaves only the conversion and stdio overhead (POSIX only)
+ *
+ * Usage: TinywavBench [--json] [--quick] [--dir <path>] [--bytes <per run>] [--buffer <stdio buffer size>]
+ */
+
+#include "tinywav.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <unistd.h>
+  #define TINYWAV_BENCH_FMEMOPEN 1
+#endif
+
+namespace
+{
+
+// larger blocks need more stack than tinywav's internal allocations can count on, see README
+constexpr long kMaxSamplesPerBlock = 1 << 18;
+
+TinyWavOpenOptions openOptions = {};
+
+struct Result
+{
+  std::string operation, backend;
+  TinyWavSampleFormat sampFmt;
+  TinyWavChannelFormat chanFmt;
+  int numChannels, blockSize;
+  long numFrames;
+  double seconds;
+};
+
+const char* sampleFormatName(TinyWavSampleFormat f) { return (f == TW_INT16) ? "int16" : "float32"; }
+
+const char* channelFormatName(TinyWavChannelFormat f)
+{
+  switch (f) {
+    case TW_INTERLEAVED: return "interleaved";
+    case TW_INLINE: return "inline";
+    case TW_SPLIT: return "split";
+    default: return "unknown";
+  }
+}
+
+double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Memory of a block of samples in any channel format, split pointers included */
+struct Block
+{
+  Block(int numChannels, int blockSize, TinyWavChannelFormat chanFmt)
+  : samples(static_cast<size_t>(numChannels) * blockSize), channels(numChannels), chanFmt(chanFmt)
+  {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-0.9f, 0.9f);
+    for (float& s : samples) s = dist(rng);
+    for (int c = 0; c < numChannels; ++c) channels[c] = samples.data() + static_cast<size_t>(c) * blockSize;
+  }
+  void* data() { return (chanFmt == TW_SPLIT) ? static_cast<void*>(channels.data()) : samples.data(); }
+
+  std::vector<float> samples;
+  std::vector<float*> channels;
+  TinyWavChannelFormat chanFmt;
+};
+
+/** Replaces the file of an open handle by a memory buffer at the same position, with the same stdio buffer size */
+bool swapToMemory(TinyWav& tw, std::vector<char>& memory, const char* mode)
+{
+#if TINYWAV_BENCH_FMEMOPEN
+  const long position = ftell(tw.f);
+  FILE* m = fmemopen(memory.data(), memory.size(), mode);
+  if (m == nullptr) return false;
+  if (openOptions.bufferSize > 0 && setvbuf(m, nullptr, _IOFBF, openOptions.bufferSize) != 0) {
+    fclose(m);
+    return false;
+  }
+  if (fseek(m, position, SEEK_SET) != 0) {
+    fclose(m);
+    return false;
+  }
+  fclose(tw.f);
+  tw.f = m;
+  return true;
+#else
+  (void) tw; (void) memory; (void) mode;
+  return false;
+#endif
+}
+
+bool runWrite(const std::string& backend, const std::string& path, Result& r, std::vector<char>* memory,
+              bool withStats = false)
+{
+  Block block(r.numChannels, r.blockSize, r.chanFmt);
+  std::vector<TinyWavStats> stats(static_cast<size_t>(r.numChannels));
+  TinyWav tw;
+  if (tinywav_open_write_ex(&tw, static_cast<int16_t>(r.numChannels), 48000, r.sampFmt, r.chanFmt, path.c_str(),
+                            &openOptions) != 0) {
+    return false;
+  }
+  if (withStats) {
+    tinywav_set_stats(&tw, stats.data());
+  }
+  if (backend == "memory") {
+    const size_t bytesPerSample = (r.sampFmt == TW_INT16) ? 2 : 4;
+    memory->assign(static_cast<size_t>(ftell(tw.f)) + r.numFrames * r.numChannels * bytesPerSample, 0);
+    if (!swapToMemory(tw, *memory, "w+b")) {
+      tinywav_close_write(&tw);
+      return false;
+    }
+  }
+  const double start = now();
+  for (long frame = 0; frame < r.numFrames; frame += r.blockSize) {
+    if (tinywav_write_f(&tw, block.data(), r.blockSize) != r.blockSize) {
+      tinywav_close_write(&tw);
+      return false;
+    }
+  }
+  tinywav_close_write(&tw); // includes flushing the stdio buffer
+  r.seconds = now() - start;
+  return true;
+}
+
+bool runRead(const std::string& backend, const std::string& path, Result& r, std::vector<char>* memory)
+{
+  Block block(r.numChannels, r.blockSize, r.chanFmt);
+  TinyWav tw;
+  if (tinywav_open_read_ex(&tw, path.c_str(), r.chanFmt, &openOptions) != 0) {
+    return false;
+  }
+  if (backend == "memory") {
+    // the header was parsed from the file, the audio data comes from a copy of it
+    FILE* f = fopen(path.c_str(), "rb");
+    memory->resize(0);
+    if (f != nullptr) {
+      char chunk[65536];
+      for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0;) memory->insert(memory->end(), chunk, chunk + n);
+      fclose(f);
+    }
+    if (memory->empty() || !swapToMemory(tw, *memory, "rb")) {
+      tinywav_close_read(&tw);
+      return false;
+    }
+  }
+  long numFrames = 0;
+  const double start = now();
+  for (int n; (n = tinywav_read_f(&tw, block.data(), r.blockSize)) > 0;) numFrames += n;
+  r.seconds = now() - start;
+  tinywav_close_read(&tw);
+  return numFrames == r.numFrames;
+}
+
+void printJson(const std::vector<Result>& results)
+{
+  printf("[\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    const double bytes = static_cast<double>(r.numFrames) * r.numChannels * ((r.sampFmt == TW_INT16) ? 2 : 4);
+    printf("  {\"operation\": \"%s\", \"backend\": \"%s\", \"sampleFormat\": \"%s\", \"channelFormat\": \"%s\", "
+           "\"numChannels\": %d, \"blockSize\": %d, \"numFrames\": %ld, \"seconds\": %.6f, \"mbPerSecond\": %.2f, "
+           "\"nsPerFrame\": %.3f}%s\n",
+           r.operation.c_str(), r.backend.c_str(), sampleFormatName(r.sampFmt), channelFormatName(r.chanFmt),
+           r.numChannels, r.blockSize, r.numFrames, r.seconds, bytes / r.seconds / 1e6,
+           r.seconds * 1e9 / r.numFrames, (i + 1 < results.size()) ? "," : "");
+  }
+  printf("]\n");
+}
+
+void printRow(const Result& r)
+{
+  const double bytes = static_cast<double>(r.numFrames) * r.numChannels * ((r.sampFmt == TW_INT16) ? 2 : 4);
+  printf("%-11s %-7s %-8s %-12s %3d ch %6d fr/block %10.2f MB/s %10.3f ns/frame\n", r.operation.c_str(),
+         r.backend.c_str(), sampleFormatName(r.sampFmt), channelFormatName(r.chanFmt), r.numChannels, r.blockSize,
+         bytes / r.seconds / 1e6, r.seconds * 1e9 / r.numFrames);
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  bool json = false, quick = false;
+  std::string dir = ".";
+  long bytesPerRun = 8L << 20;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) json = true;
+    else if (strcmp(argv[i], "--quick") == 0) quick = true;
+    else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+    else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) bytesPerRun = atol(argv[++i]);
+    else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) openOptions.bufferSize = strtoul(argv[++i], nullptr, 10);
+    else {
+      fprintf(stderr, "Usage: %s [--json] [--quick] [--dir <path>] [--bytes <per run>] [--buffer <bytes>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<std::string> backends = { "file" };
+#if defined(__linux__)
+  if (access("/dev/shm", W_OK) == 0) backends.push_back("tmpfs");
+#endif
+#if TINYWAV_BENCH_FMEMOPEN
+  backends.push_back("memory");
+#endif
+  const std::vector<int> channelCounts = quick ? std::vector<int>{ 2 } : std::vector<int>{ 1, 2, 8, 64 };
+  const std::vector<int> blockSizes = quick ? std::vector<int>{ 512 } : std::vector<int>{ 16, 256, 4096, 65536 };
+
+  std::vector<Result> results;
+  std::vector<char> memory;
+  for (const std::string& backend : backends) {
+    const std::string path = ((backend == "tmpfs") ? std::string("/dev/shm") : dir) + "/tinywav-bench.wav";
+    for (TinyWavSampleFormat sampFmt : { TW_INT16, TW_FLOAT32 }) {
+      for (TinyWavChannelFormat chanFmt : { TW_INTERLEAVED, TW_INLINE, TW_SPLIT }) {
+        for (int numChannels : channelCounts) {
+          for (int blockSize : blockSizes) {
+            if (static_cast<long>(numChannels) * blockSize > kMaxSamplesPerBlock) continue;
+            const long bytesPerFrame = numChannels * ((sampFmt == TW_INT16) ? 2 : 4);
+            const long numBlocks = std::max(1L, bytesPerRun / bytesPerFrame / blockSize);
+            Result r = { "write", backend, sampFmt, chanFmt, numChannels, blockSize, numBlocks * blockSize, 0.0 };
+            Result rs = r;
+            rs.operation = "write+stats";
+            const bool isWrittenWithStats = runWrite(backend, path, rs, &memory, true);
+            const bool isWritten = runWrite(backend, path, r, &memory);
+            if (backend == "memory") {
+              // reading needs the header on disk, write the file once more
+              Result w = r;
+              runWrite("file", path, w, nullptr);
+            }
+            Result rr = r;
+            rr.operation = "read";
+            const bool isRead = runRead(backend, path, rr, &memory);
+            remove(path.c_str());
+            if (!isWritten || !isWrittenWithStats || !isRead) {
+              fprintf(stderr, "Failed: %s %s %s %d ch %d fr/block\n", backend.c_str(), sampleFormatName(sampFmt),
+                      channelFormatName(chanFmt), numChannels, blockSize);
+              return 1;
+            }
+            results.push_back(r);
+            results.push_back(rs);
+            results.push_back(rr);
+            if (!json) {
+              printRow(r);
+              printRow(rs);
+              printRow(rr);
+            }
+          }
+        }
+      }
+    }
+  }
+  if (json) printJson(results);
+  return 0;
+}
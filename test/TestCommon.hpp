@@ -9,6 +9,8 @@
 #pragma once
 
 #include <catch2/catch.hpp>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 
 // classic preprocessor hack to stringify -- double expansion is required
@@ -25,6 +27,18 @@ static inline bool fileExists(const std::string& name)
     return f.good();
 }
 
+/** Removes the file written by a test when leaving the scope, also when a REQUIRE fails */
+class ScopedFile
+{
+public:
+    explicit ScopedFile(std::string path) : path_(std::move(path)) {}
+    ~ScopedFile() { std::remove(path_.c_str()); }
+    ScopedFile(const ScopedFile&) = delete;
+    ScopedFile& operator=(const ScopedFile&) = delete;
+private:
+    const std::string path_;
+};
+
 /** [ABCABCABC] --> [AAABBBCCC] */
 static std::vector<float> deinterleave(std::vector<float> interleavedVector, int numChannels)
 {
@@ -79,5 +93,53 @@ static inline std::vector<int> createRandomVectorInt(int length, int seed=0)
 }
 
 
+/** Appends a little-endian integer of the given byte size */
+static inline void putLE(std::vector<uint8_t>& bytes, uint32_t value, int numBytes)
+{
+    for (int i=0; i<numBytes; ++i) {
+        bytes.push_back(static_cast<uint8_t>((value >> (8*i)) & 0xFF));
+    }
+}
+
+/**
+ * Writes a minimal RIFF WAVE file byte by byte, e.g. for formats tinywav can read but not write.
+ * The fmt chunk is 18 bytes + the size of fmtExtension (cbSize is always written). A 'fact' chunk is written before
+ * the data if factSampleLength is not negative.
+ */
+static inline void writeWavFile(const std::string& path, uint16_t audioFormat, uint16_t numChannels,
+                                uint32_t sampleRate, uint16_t bitsPerSample, uint16_t blockAlign,
+                                const std::vector<uint8_t>& data, const std::vector<uint8_t>& fmtExtension = {},
+                                int64_t factSampleLength = -1)
+{
+    const uint32_t fmtSize = 18 + static_cast<uint32_t>(fmtExtension.size());
+    const uint32_t dataSize = static_cast<uint32_t>(data.size());
+    const uint32_t factSize = (factSampleLength >= 0) ? 12 : 0;
+    std::vector<uint8_t> bytes;
+    bytes.insert(bytes.end(), {'R', 'I', 'F', 'F'});
+    putLE(bytes, 4 + (8 + fmtSize + (fmtSize & 1)) + factSize + (8 + dataSize + (dataSize & 1)), 4);
+    bytes.insert(bytes.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    putLE(bytes, fmtSize, 4);
+    putLE(bytes, audioFormat, 2);
+    putLE(bytes, numChannels, 2);
+    putLE(bytes, sampleRate, 4);
+    putLE(bytes, sampleRate * blockAlign, 4); // not exact for compressed formats, tinywav does not rely on it
+    putLE(bytes, blockAlign, 2);
+    putLE(bytes, bitsPerSample, 2);
+    putLE(bytes, static_cast<uint32_t>(fmtExtension.size()), 2);
+    bytes.insert(bytes.end(), fmtExtension.begin(), fmtExtension.end());
+    if (fmtSize & 1) bytes.push_back(0);
+    if (factSampleLength >= 0) {
+        bytes.insert(bytes.end(), {'f', 'a', 'c', 't'});
+        putLE(bytes, 4, 4);
+        putLE(bytes, static_cast<uint32_t>(factSampleLength), 4);
+    }
+    bytes.insert(bytes.end(), {'d', 'a', 't', 'a'});
+    putLE(bytes, dataSize, 4);
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    if (dataSize & 1) bytes.push_back(0);
+    
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
 
 } // namespace TestCommon
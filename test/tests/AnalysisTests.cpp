@@ -0,0 +1,641 @@
+#include <catch2/catch.hpp>
+#include "tinywav.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "TestCommon.hpp"
+
+/** Peaks of bins of framesPerBin frames of interleaved samples, computed the straightforward way */
+static std::vector<TinyWavPeak> referencePeaks(const std::vector<float>& samples, int numChannels, int framesPerBin)
+{
+  const int numFrames = static_cast<int>(samples.size()) / numChannels;
+  std::vector<TinyWavPeak> peaks;
+  for (int first = 0; first < numFrames; first += framesPerBin) {
+    const int n = std::min(framesPerBin, numFrames - first);
+    for (int c = 0; c < numChannels; ++c) {
+      TinyWavPeak p = { samples[first*numChannels + c], samples[first*numChannels + c], 0.0f };
+      double sumSquares = 0.0;
+      for (int i = first; i < first + n; ++i) {
+        const float v = samples[i*numChannels + c];
+        p.min = std::min(p.min, v);
+        p.max = std::max(p.max, v);
+        sumSquares += v * v;
+      }
+      p.rms = static_cast<float>(std::sqrt(sumSquares / n));
+      peaks.push_back(p);
+    }
+  }
+  return peaks;
+}
+
+static void requirePeaksEqual(const TinyWavPeak* peaks, const std::vector<TinyWavPeak>& expected)
+{
+  for (size_t i = 0; i < expected.size(); ++i) {
+    CAPTURE(i);
+    REQUIRE(peaks[i].min == expected[i].min);
+    REQUIRE(peaks[i].max == expected[i].max);
+    REQUIRE(peaks[i].rms == Approx(expected[i].rms).epsilon(1e-5));
+  }
+}
+
+TEST_CASE("Tinywav - Peak overview while writing and reading")
+{
+  const char* testFile = "testFilePeaks.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavChannelFormat channelFormatW = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  const TinyWavChannelFormat channelFormatR = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 1000;
+  constexpr int framesPerBin = 64;
+  constexpr int numBins = (numFrames + framesPerBin - 1) / framesPerBin; // the last bin is partial
+  constexpr int blockSize = 37; // not aligned to the bins
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels);
+  const std::vector<TinyWavPeak> expected = referencePeaks(samples, numChannels, framesPerBin);
+  
+  CAPTURE(channelFormatW, channelFormatR);
+  
+  TinyWav tw;
+  TinyWavPeaks peaks;
+  std::vector<TinyWavPeak> bins(numBins * numChannels);
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, TW_FLOAT32, channelFormatW, testFile) == 0);
+  REQUIRE(tinywav_set_peaks(&tw, &peaks, bins.data(), numBins, framesPerBin) == 0);
+  for (int frame = 0; frame < numFrames; frame += blockSize) {
+    const int n = std::min(blockSize, numFrames - frame);
+    std::vector<float> block(n * numChannels);
+    float* channels[numChannels] = { block.data(), block.data() + n };
+    for (int i = 0; i < n; ++i) {
+      for (int c = 0; c < numChannels; ++c) {
+        const float v = samples[(frame + i) * numChannels + c];
+        if (channelFormatW == TW_INTERLEAVED) block[i * numChannels + c] = v;
+        else block[c * n + i] = v;
+      }
+    }
+    void* data = (channelFormatW == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+    REQUIRE(tinywav_write_f(&tw, data, n) == n);
+  }
+  REQUIRE(peaks.numBins == numBins - 1);
+  tinywav_close_write(&tw);
+  REQUIRE(peaks.numBins == numBins);
+  requirePeaksEqual(bins.data(), expected);
+  
+  std::vector<TinyWavPeak> readBins(numBins * numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormatR) == 0);
+  REQUIRE(tinywav_set_peaks(&tw, &peaks, readBins.data(), numBins, framesPerBin) == 0);
+  std::vector<float> block(blockSize * numChannels);
+  float* channels[numChannels] = { block.data(), block.data() + blockSize };
+  void* data = (channelFormatR == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+  while (tinywav_read_f(&tw, data, blockSize) > 0) {}
+  tinywav_close_read(&tw);
+  REQUIRE(peaks.numBins == numBins);
+  requirePeaksEqual(readBins.data(), expected);
+}
+
+TEST_CASE("Tinywav - Peak overview pyramid")
+{
+  constexpr int numChannels = 3;
+  const std::vector<float> samples = TestCommon::createRandomVector(1000 * numChannels);
+  std::vector<TinyWavPeak> level = referencePeaks(samples, numChannels, 10); // 100 bins
+  
+  // reduce in place, level by level, and compare against bins computed directly from the samples
+  int numBins = 100;
+  for (int framesPerBin : { 40, 160, 640, 2560 }) {
+    numBins = tinywav_reduce_peaks(level.data(), numBins, numChannels, 4, level.data());
+    const std::vector<TinyWavPeak> expected = referencePeaks(samples, numChannels, framesPerBin);
+    REQUIRE(numBins * numChannels == static_cast<int>(expected.size()));
+    for (int i = 0; i < numBins * numChannels; ++i) {
+      REQUIRE(level[i].min == expected[i].min);
+      REQUIRE(level[i].max == expected[i].max);
+      if ((i / numChannels + 1) * framesPerBin <= 1000) { // bins holding different numbers of frames are approximate
+        REQUIRE(level[i].rms == Approx(expected[i].rms).epsilon(1e-4));
+      }
+    }
+  }
+  REQUIRE(numBins == 1);
+  REQUIRE(tinywav_reduce_peaks(level.data(), 1, numChannels, 0, level.data()) == -1);
+}
+
+TEST_CASE("Tinywav - Write 'levl' peak envelope chunk")
+{
+  const char* testFile = "testFileLevl.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const int maxBins = GENERATE(64, 8); // 8 bins are not enough for 256 frames per block
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 256 * 20 + 100;
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels);
+  
+  CAPTURE(sampleFormat, maxBins);
+  
+  TinyWav tw;
+  TinyWavPeaks peaks;
+  std::vector<TinyWavPeak> bins(maxBins * numChannels);
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_set_levl(&tw, &peaks, bins.data(), maxBins) == 0);
+  REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  // 21 blocks of 256 frames fit into 64 bins, 8 bins need blocks of 1024 frames
+  const int blockSize = (maxBins == 64) ? 256 : 1024;
+  const int numBlocks = (numFrames + blockSize - 1) / blockSize;
+  REQUIRE(peaks.framesPerBin == blockSize);
+  REQUIRE(peaks.numBins == numBlocks);
+  const std::vector<TinyWavPeak> expected = referencePeaks(samples, numChannels, blockSize);
+  
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  const TinyWavChunk* levl = tinywav_find_chunk(&tw, "levl");
+  REQUIRE(levl != nullptr);
+  REQUIRE(levl->size == 120 + numBlocks * numChannels * 4);
+  std::vector<uint8_t> chunk(levl->size);
+  REQUIRE(tinywav_read_chunk(&tw, levl, chunk.data(), static_cast<int>(chunk.size())) == static_cast<int>(levl->size));
+  std::vector<float> readSamples(samples.size());
+  REQUIRE(tinywav_read_f(&tw, readSamples.data(), numFrames) == numFrames); // the audio data is unaffected
+  tinywav_close_read(&tw);
+  if (sampleFormat == TW_FLOAT32) {
+    REQUIRE(readSamples == samples);
+  }
+  
+  auto dword = [&chunk](int offset) {
+    return chunk[offset] | (chunk[offset+1] << 8) | (chunk[offset+2] << 16) | (static_cast<uint32_t>(chunk[offset+3]) << 24);
+  };
+  REQUIRE(dword(0) == 0);            // dwVersion
+  REQUIRE(dword(4) == 2);            // dwFormat
+  REQUIRE(dword(8) == 2);            // dwPointsPerValue
+  REQUIRE(dword(12) == blockSize);   // dwBlockSize
+  REQUIRE(dword(16) == numChannels); // dwPeakChannels
+  REQUIRE(dword(20) == numBlocks);   // dwNumPeakFrames
+  REQUIRE(dword(24) == 0xFFFFFFFF);  // dwPosPeakOfPeaks
+  REQUIRE(dword(28) == 128);         // dwOffsetToPeaks
+  REQUIRE(chunk[32 + 4] == ':');     // strTimestamp "YYYY:MM:DD:hh-mm-ss:uuu"
+  REQUIRE(chunk[32 + 13] == '-');
+  for (int i = 0; i < numBlocks * numChannels; ++i) {
+    const int pos = chunk[120 + 4*i] | (chunk[121 + 4*i] << 8);
+    const int neg = chunk[122 + 4*i] | (chunk[123 + 4*i] << 8);
+    REQUIRE(pos == std::lround(std::max(expected[i].max, 0.0f) * INT16_MAX));
+    REQUIRE(neg == std::lround(std::max(-expected[i].min, 0.0f) * INT16_MAX));
+  }
+}
+
+TEST_CASE("Tinywav - 'levl' peaks beyond full scale")
+{
+  const char* testFile = "testFileLevl.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numFrames = 3 * 256;
+  std::vector<float> samples(numFrames, 0.0f);
+  samples[10] = 1.5f;   // 1st block: both peaks beyond full scale
+  samples[20] = -1.9f;
+  samples[256 + 10] = 2.5f; // 2nd block: only the positive one
+  samples[256 + 20] = -0.25f;
+  samples[512 + 10] = 0.5f; // 3rd block: within full scale
+  samples[512 + 20] = -1.0f;
+  
+  TinyWav tw;
+  TinyWavPeaks peaks;
+  std::vector<TinyWavPeak> bins(8);
+  REQUIRE(tinywav_open_write(&tw, 1, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_set_levl(&tw, &peaks, bins.data(), 8) == 0);
+  REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  const TinyWavChunk* levl = tinywav_find_chunk(&tw, "levl");
+  REQUIRE(levl != nullptr);
+  REQUIRE(levl->size == 120 + 3 * 4);
+  std::vector<uint8_t> chunk(levl->size);
+  REQUIRE(tinywav_read_chunk(&tw, levl, chunk.data(), static_cast<int>(chunk.size())) == static_cast<int>(levl->size));
+  tinywav_close_read(&tw);
+  
+  const int expected[3][2] = { { 32767, 32767 }, { 32767, 8192 }, { 16384, 32767 } };
+  for (int i = 0; i < 3; ++i) {
+    CAPTURE(i);
+    REQUIRE((chunk[120 + 4*i] | (chunk[121 + 4*i] << 8)) == expected[i][0]);
+    REQUIRE((chunk[122 + 4*i] | (chunk[123 + 4*i] << 8)) == expected[i][1]);
+  }
+}
+
+static std::string md5String(const TinyWavHash& hash)
+{
+  static const char* digits = "0123456789abcdef";
+  std::string s;
+  for (uint8_t b : hash.md5) {
+    s += digits[b >> 4];
+    s += digits[b & 15];
+  }
+  return s;
+}
+
+TEST_CASE("Tinywav - Hash of the audio data")
+{
+  const char* testFile = "testFileHash.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  
+  SECTION("reference values") {
+    // G.711 files have one byte per sample, so the data chunk can hold any byte string
+    struct Vector { std::string data; uint64_t xxh64; const char* md5; };
+    const Vector vectors[] = {
+      { "", 0xEF46DB3751D8E999ULL, "d41d8cd98f00b204e9800998ecf8427e" },
+      { "abc", 0x44BC2CF5AD770999ULL, "900150983cd24fb0d6963f7d28e17f72" },
+      { "Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ULL, "bb649c83dd1ea5c9d9dec9a18df0ffe9" },
+    };
+    const int blockSize = GENERATE(1, 7, 64);
+    for (const Vector& v : vectors) {
+      CAPTURE(v.data, blockSize);
+      TestCommon::writeWavFile(testFile, TW_FORMAT_ALAW, 1, 8000, 8, 1, std::vector<uint8_t>(v.data.begin(), v.data.end()));
+      TinyWav tw;
+      TinyWavHash hash;
+      REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+      REQUIRE(tinywav_set_hash(&tw, &hash, TW_HASH_XXH64 | TW_HASH_MD5) == 0);
+      std::vector<float> samples(blockSize);
+      while (tinywav_read_f(&tw, samples.data(), blockSize) > 0) {}
+      tinywav_close_read(&tw);
+      REQUIRE(hash.length == v.data.size());
+      REQUIRE(hash.xxh64 == v.xxh64);
+      REQUIRE(md5String(hash) == v.md5);
+    }
+  }
+  
+  SECTION("written and read data hash the same") {
+    const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+    constexpr int numChannels = 2;
+    constexpr int numFrames = 1000;
+    const std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels);
+    
+    TinyWav tw;
+    TinyWavHash writeHash;
+    REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_set_hash(&tw, &writeHash, TW_HASH_XXH64 | TW_HASH_MD5) == 0);
+    REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), 333) == 333);
+    REQUIRE(tinywav_write_f(&tw, (void*)(samples.data() + 333 * numChannels), numFrames - 333) == numFrames - 333);
+    tinywav_close_write(&tw);
+    REQUIRE(writeHash.length == static_cast<uint64_t>(numFrames * numChannels * sampleFormat));
+    
+    // metadata after the audio data must not change the hash
+    TinyWavPeaks peaks;
+    std::vector<TinyWavPeak> bins(64 * numChannels);
+    TinyWavHash levlHash;
+    REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_set_levl(&tw, &peaks, bins.data(), 64) == 0);
+    REQUIRE(tinywav_set_hash(&tw, &levlHash, TW_HASH_XXH64) == 0);
+    REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), numFrames) == numFrames);
+    tinywav_close_write(&tw);
+    REQUIRE(levlHash.xxh64 == writeHash.xxh64);
+    
+    TinyWavHash readHash;
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_set_hash(&tw, &readHash, TW_HASH_XXH64 | TW_HASH_MD5) == 0);
+    std::vector<float> block(100 * numChannels);
+    while (tinywav_read_f(&tw, block.data(), 100) > 0) {} // up to the 'levl' chunk after the data chunk
+    tinywav_close_read(&tw);
+    REQUIRE(readHash.length == writeHash.length);
+    REQUIRE(readHash.xxh64 == writeHash.xxh64);
+    REQUIRE(md5String(readHash) == md5String(writeHash));
+  }
+  
+  SECTION("ADPCM blocks read more than once are hashed once") {
+    std::vector<uint8_t> data(1000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<uint8_t>(i * 7 + 3);
+    const uint8_t fmtExtension[] = { 0xF9, 0x01 }; // 505 samples per block of 256 bytes
+    TestCommon::writeWavFile(testFile, TW_FORMAT_IMA_ADPCM, 1, 8000, 4, 256, data,
+                             std::vector<uint8_t>(fmtExtension, fmtExtension + 2));
+    TinyWav tw;
+    TinyWavHash hash;
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_set_hash(&tw, &hash, TW_HASH_MD5) == 0);
+    std::vector<float> samples(100);
+    while (tinywav_read_f(&tw, samples.data(), 100) > 0) {}
+    tinywav_close_read(&tw);
+    REQUIRE(hash.length == data.size());
+    REQUIRE(md5String(hash) == "10046f077f2082ac19676b8079f1cb1a");
+  }
+}
+
+TEST_CASE("Tinywav - Channel statistics & clipping")
+{
+  const char* testFile = "testFileStats.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 4800;
+  constexpr int blockSize = 480;
+  
+  // channel 0: a sine with DC offset, channel 1: a sine overdriven to +-1.5, clipping at 1/3 of its samples
+  std::vector<float> samples(numFrames * numChannels);
+  for (int i = 0; i < numFrames; ++i) {
+    const float s = std::sin(2.0f * 3.14159265f * static_cast<float>(i) / 480.0f);
+    samples[i * numChannels] = 0.1f + 0.5f * s;
+    samples[i * numChannels + 1] = 1.5f * s;
+  }
+  
+  CAPTURE(channelFormat);
+  
+  auto blockData = [&](std::vector<float>& block, float** channels) -> void* {
+    return (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+  };
+  auto arrange = [&](int frame, std::vector<float>& block) {
+    for (int i = 0; i < blockSize; ++i) {
+      for (int c = 0; c < numChannels; ++c) {
+        const float v = samples[(frame + i) * numChannels + c];
+        if (channelFormat == TW_INTERLEAVED) block[i * numChannels + c] = v;
+        else block[c * blockSize + i] = v;
+      }
+    }
+  };
+  std::vector<float> block(blockSize * numChannels);
+  float* channels[numChannels] = { block.data(), block.data() + blockSize };
+  
+  TinyWav tw;
+  TinyWavStats stats[numChannels];
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, TW_INT16, channelFormat, testFile) == 0);
+  REQUIRE(tinywav_get_stats(&tw) == nullptr);
+  REQUIRE(tinywav_set_stats(&tw, stats) == 0);
+  for (int frame = 0; frame < numFrames; frame += blockSize) {
+    arrange(frame, block);
+    REQUIRE(tinywav_write_f(&tw, blockData(block, channels), blockSize) == blockSize);
+  }
+  const TinyWavStats* current = tinywav_get_stats(&tw);
+  REQUIRE(current == stats);
+  REQUIRE(current[0].numSamples == numFrames);
+  tinywav_close_write(&tw);
+  
+  double sumSquares = 0.0;
+  int numOver = 0;
+  for (int i = 0; i < numFrames; ++i) {
+    const float v = samples[i * numChannels + 1];
+    sumSquares += v * v;
+    numOver += std::abs(v) >= 1.0f;
+  }
+  REQUIRE(stats[0].peak == Approx(0.6f));
+  REQUIRE(stats[0].dc == Approx(0.1f).margin(1e-5));
+  REQUIRE(stats[0].rms == Approx(std::sqrt(0.01 + 0.125)).epsilon(1e-4));
+  REQUIRE(stats[0].numClipped == 0);
+  REQUIRE(stats[1].peak == Approx(1.5f));
+  REQUIRE(stats[1].dc == Approx(0.0f).margin(1e-5));
+  REQUIRE(stats[1].rms == Approx(std::sqrt(sumSquares / numFrames)));
+  REQUIRE(stats[1].numClipped == static_cast<uint64_t>(numOver));
+  REQUIRE(numOver > numFrames / 4);
+  
+  // the overs were clamped to full scale instead of wrapping around
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  REQUIRE(tinywav_set_stats(&tw, stats) == 0);
+  float minimum = 0.0f;
+  for (int frame = 0; tinywav_read_f(&tw, blockData(block, channels), blockSize) > 0; frame += blockSize) {
+    for (int i = 0; i < blockSize; ++i) {
+      const float v = (channelFormat == TW_INTERLEAVED) ? block[i * numChannels + 1] : block[blockSize + i];
+      REQUIRE(v * samples[(frame + i) * numChannels + 1] >= 0.0f); // no sign flips
+      minimum = std::min(minimum, v);
+    }
+  }
+  tinywav_close_read(&tw);
+  REQUIRE(minimum == -1.0f);
+  REQUIRE(stats[1].peak == 1.0f);
+  REQUIRE(stats[1].numClipped == static_cast<uint64_t>(numOver));
+  REQUIRE(stats[0].numClipped == 0);
+  REQUIRE(stats[0].dc == Approx(0.1f).margin(1e-4));
+  
+  // values within full scale are converted as they are, infinities and NaN are clamped like any other over
+  const float specials[] = { 0.5f, -0.25f, 1.0f, -1.0f, INFINITY, -INFINITY, NAN, 0.0f };
+  for (int withSpecials = 0; withSpecials < 2; ++withSpecials) {
+    const int numValues = withSpecials ? 8 : 4;
+    REQUIRE(tinywav_open_write(&tw, 1, 48000, TW_INT16, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_write_f(&tw, const_cast<float*>(specials), numValues) == numValues);
+    tinywav_close_write(&tw);
+    float read[8];
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_read_f(&tw, read, numValues) == numValues);
+    tinywav_close_read(&tw);
+    REQUIRE(read[0] == Approx(0.5f).margin(1.0f / INT16_MAX));
+    REQUIRE(read[1] == Approx(-0.25f).margin(1.0f / INT16_MAX));
+    REQUIRE(read[2] == 1.0f);
+    REQUIRE(read[3] == -1.0f);
+    if (withSpecials) {
+      REQUIRE(read[4] == 1.0f);
+      REQUIRE(read[5] == -1.0f);
+      REQUIRE(std::abs(read[6]) == 1.0f);
+    }
+  }
+}
+
+/** Statistics of the samples of one channel, computed the straightforward way */
+static void requireStatsOf(const TinyWavStats& stats, const std::vector<float>& values)
+{
+  float peak = 0.0f;
+  uint64_t numClipped = 0;
+  double sum = 0.0, sumSquares = 0.0;
+  for (float v : values) {
+    peak = std::max(peak, std::abs(v));
+    numClipped += std::abs(v) >= 1.0f;
+    sum += v;
+    sumSquares += static_cast<double>(v) * v;
+  }
+  const double n = static_cast<double>(values.size());
+  REQUIRE(stats.numSamples == values.size());
+  REQUIRE(stats.peak == peak);
+  REQUIRE(stats.numClipped == numClipped);
+  REQUIRE(stats.dc == Approx(sum / n).margin(1e-6));
+  REQUIRE(stats.rms == Approx(std::sqrt(sumSquares / n)).epsilon(1e-5));
+}
+
+TEST_CASE("Tinywav - Channel statistics of every conversion path")
+{
+  const char* testFile = "testFileStatsPaths.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavAudioFormat audioFormat = GENERATE(TW_FORMAT_PCM, TW_FORMAT_IEEE_FLOAT, TW_FORMAT_MULAW);
+  const int mapping = GENERATE(0, 1, 2, 3); // none, channel selection, mix, resampler
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  const bool isDithered = GENERATE(false, true);
+  constexpr int numChannels = 3;
+  constexpr int numFrames = 1000;
+  constexpr int blockSize = 96;
+  
+  CAPTURE(audioFormat, mapping, channelFormat, isDithered);
+  
+  // some samples beyond full scale, to be counted and clamped
+  std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels, 3);
+  for (int i = 0; i < numFrames * numChannels; i += 7) {
+    samples[i] *= 1.25f;
+  }
+  TinyWav tw;
+  if (audioFormat == TW_FORMAT_MULAW) {
+    if (isDithered) return; // not written by tinywav
+    std::vector<uint8_t> codes(samples.size());
+    for (size_t i = 0; i < codes.size(); ++i) {
+      codes[i] = static_cast<uint8_t>(i * 37);
+    }
+    TestCommon::writeWavFile(testFile, TW_FORMAT_MULAW, numChannels, 48000, 8, numChannels, codes);
+  } else {
+    const TinyWavSampleFormat sampleFormat = (audioFormat == TW_FORMAT_PCM) ? TW_INT16 : TW_FLOAT32;
+    if (isDithered && sampleFormat == TW_FLOAT32) return; // dither is for 16-bit int only
+    std::vector<float> block = (channelFormat == TW_INTERLEAVED) ? samples : TestCommon::deinterleave(samples, numChannels);
+    float* channels[numChannels] = { block.data(), block.data() + numFrames, block.data() + 2 * numFrames };
+    TinyWavStats stats[numChannels];
+    REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, channelFormat, testFile) == 0);
+    REQUIRE(tinywav_set_stats(&tw, stats) == 0);
+    if (isDithered) {
+      REQUIRE(tinywav_set_dither(&tw, TW_DITHER_TPDF, 1) == 0);
+    }
+    void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+    REQUIRE(tinywav_write_f(&tw, data, numFrames) == numFrames);
+    tinywav_close_write(&tw);
+    for (int c = 0; c < numChannels; ++c) {
+      std::vector<float> written(numFrames);
+      for (int i = 0; i < numFrames; ++i) written[i] = samples[i * numChannels + c];
+      requireStatsOf(stats[c], written);
+    }
+  }
+  
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  int numOut = numChannels;
+  const int selection[] = { 2, 0 };
+  const float matrix[] = { 0.5f, 0.5f, 0.0f, 0.0f, 0.75f, 0.75f }; // the second output can go beyond full scale
+  TinyWavResampler resampler;
+  std::vector<float> memory;
+  if (mapping == 1) {
+    REQUIRE(tinywav_select_channels(&tw, selection, 2) == 0);
+    numOut = 2;
+  } else if (mapping == 2) {
+    REQUIRE(tinywav_set_mix(&tw, matrix, nullptr, 2) == 0);
+    numOut = 2;
+  } else if (mapping == 3) {
+    memory.resize(tinywav_resampler_size(&tw, 32000) / sizeof(float) + 1);
+    REQUIRE(tinywav_set_resampler(&tw, &resampler, 32000, memory.data(), memory.size() * sizeof(float)) == 0);
+  }
+  std::vector<TinyWavStats> stats(numOut);
+  REQUIRE(tinywav_set_stats(&tw, stats.data()) == 0);
+  
+  std::vector<std::vector<float>> values(numOut);
+  std::vector<float> block(blockSize * numOut);
+  std::vector<float*> channels(numOut);
+  for (int c = 0; c < numOut; ++c) {
+    channels[c] = block.data() + c * blockSize;
+  }
+  void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels.data()) : block.data();
+  int n;
+  while ((n = tinywav_read_f(&tw, data, blockSize)) > 0) {
+    for (int c = 0; c < numOut; ++c) {
+      for (int i = 0; i < n; ++i) {
+        switch (channelFormat) {
+          case TW_INTERLEAVED: values[c].push_back(block[i * numOut + c]); break;
+          case TW_INLINE: values[c].push_back(block[c * n + i]); break; // the channels of a short block are adjacent
+          default: values[c].push_back(channels[c][i]); break;
+        }
+      }
+    }
+  }
+  REQUIRE(tinywav_get_stats(&tw) == stats.data());
+  tinywav_close_read(&tw);
+  
+  for (int c = 0; c < numOut; ++c) {
+    CAPTURE(c);
+    REQUIRE(values[c].size() > static_cast<size_t>(numFrames / 2));
+    requireStatsOf(stats[c], values[c]);
+  }
+}
+
+TEST_CASE("Tinywav - Dither and noise shaping for 16-bit int")
+{
+  const char* testFile = "testFileDither.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 48000;
+  constexpr int blockSize = 480;
+  
+  // channel 0: a constant level of 0.3 LSB, which truncation turns into silence, channel 1: a sine at -6 dBFS
+  std::vector<float> samples(numFrames * numChannels);
+  for (int i = 0; i < numFrames; ++i) {
+    samples[i * numChannels] = 0.3f / INT16_MAX;
+    samples[i * numChannels + 1] = 0.5f * std::sin(2.0f * 3.14159265f * static_cast<float>(i) / 480.0f);
+  }
+  
+  // writes the samples and returns them read back as interleaved LSBs
+  auto writeDithered = [&](TinyWavChannelFormat channelFormat, TinyWavDither dither, uint32_t seed) {
+    std::vector<float> block(blockSize * numChannels);
+    float* channels[numChannels] = { block.data(), block.data() + blockSize };
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, numChannels, 48000, TW_INT16, channelFormat, testFile) == 0);
+    REQUIRE(tinywav_set_dither(&tw, dither, seed) == 0);
+    for (int frame = 0; frame < numFrames; frame += blockSize) {
+      for (int i = 0; i < blockSize; ++i) {
+        for (int c = 0; c < numChannels; ++c) {
+          const float v = samples[(frame + i) * numChannels + c];
+          if (channelFormat == TW_INTERLEAVED) block[i * numChannels + c] = v;
+          else block[c * blockSize + i] = v;
+        }
+      }
+      void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+      REQUIRE(tinywav_write_f(&tw, data, blockSize) == blockSize);
+    }
+    tinywav_close_write(&tw);
+    
+    std::vector<float> read(numFrames * numChannels);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_read_f(&tw, read.data(), numFrames) == numFrames);
+    tinywav_close_read(&tw);
+    std::vector<int> lsb(read.size());
+    for (size_t i = 0; i < read.size(); ++i) {
+      lsb[i] = static_cast<int>(std::lround(read[i] * INT16_MAX));
+    }
+    return lsb;
+  };
+  
+  // mean and lag-1 autocorrelation of the error of a channel, in LSB
+  auto errorMoments = [&](const std::vector<int>& lsb, int c, double& mean, double& correlation) {
+    std::vector<double> e(numFrames);
+    for (int i = 0; i < numFrames; ++i) {
+      e[i] = lsb[i * numChannels + c] - samples[i * numChannels + c] * INT16_MAX;
+    }
+    mean = 0.0;
+    for (double v : e) mean += v;
+    mean /= numFrames;
+    double variance = 0.0, covariance = 0.0;
+    for (int i = 0; i < numFrames; ++i) {
+      variance += (e[i] - mean) * (e[i] - mean);
+      if (i > 0) covariance += (e[i] - mean) * (e[i - 1] - mean);
+    }
+    correlation = covariance / variance;
+  };
+  
+  SECTION("truncation loses levels below 1 LSB") {
+    const std::vector<int> lsb = writeDithered(TW_INTERLEAVED, TW_DITHER_NONE, 0);
+    for (int i = 0; i < numFrames; ++i) {
+      REQUIRE(lsb[i * numChannels] == 0);
+    }
+  }
+  
+  SECTION("TPDF dither") {
+    const std::vector<int> lsb = writeDithered(TW_INTERLEAVED, TW_DITHER_TPDF, 1);
+    double mean, correlation;
+    errorMoments(lsb, 0, mean, correlation);
+    REQUIRE(mean == Approx(0.0).margin(0.02)); // the level below 1 LSB is preserved on average
+    REQUIRE(correlation == Approx(0.0).margin(0.05));
+    errorMoments(lsb, 1, mean, correlation);
+    REQUIRE(mean == Approx(0.0).margin(0.02));
+    REQUIRE(correlation == Approx(0.0).margin(0.05));
+    for (int i = 0; i < numFrames * numChannels; ++i) {
+      REQUIRE(std::abs(lsb[i] - samples[i] * INT16_MAX) <= 1.5f);
+    }
+    
+    // the noise depends only on the seed, not on the channel format
+    REQUIRE(writeDithered(TW_INLINE, TW_DITHER_TPDF, 1) == lsb);
+    REQUIRE(writeDithered(TW_SPLIT, TW_DITHER_TPDF, 1) == lsb);
+    REQUIRE(writeDithered(TW_INTERLEAVED, TW_DITHER_TPDF, 2) != lsb);
+  }
+  
+  SECTION("TPDF dither with noise shaping") {
+    const std::vector<int> lsb = writeDithered(TW_SPLIT, TW_DITHER_TPDF_SHAPED, 1);
+    double mean, correlation;
+    for (int c = 0; c < numChannels; ++c) {
+      errorMoments(lsb, c, mean, correlation);
+      REQUIRE(mean == Approx(0.0).margin(0.02));
+      REQUIRE(correlation == Approx(-0.5).margin(0.05)); // first-order highpass
+    }
+  }
+  
+  SECTION("too many channels") {
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, TINYWAV_MAX_DITHER_CHANNELS + 1, 48000, TW_INT16, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_set_dither(&tw, TW_DITHER_TPDF, 1) == -1);
+    REQUIRE(tinywav_set_dither(&tw, TW_DITHER_NONE, 0) == 0);
+    tinywav_close_write(&tw);
+  }
+}
@@ -2,6 +2,7 @@
 #include <catch2/catch.hpp>
 #include "tinywav.h"
 
+#include <cstdio>  // for remove
 #include <cstring> // for memset
 #include "TestCommon.hpp"
 
@@ -15,6 +16,7 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   const int frameSize = blockSize * numChannels;
 
   const char* testFile = "testFile.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
 
   if (TestCommon::fileExists(testFile)) {
       REQUIRE(remove(testFile) == 0);
@@ -26,6 +28,9 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
 
   const int numBlocks = static_cast<int>(std::ceil(static_cast<float>(numSamples)/blockSize));
   const auto bytesPerSample = static_cast<int>(sampleFormat);
+  const bool isExtensible = numChannels > 2; // WAVE_FORMAT_EXTENSIBLE is used for more than two channels
+  const int fmtSize = isExtensible ? 40 : 16;
+  const int audioFormat = isExtensible ? TW_FORMAT_EXTENSIBLE : (int)sampleFormat-1; // 1 PCM, 3 IEEE float
 
   // Test data
   const std::vector<float> samples = TestCommon::createRandomVector(numSamples*numChannels);
@@ -57,8 +62,9 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   REQUIRE(tw.h.Subchunk1ID[1] == 'm');
   REQUIRE(tw.h.Subchunk1ID[2] == 't');
   REQUIRE(tw.h.Subchunk1ID[3] == ' ');
-  REQUIRE(tw.h.Subchunk1Size == 16); // PCM
-  REQUIRE(tw.h.AudioFormat == (int)sampleFormat-1); // 1 PCM, 3 IEEE float
+  REQUIRE(tw.h.Subchunk1Size == fmtSize);
+  REQUIRE(tw.h.AudioFormat == audioFormat);
+  REQUIRE(tw.audioFormat == (int)sampleFormat-1); // 1 PCM, 3 IEEE float
   REQUIRE(tw.h.NumChannels == numChannels);
   REQUIRE(tw.h.SampleRate == sampleRate);
   REQUIRE(tw.h.ByteRate == sampleRate * numChannels * bytesPerSample);
@@ -95,7 +101,7 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   REQUIRE(tw.totalFramesReadWritten == frameCount);
   
   int totalPayload = frameCount * numChannels * bytesPerSample;
-  REQUIRE(tw.h.ChunkSize == 36 + totalPayload);
+  REQUIRE(tw.h.ChunkSize == 20 + fmtSize + totalPayload);
   REQUIRE(tw.h.Subchunk2Size == totalPayload);
 
   // Wipe struct in between (test with and without)
@@ -118,7 +124,7 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   REQUIRE(tw.h.ChunkID[2] == 'F');
   REQUIRE(tw.h.ChunkID[3] == 'F');
 
-  int headerSize = 4 /*WAVE*/ + 8 /*Subchunk1ID(fmt ) + SubChunkIDSize*/ + 16 /*Subchunk1*/ + 8 /*Subchunk1ID(data) + SubChunkIDSize*/;
+  int headerSize = 4 /*WAVE*/ + 8 /*Subchunk1ID(fmt ) + SubChunkIDSize*/ + fmtSize /*Subchunk1*/ + 8 /*Subchunk1ID(data) + SubChunkIDSize*/;
   REQUIRE(tw.h.ChunkSize == headerSize + frameCount * numChannels * bytesPerSample);
   REQUIRE(tw.h.Format[0] == 'W');
   REQUIRE(tw.h.Format[1] == 'A');
@@ -128,8 +134,9 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   REQUIRE(tw.h.Subchunk1ID[1] == 'm');
   REQUIRE(tw.h.Subchunk1ID[2] == 't');
   REQUIRE(tw.h.Subchunk1ID[3] == ' ');
-  REQUIRE(tw.h.Subchunk1Size == 16); // PCM
-  REQUIRE(tw.h.AudioFormat == (int)sampleFormat-1); // 1 PCM, 3 IEEE float
+  REQUIRE(tw.h.Subchunk1Size == fmtSize);
+  REQUIRE(tw.h.AudioFormat == audioFormat);
+  REQUIRE(tw.audioFormat == (int)sampleFormat-1); // 1 PCM, 3 IEEE float
   REQUIRE(tw.h.NumChannels == numChannels);
   REQUIRE(tw.h.SampleRate == sampleRate);
   REQUIRE(tw.h.ByteRate == sampleRate * numChannels * bytesPerSample);
@@ -176,11 +183,102 @@ TEST_CASE("Tinywav - Basic Reading/Writing Loop", "aka Eat Your Own Dog Food")
   }
 }
 
+TEST_CASE("Tinywav - WAVE_FORMAT_EXTENSIBLE")
+{
+  const char* testFile = "testFileExtensible.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  constexpr int numChannels = 6;
+  constexpr int numSamples = 32;
+  const std::vector<float> samples = TestCommon::createRandomVector(numSamples*numChannels);
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tw.h.AudioFormat == TW_FORMAT_EXTENSIBLE);
+  REQUIRE(tw.h.cbSize == 22);
+  REQUIRE(tw.h.ValidBitsPerSample == 8 * sampleFormat);
+  tw.h.ChannelMask = 0x3F; // 5.1
+  REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), numSamples) == numSamples);
+  tinywav_close_write(&tw);
+  
+  memset(&tw, 0, sizeof(TinyWav));
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tw.h.AudioFormat == TW_FORMAT_EXTENSIBLE);
+  REQUIRE(tw.audioFormat == (int)sampleFormat-1);
+  REQUIRE(tw.sampFmt == sampleFormat);
+  REQUIRE(tw.h.cbSize == 22);
+  REQUIRE(tw.h.ValidBitsPerSample == 8 * sampleFormat);
+  REQUIRE(tw.h.ChannelMask == 0x3F);
+  REQUIRE(tw.h.SubFormat[0] == (int)sampleFormat-1);
+  REQUIRE(tw.h.SubFormat[15] == 0x71);
+  REQUIRE(tw.numFramesInHeader == numSamples);
+  
+  std::vector<float> readSamples(samples.size());
+  REQUIRE(tinywav_read_f(&tw, readSamples.data(), numSamples) == numSamples);
+  REQUIRE(tinywav_read_f(&tw, readSamples.data(), numSamples) == 0);
+  tinywav_close_read(&tw);
+  
+  if (sampleFormat == TW_FLOAT32) {
+    REQUIRE(samples == readSamples);
+  }
+}
+
+TEST_CASE("Tinywav - WAVE_FORMAT_EXTENSIBLE SubFormat and valid bits")
+{
+  const char* testFile = "testFileExtensibleGuid.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 4;
+  const std::vector<uint8_t> pcmTail = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+  const std::vector<uint8_t> ambisonicTail = {0x21, 0x07, 0xD3, 0x11, 0x86, 0x44, 0xC8, 0xC1, 0xCA, 0x00, 0x00, 0x00};
+  
+  // the fmt extension holds ValidBitsPerSample, ChannelMask and the SubFormat GUID
+  auto writeFile = [&](uint16_t bitsPerSample, uint16_t validBits, uint16_t formatTag, bool isAmbisonic) {
+    std::vector<uint8_t> extension;
+    TestCommon::putLE(extension, validBits, 2);
+    TestCommon::putLE(extension, 0x33, 4);
+    if (isAmbisonic) {
+      TestCommon::putLE(extension, formatTag, 4); // B-format GUIDs have the tag in a 32-bit first field
+      extension.insert(extension.end(), ambisonicTail.begin(), ambisonicTail.end());
+    } else {
+      TestCommon::putLE(extension, formatTag, 2);
+      extension.insert(extension.end(), pcmTail.begin(), pcmTail.end());
+    }
+    const uint16_t blockAlign = static_cast<uint16_t>(numChannels * bitsPerSample / 8);
+    const std::vector<uint8_t> data(10 * blockAlign, 0);
+    TestCommon::writeWavFile(testFile, TW_FORMAT_EXTENSIBLE, numChannels, 48000, bitsPerSample, blockAlign, data, extension);
+  };
+  
+  TinyWav tw;
+  TinyWavInfo info;
+  SECTION("fewer valid bits than the container holds") {
+    writeFile(16, 12, TW_FORMAT_PCM, false);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tw.audioFormat == TW_FORMAT_PCM);
+    REQUIRE(tw.sampFmt == TW_INT16);
+    REQUIRE(tw.numFramesInHeader == 10);
+    tinywav_close_read(&tw);
+  }
+  SECTION("Ambisonic B-format GUID") {
+    writeFile(16, 16, TW_FORMAT_PCM, true);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) != 0);
+    REQUIRE(tinywav_probe(testFile, &info) != 0);
+  }
+  SECTION("more valid bits than the container holds") {
+    writeFile(16, 20, TW_FORMAT_PCM, false);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) != 0);
+    REQUIRE(tinywav_probe(testFile, &info) != 0);
+  }
+  SECTION("float with unused bits") {
+    writeFile(32, 24, TW_FORMAT_IEEE_FLOAT, false);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) != 0);
+  }
+}
 
 TEST_CASE("Tinywav - Test Error Behaviour")
 {
   TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
   TinyWav tw;
+  const TestCommon::ScopedFile removeBogusFile("bogus.wav");
   
   if (TestCommon::fileExists("bogus.wav")) {
     REQUIRE(std::remove("bogus.wav") == 0);
@@ -245,3 +343,194 @@ TEST_CASE("Tinywav - Test Error Behaviour")
   }
   
 }
+
+TEST_CASE("Tinywav - Channel selection")
+{
+  const char* testFile = "testFileSelection.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  constexpr int numChannels = 8;
+  constexpr int numFrames = 100;
+  constexpr int blockSize = 30;
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels);
+  
+  CAPTURE(sampleFormat, channelFormat);
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write(&tw, numChannels, 16000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  // all channels, for reference
+  std::vector<float> all(numFrames * numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tinywav_read_f(&tw, all.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  
+  const int selection[] = { 5, 0, 5 };
+  constexpr int numSelected = 3;
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  const int invalid[] = { 8 };
+  REQUIRE(tinywav_select_channels(&tw, invalid, 1) == -1);
+  REQUIRE(tinywav_select_channels(&tw, selection, 0) == -1);
+  REQUIRE(tinywav_select_channels(&tw, selection, numSelected) == 0);
+  TinyWavStats stats[numSelected];
+  REQUIRE(tinywav_set_stats(&tw, stats) == 0);
+  
+  std::vector<float> block(blockSize * numSelected, -42.0f);
+  float* channels[numSelected] = { block.data(), block.data() + blockSize, block.data() + 2 * blockSize };
+  void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+  int frame = 0;
+  for (int n; (n = tinywav_read_f(&tw, data, blockSize)) > 0; frame += n) {
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k < numSelected; ++k) {
+        const int channelStride = (channelFormat == TW_SPLIT) ? blockSize : n;
+        const float v = (channelFormat == TW_INTERLEAVED) ? block[i * numSelected + k] : block[k * channelStride + i];
+        REQUIRE(v == all[(frame + i) * numChannels + selection[k]]);
+      }
+    }
+  }
+  REQUIRE(frame == numFrames);
+  tinywav_close_read(&tw);
+  REQUIRE(stats[0].numSamples == numFrames);
+  REQUIRE(stats[0].sum == Approx(stats[2].sum));
+}
+
+TEST_CASE("Tinywav - Channel selection of compressed files")
+{
+  const char* testFile = "testFileSelectionG711.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  std::vector<uint8_t> codes(4 * 50);
+  for (size_t i = 0; i < codes.size(); ++i) codes[i] = static_cast<uint8_t>(i * 37);
+  TestCommon::writeWavFile(testFile, TW_FORMAT_MULAW, 4, 8000, 8, 4, codes);
+  
+  TinyWav tw;
+  std::vector<float> all(codes.size());
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tinywav_read_f(&tw, all.data(), 50) == 50);
+  tinywav_close_read(&tw);
+  
+  const int selection[] = { 3 };
+  std::vector<float> channel(50);
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INLINE) == 0);
+  REQUIRE(tinywav_select_channels(&tw, selection, 1) == 0);
+  REQUIRE(tinywav_read_f(&tw, channel.data(), 50) == 50);
+  tinywav_close_read(&tw);
+  for (int i = 0; i < 50; ++i) {
+    REQUIRE(channel[i] == all[i * 4 + 3]);
+  }
+}
+
+TEST_CASE("Tinywav - Mixing matrix")
+{
+  const char* testFile = "testFileMix.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  constexpr int numChannels = 6; // 5.1: L R C LFE Ls Rs
+  constexpr int numFrames = 200;
+  constexpr int blockSize = 64;
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames * numChannels);
+  
+  CAPTURE(sampleFormat, channelFormat);
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_write_f(&tw, (void*)samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  std::vector<float> all(numFrames * numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tinywav_read_f(&tw, all.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  
+  // ITU-R BS.775 downmix to stereo
+  const float matrix[2 * numChannels] = {
+    1.0f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f,
+    0.0f, 1.0f, 0.7071f, 0.0f, 0.0f, 0.7071f,
+  };
+  const float gains[2] = { 0.5f, 0.25f };
+  const int selection[] = { 0 };
+  
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  REQUIRE(tinywav_set_mix(&tw, matrix, gains, 0) == -1);
+  REQUIRE(tinywav_set_mix(&tw, matrix, gains, 2) == 0);
+  REQUIRE(tinywav_select_channels(&tw, selection, 1) == -1); // either mix or select
+  std::vector<float> block(blockSize * 2);
+  float* channels[2] = { block.data(), block.data() + blockSize };
+  void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+  int frame = 0;
+  for (int n; (n = tinywav_read_f(&tw, data, blockSize)) > 0; frame += n) {
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k < 2; ++k) {
+        float expected = 0.0f;
+        for (int c = 0; c < numChannels; ++c) expected += matrix[k * numChannels + c] * all[(frame + i) * numChannels + c];
+        expected *= gains[k];
+        const int channelStride = (channelFormat == TW_SPLIT) ? blockSize : n;
+        const float v = (channelFormat == TW_INTERLEAVED) ? block[i * 2 + k] : block[k * channelStride + i];
+        REQUIRE(v == Approx(expected).margin(1e-6));
+      }
+    }
+  }
+  REQUIRE(frame == numFrames);
+  tinywav_close_read(&tw);
+}
+
+TEST_CASE("Tinywav - Sample rate conversion while reading")
+{
+  const char* testFile = "testFileResample.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const auto rates = GENERATE(std::make_pair(48000, 16000), std::make_pair(44100, 16000),
+                              std::make_pair(16000, 48000), std::make_pair(44100, 48000));
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  const int inRate = rates.first;
+  const int outRate = rates.second;
+  constexpr int numChannels = 2;
+  constexpr int blockSize = 100;
+  const int numFrames = inRate / 10 + 7; // a bit more than 0.1 seconds
+  const double frequencies[numChannels] = { 1000.0, 3000.0 };
+  const double pi = 3.14159265358979323846;
+  
+  CAPTURE(inRate, outRate, channelFormat);
+  
+  std::vector<float> samples(numFrames * numChannels);
+  for (int i = 0; i < numFrames; ++i) {
+    for (int c = 0; c < numChannels; ++c) {
+      samples[i * numChannels + c] = static_cast<float>(0.5 * std::sin(2.0 * pi * frequencies[c] * i / inRate));
+    }
+  }
+  TinyWav tw;
+  REQUIRE(tinywav_open_write(&tw, numChannels, inRate, TW_FLOAT32, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  TinyWavResampler resampler;
+  const size_t size = tinywav_resampler_size(&tw, outRate);
+  REQUIRE(size > 0);
+  std::vector<float> memory(size / sizeof(float));
+  REQUIRE(tinywav_set_resampler(&tw, &resampler, outRate, memory.data(), size - 1) == -1);
+  REQUIRE(tinywav_set_resampler(&tw, &resampler, outRate, memory.data(), size) == 0);
+  const int expectedFrames = static_cast<int>((static_cast<int64_t>(numFrames) * outRate + inRate - 1) / inRate);
+  REQUIRE(resampler.numFrames == expectedFrames);
+  
+  std::vector<float> block(blockSize * numChannels);
+  float* channels[numChannels] = { block.data(), block.data() + blockSize };
+  void* data = (channelFormat == TW_SPLIT) ? static_cast<void*>(channels) : block.data();
+  const int margin = 40; // the filter sees silence before the start and after the end of the file
+  int frame = 0;
+  for (int n; (n = tinywav_read_f(&tw, data, blockSize)) > 0; frame += n) {
+    for (int i = 0; i < n; ++i) {
+      if (frame + i < margin || frame + i >= expectedFrames - margin) continue;
+      for (int c = 0; c < numChannels; ++c) {
+        const int channelStride = (channelFormat == TW_SPLIT) ? blockSize : n;
+        const float v = (channelFormat == TW_INTERLEAVED) ? block[i * numChannels + c] : block[c * channelStride + i];
+        const double expected = 0.5 * std::sin(2.0 * pi * frequencies[c] * (frame + i) / outRate);
+        REQUIRE(v == Approx(expected).margin(2e-3));
+      }
+    }
+  }
+  REQUIRE(frame == expectedFrames);
+  tinywav_close_read(&tw);
+}
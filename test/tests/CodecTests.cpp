@@ -0,0 +1,381 @@
+
+#include <catch2/catch.hpp>
+#include "tinywav.h"
+
+#include "TestCommon.hpp"
+
+#include <cstdio> // for remove
+
+TEST_CASE("Read G.711 A-law & mu-law wave files")
+{
+  const char* testFile = "testFileG711.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const uint16_t audioFormat = GENERATE(TW_FORMAT_ALAW, TW_FORMAT_MULAW);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 128; // every code exactly once
+  
+  std::vector<uint8_t> codes(numChannels*numFrames);
+  for (int i = 0; i < numChannels*numFrames; ++i) {
+    codes[i] = static_cast<uint8_t>(i);
+  }
+  TestCommon::writeWavFile(testFile, audioFormat, numChannels, 8000, 8, numChannels, codes);
+  
+  CAPTURE(audioFormat, channelFormat);
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  REQUIRE(tw.audioFormat == audioFormat);
+  REQUIRE(tw.sampFmt == TW_INT16);
+  REQUIRE(tw.h.Subchunk1Size == 18);
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  
+  std::vector<float> samples(numChannels*numFrames);
+  if (channelFormat == TW_SPLIT) {
+    float* splitBuffer[numChannels] = { samples.data(), samples.data() + numFrames };
+    REQUIRE(tinywav_read_f(&tw, splitBuffer, numFrames) == numFrames);
+  } else {
+    REQUIRE(tinywav_read_f(&tw, samples.data(), numFrames) == numFrames);
+  }
+  REQUIRE(tinywav_read_f(&tw, samples.data(), 1) == 0);
+  tinywav_close_read(&tw);
+  
+  if (channelFormat != TW_INTERLEAVED) {
+    samples = TestCommon::interleave(samples, numChannels);
+  }
+  
+  // spot-check a few well-known code points
+  if (audioFormat == TW_FORMAT_MULAW) {
+    REQUIRE(samples[0x00] == Approx(-32124.0f / INT16_MAX));
+    REQUIRE(samples[0x80] == Approx(32124.0f / INT16_MAX));
+    REQUIRE(samples[0xFF] == 0.0f);
+    REQUIRE(samples[0x7F] == 0.0f);
+  } else {
+    REQUIRE(samples[0xD5] == Approx(8.0f / INT16_MAX));
+    REQUIRE(samples[0x55] == Approx(-8.0f / INT16_MAX));
+    REQUIRE(samples[0xAA] == Approx(32256.0f / INT16_MAX));
+    REQUIRE(samples[0x2A] == Approx(-32256.0f / INT16_MAX));
+  }
+  // both laws are sign-symmetric around code 0x80
+  for (int i = 0; i < 0x80; ++i) {
+    REQUIRE(samples[i] == -samples[i + 0x80]);
+  }
+  
+  // the same as 16-bit int, read in two parts up to the end of the data chunk
+  std::vector<int16_t> decoded(numChannels*numFrames + numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  REQUIRE(tinywav_read_int16(&tw, decoded.data(), 100) == 100);
+  REQUIRE(tinywav_read_int16(&tw, decoded.data() + 100*numChannels, numFrames) == numFrames - 100);
+  REQUIRE(tinywav_read_int16(&tw, decoded.data(), 1) == 0);
+  tinywav_close_read(&tw);
+  for (int i = 0; i < numChannels*numFrames; ++i) {
+    REQUIRE(samples[i] == static_cast<float>(decoded[i]) / INT16_MAX);
+  }
+  if (audioFormat == TW_FORMAT_MULAW) {
+    REQUIRE(decoded[0x00] == -32124);
+    REQUIRE(decoded[0xFF] == 0);
+  } else {
+    REQUIRE(decoded[0xD5] == 8);
+    REQUIRE(decoded[0xAA] == 32256);
+  }
+}
+
+namespace {
+
+struct AdpcmFile {
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> fmtExtension;
+  std::vector<float> expected; // interleaved, as the decoder should reconstruct it
+  std::vector<int16_t> decoded; // the same as 16-bit int
+  int blockAlign;
+};
+
+/** Reference IMA ADPCM encoder, keeping track of the decoder state to predict the exact decoded output. */
+AdpcmFile encodeIma(const std::vector<int16_t>& x, int numChannels, int blockAlign)
+{
+  static const int steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767 };
+  static const int indexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+  
+  AdpcmFile file;
+  file.blockAlign = blockAlign;
+  const int framesPerBlock = 1 + (blockAlign - 4*numChannels) / (4*numChannels) * 8;
+  TestCommon::putLE(file.fmtExtension, static_cast<uint32_t>(framesPerBlock), 2);
+  const int numFrames = static_cast<int>(x.size()) / numChannels;
+  file.expected.resize(x.size());
+  file.decoded.resize(x.size());
+  std::vector<int> index(numChannels, 0);
+  
+  for (int start = 0; start < numFrames; start += framesPerBlock) {
+    const int frames = std::min(framesPerBlock, numFrames - start);
+    REQUIRE((frames - 1) % 8 == 0); // this simple encoder only writes complete nibble groups
+    const size_t blockStart = file.data.size();
+    file.data.resize(blockStart + 4*numChannels + (frames - 1) / 8 * 4 * numChannels, 0);
+    for (int c = 0; c < numChannels; ++c) {
+      int predictor = x[start*numChannels + c];
+      file.data[blockStart + 4*c + 0] = static_cast<uint8_t>(predictor & 0xFF);
+      file.data[blockStart + 4*c + 1] = static_cast<uint8_t>((predictor >> 8) & 0xFF);
+      file.data[blockStart + 4*c + 2] = static_cast<uint8_t>(index[c]);
+      file.expected[start*numChannels + c] = static_cast<float>(predictor) / INT16_MAX;
+      file.decoded[start*numChannels + c] = static_cast<int16_t>(predictor);
+      for (int i = 1; i < frames; ++i) {
+        const int step = steps[index[c]];
+        int diff = x[(start+i)*numChannels + c] - predictor;
+        int nibble = (diff < 0) ? 8 : 0;
+        diff = std::abs(diff);
+        if (diff >= step) { nibble |= 4; diff -= step; }
+        if (diff >= step/2) { nibble |= 2; diff -= step/2; }
+        if (diff >= step/4) { nibble |= 1; }
+        int delta = step >> 3;
+        if (nibble & 1) delta += step >> 2;
+        if (nibble & 2) delta += step >> 1;
+        if (nibble & 4) delta += step;
+        predictor = std::max(-32768, std::min(32767, (nibble & 8) ? predictor - delta : predictor + delta));
+        index[c] = std::max(0, std::min(88, index[c] + indexTable[nibble]));
+        const int group = (i - 1) / 8;
+        const int n = (i - 1) % 8;
+        uint8_t& byte = file.data[blockStart + 4*numChannels + (group*numChannels + c)*4 + n/2];
+        byte |= static_cast<uint8_t>((n & 1) ? (nibble << 4) : nibble);
+        file.expected[(start+i)*numChannels + c] = static_cast<float>(predictor) / INT16_MAX;
+        file.decoded[(start+i)*numChannels + c] = static_cast<int16_t>(predictor);
+      }
+    }
+  }
+  return file;
+}
+
+/** Reference MS ADPCM encoder (always using the second predictor), keeping track of the decoder state. */
+AdpcmFile encodeMs(const std::vector<int16_t>& x, int numChannels, int blockAlign)
+{
+  static const int adaptation[16] = { 230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230 };
+  static const int coefs[7][2] = { {256, 0}, {512, -256}, {0, 0}, {192, 64}, {240, 0}, {460, -208}, {392, -232} };
+  constexpr int predictor = 1;
+  
+  AdpcmFile file;
+  file.blockAlign = blockAlign;
+  const int framesPerBlock = 2 + (blockAlign - 7*numChannels) * 2 / numChannels;
+  TestCommon::putLE(file.fmtExtension, static_cast<uint32_t>(framesPerBlock), 2);
+  TestCommon::putLE(file.fmtExtension, 7, 2);
+  for (const auto& coef : coefs) {
+    TestCommon::putLE(file.fmtExtension, static_cast<uint32_t>(coef[0]), 2);
+    TestCommon::putLE(file.fmtExtension, static_cast<uint32_t>(coef[1]), 2);
+  }
+  const int numFrames = static_cast<int>(x.size()) / numChannels;
+  file.expected.resize(x.size());
+  file.decoded.resize(x.size());
+  
+  for (int start = 0; start < numFrames; start += framesPerBlock) {
+    const int frames = std::min(framesPerBlock, numFrames - start);
+    REQUIRE(frames >= 2);
+    const size_t blockStart = file.data.size();
+    file.data.resize(blockStart + 7*numChannels + ((frames - 2) * numChannels + 1) / 2, 0);
+    uint8_t* const block = file.data.data() + blockStart;
+    for (int c = 0; c < numChannels; ++c) {
+      int delta = 16;
+      int sample2 = x[start*numChannels + c];
+      int sample1 = x[(start+1)*numChannels + c];
+      block[c] = predictor;
+      block[numChannels + 2*c] = static_cast<uint8_t>(delta & 0xFF);
+      block[numChannels + 2*c + 1] = static_cast<uint8_t>(delta >> 8);
+      block[3*numChannels + 2*c] = static_cast<uint8_t>(sample1 & 0xFF);
+      block[3*numChannels + 2*c + 1] = static_cast<uint8_t>((sample1 >> 8) & 0xFF);
+      block[5*numChannels + 2*c] = static_cast<uint8_t>(sample2 & 0xFF);
+      block[5*numChannels + 2*c + 1] = static_cast<uint8_t>((sample2 >> 8) & 0xFF);
+      file.expected[start*numChannels + c] = static_cast<float>(sample2) / INT16_MAX;
+      file.decoded[start*numChannels + c] = static_cast<int16_t>(sample2);
+      file.expected[(start+1)*numChannels + c] = static_cast<float>(sample1) / INT16_MAX;
+      file.decoded[(start+1)*numChannels + c] = static_cast<int16_t>(sample1);
+      for (int i = 2; i < frames; ++i) {
+        const int predicted = (sample1 * coefs[predictor][0] + sample2 * coefs[predictor][1]) / 256;
+        const double error = x[(start+i)*numChannels + c] - predicted;
+        const int signedNibble = std::max(-8, std::min(7, static_cast<int>(std::lround(error / delta))));
+        const int nibble = signedNibble & 0x0F;
+        sample2 = sample1;
+        sample1 = std::max(-32768, std::min(32767, predicted + signedNibble * delta));
+        delta = std::max(16, adaptation[nibble] * delta / 256);
+        const int n = (i - 2) * numChannels + c;
+        block[7*numChannels + n/2] |= static_cast<uint8_t>((n & 1) ? nibble : (nibble << 4));
+        file.expected[(start+i)*numChannels + c] = static_cast<float>(sample1) / INT16_MAX;
+        file.decoded[(start+i)*numChannels + c] = static_cast<int16_t>(sample1);
+      }
+    }
+  }
+  return file;
+}
+
+} // namespace
+
+TEST_CASE("Read IMA & MS ADPCM wave files")
+{
+  const char* testFile = "testFileAdpcm.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const uint16_t audioFormat = GENERATE(TW_FORMAT_IMA_ADPCM, TW_FORMAT_MS_ADPCM);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE, TW_SPLIT);
+  const int blockSize = GENERATE(37, 505, 4096); // frames per read: within, exactly and across ADPCM blocks
+  constexpr int numChannels = 2;
+  constexpr int blockAlign = 256 * numChannels;
+  // the last ADPCM block is a short one
+  const int numFrames = (audioFormat == TW_FORMAT_IMA_ADPCM) ? (3*505 + 1 + 8*20) : (3*500 + 123);
+  
+  std::vector<int16_t> x(numChannels*numFrames);
+  for (int i = 0; i < numFrames; ++i) {
+    for (int c = 0; c < numChannels; ++c) {
+      x[i*numChannels + c] = static_cast<int16_t>(20000.0 * std::sin(0.01 * (c+1) * i));
+    }
+  }
+  const AdpcmFile file = (audioFormat == TW_FORMAT_IMA_ADPCM) ? encodeIma(x, numChannels, blockAlign)
+                                                             : encodeMs(x, numChannels, blockAlign);
+  TestCommon::writeWavFile(testFile, audioFormat, numChannels, 22050, 4, blockAlign, file.data, file.fmtExtension);
+  
+  CAPTURE(audioFormat, channelFormat, blockSize);
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+  REQUIRE(tw.audioFormat == audioFormat);
+  REQUIRE(tw.sampFmt == TW_INT16);
+  REQUIRE(tw.h.SamplesPerBlock == ((audioFormat == TW_FORMAT_IMA_ADPCM) ? 505 : 500));
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  
+  std::vector<float> readSamples;
+  std::vector<float> buffer(numChannels*blockSize);
+  int framesRead = 0;
+  do {
+    if (channelFormat == TW_SPLIT) {
+      float* splitBuffer[numChannels] = { buffer.data(), buffer.data() + blockSize };
+      framesRead = tinywav_read_f(&tw, splitBuffer, blockSize);
+    } else {
+      framesRead = tinywav_read_f(&tw, buffer.data(), blockSize);
+    }
+    REQUIRE(framesRead >= 0);
+    if (framesRead > 0) {
+      std::vector<float> block(buffer.begin(), buffer.begin() + numChannels*framesRead);
+      if (channelFormat == TW_SPLIT) { // channels are blockSize apart
+        for (int c = 0; c < numChannels; ++c) {
+          std::copy(buffer.begin() + c*blockSize, buffer.begin() + c*blockSize + framesRead, block.begin() + c*framesRead);
+        }
+      }
+      if (channelFormat != TW_INTERLEAVED) {
+        block = TestCommon::interleave(block, numChannels);
+      }
+      readSamples.insert(readSamples.end(), block.begin(), block.end());
+    }
+  } while (framesRead > 0);
+  REQUIRE(tw.totalFramesReadWritten == numFrames);
+  tinywav_close_read(&tw);
+  
+  REQUIRE(readSamples == file.expected);
+  for (size_t i = 64*numChannels; i < x.size(); ++i) { // give the encoder's step size some time to adapt
+    REQUIRE(readSamples[i] == Approx(x[i] / 32767.0f).margin(0.02));
+  }
+  
+  if (channelFormat == TW_INTERLEAVED) {
+    // the decoded 16-bit values, without a round trip through float
+    std::vector<int16_t> decoded;
+    std::vector<int16_t> int16Buffer(numChannels*blockSize);
+    REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+    while ((framesRead = tinywav_read_int16(&tw, int16Buffer.data(), blockSize)) > 0) {
+      decoded.insert(decoded.end(), int16Buffer.begin(), int16Buffer.begin() + numChannels*framesRead);
+    }
+    REQUIRE(framesRead == 0);
+    tinywav_close_read(&tw);
+    REQUIRE(decoded == file.decoded);
+  }
+}
+
+TEST_CASE("Load ADPCM wave files at once")
+{
+  const char* testFile = "testFileAdpcmLoad.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const uint16_t audioFormat = GENERATE(TW_FORMAT_IMA_ADPCM, TW_FORMAT_MS_ADPCM);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE);
+  constexpr int numChannels = 2;
+  constexpr int blockAlign = 256 * numChannels;
+  // far more blocks than TINYWAV_PARALLEL_BLOCKS, so that they are decoded in parallel with OpenMP
+  const int numFrames = (audioFormat == TW_FORMAT_IMA_ADPCM) ? (200*505 + 1 + 8*20) : (200*500 + 123);
+  
+  std::vector<int16_t> x(numChannels*numFrames);
+  for (int i = 0; i < numFrames; ++i) {
+    for (int c = 0; c < numChannels; ++c) {
+      x[i*numChannels + c] = static_cast<int16_t>(20000.0 * std::sin(0.003 * (c+1) * i));
+    }
+  }
+  const AdpcmFile file = (audioFormat == TW_FORMAT_IMA_ADPCM) ? encodeIma(x, numChannels, blockAlign)
+                                                             : encodeMs(x, numChannels, blockAlign);
+  TestCommon::writeWavFile(testFile, audioFormat, numChannels, 22050, 4, blockAlign, file.data, file.fmtExtension);
+  CAPTURE(audioFormat, channelFormat);
+  
+  float* data = nullptr;
+  int32_t frames = 0;
+  REQUIRE(tinywav_load_all(testFile, channelFormat, &data, &frames, nullptr) == 0);
+  REQUIRE(frames == numFrames);
+  std::vector<float> loaded(data, data + numChannels*numFrames);
+  free(data);
+  if (channelFormat == TW_INLINE) {
+    loaded = TestCommon::interleave(loaded, numChannels);
+  }
+  REQUIRE(loaded == file.expected);
+}
+
+TEST_CASE("ADPCM frame count and coefficient table")
+{
+  const char* testFile = "testFileAdpcmHeader.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int blockAlign = 256 * numChannels;
+  constexpr int numFrames = 3*500 + 124; // the data chunk needs no pad byte, which recovery would count as data
+  std::vector<int16_t> x(numChannels*numFrames);
+  for (size_t i = 0; i < x.size(); ++i) x[i] = static_cast<int16_t>(1000.0 * std::sin(0.01 * i));
+  AdpcmFile file = encodeMs(x, numChannels, blockAlign);
+  TinyWav tw;
+  TinyWavOpenOptions options = {};
+  options.recover = true;
+  
+  SECTION("the fact chunk trims the padding of the last block") {
+    TestCommon::writeWavFile(testFile, TW_FORMAT_MS_ADPCM, numChannels, 22050, 4, blockAlign, file.data,
+                             file.fmtExtension, numFrames - 3);
+    REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+    REQUIRE(tw.numFramesInHeader == numFrames - 3);
+    tinywav_close_read(&tw);
+  }
+  
+  SECTION("an unfinished file recovers the frames of its data, not of its fact chunk") {
+    TestCommon::writeWavFile(testFile, TW_FORMAT_MS_ADPCM, numChannels, 22050, 4, blockAlign, file.data,
+                             file.fmtExtension, 0);
+    // a writer which crashed before finishing the header
+    std::fstream f(testFile, std::ios::in | std::ios::out | std::ios::binary);
+    const int dataSizeOffset = 12 + 8 + 18 + static_cast<int>(file.fmtExtension.size()) + 12 + 4;
+    f.seekp(dataSizeOffset);
+    f.write("\0\0\0\0", 4);
+    f.close();
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tw.numFramesInHeader == 0);
+    tinywav_close_read(&tw);
+    
+    REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+    REQUIRE(tw.numFramesInHeader == numFrames);
+    std::vector<float> samples(numChannels*numFrames);
+    REQUIRE(tinywav_read_f(&tw, samples.data(), numFrames) == numFrames);
+    tinywav_close_read(&tw);
+    REQUIRE(samples == file.expected);
+  }
+  
+  SECTION("files with another coefficient table are refused") {
+    const int numCoefficients = GENERATE(6, 7, 8);
+    CAPTURE(numCoefficients);
+    file.fmtExtension[2] = static_cast<uint8_t>(numCoefficients);
+    if (numCoefficients == 7) {
+      file.fmtExtension[4 + 4*5] ^= 1; // one coefficient differs from the standard table
+    } else if (numCoefficients == 8) {
+      TestCommon::putLE(file.fmtExtension, 128, 2);
+      TestCommon::putLE(file.fmtExtension, 128, 2);
+    }
+    TestCommon::writeWavFile(testFile, TW_FORMAT_MS_ADPCM, numChannels, 22050, 4, blockAlign, file.data, file.fmtExtension);
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) != 0);
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe(testFile, &info) != 0);
+  }
+}
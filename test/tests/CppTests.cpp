@@ -0,0 +1,318 @@
+
+#include <catch2/catch.hpp>
+#include "tinywav.hpp"
+
+#include <cstdio> // for remove
+#include "TestCommon.hpp"
+
+namespace {
+
+/** Reads the whole file with the C API, interleaved */
+std::vector<float> readAllWithC(const char* path, int numChannels)
+{
+  TinyWav tw;
+  REQUIRE(tinywav_open_read(&tw, path, TW_INTERLEAVED) == 0);
+  std::vector<float> samples(static_cast<size_t>(tw.numFramesInHeader * numChannels));
+  REQUIRE(tinywav_read_f(&tw, samples.data(), tw.numFramesInHeader) == tw.numFramesInHeader);
+  tinywav_close_read(&tw);
+  return samples;
+}
+
+template <typename SampleT, TinyWavChannelFormat Layout, int Channels>
+std::vector<SampleT> readAllWithReader(const char* path, int blockSize)
+{
+  tinywav::Reader<SampleT, Layout, Channels> reader(path);
+  REQUIRE(reader.isOpen());
+  std::vector<SampleT> result;
+  std::vector<SampleT> buffer(static_cast<size_t>(blockSize * Channels));
+  SampleT* channels[Channels];
+  for (int c = 0; c < Channels; ++c) {
+    channels[c] = buffer.data() + c*blockSize;
+  }
+  int frames = 0;
+  while (true) {
+    if (Layout == TW_SPLIT) {
+      frames = reader.read(reinterpret_cast<typename tinywav::Reader<SampleT, Layout, Channels>::Buffer>(channels), blockSize);
+    } else {
+      frames = reader.read(reinterpret_cast<typename tinywav::Reader<SampleT, Layout, Channels>::Buffer>(buffer.data()), blockSize);
+    }
+    REQUIRE(frames >= 0);
+    if (frames == 0) break;
+    for (int j = 0; j < frames; ++j) { // back to interleaved
+      for (int c = 0; c < Channels; ++c) {
+        const int stride = (Layout == TW_SPLIT) ? blockSize : frames;
+        result.push_back((Layout == TW_INTERLEAVED) ? buffer[j*Channels + c] : buffer[c*stride + j]);
+      }
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+TEST_CASE("C++ Reader/Writer - compile-time specialized kernels")
+{
+  const char* testFile = "testFileCpp.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 3;
+  constexpr int numFrames = 1000;
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames*numChannels, 42);
+  
+  CAPTURE(sampleFormat);
+  
+  {
+    // write inline, in blocks of 100 frames
+    tinywav::Writer<float, TW_INLINE, numChannels> writer(testFile, 48000, sampleFormat);
+    REQUIRE(writer.isOpen());
+    for (int start = 0; start < numFrames; start += 100) {
+      std::vector<float> block(samples.begin() + start*numChannels, samples.begin() + (start+100)*numChannels);
+      block = TestCommon::deinterleave(block, numChannels);
+      REQUIRE(writer.write(block.data(), 100) == 100);
+    }
+    REQUIRE(writer.handle().totalFramesReadWritten == numFrames);
+  } // closed by destructor
+  
+  const std::vector<float> reference = readAllWithC(testFile, numChannels);
+  if (sampleFormat == TW_FLOAT32) {
+    REQUIRE(reference == samples);
+  }
+  
+  REQUIRE((readAllWithReader<float, TW_INTERLEAVED, numChannels>(testFile, 64)) == reference);
+  REQUIRE((readAllWithReader<float, TW_INLINE, numChannels>(testFile, 77)) == reference);
+  REQUIRE((readAllWithReader<float, TW_SPLIT, numChannels>(testFile, 1000)) == reference);
+  
+  const std::vector<int16_t> asInt16 = readAllWithReader<int16_t, TW_SPLIT, numChannels>(testFile, 128);
+  REQUIRE(asInt16.size() == reference.size());
+  for (size_t i = 0; i < reference.size(); ++i) {
+    REQUIRE(asInt16[i] == Approx(reference[i] * INT16_MAX).margin(1.0));
+  }
+  
+  // a wrong channel count is rejected
+  tinywav::Reader<float, TW_INTERLEAVED, 2> stereoReader(testFile);
+  REQUIRE_FALSE(stereoReader.isOpen());
+}
+
+TEST_CASE("C++ Writer - int16 samples")
+{
+  const char* testFile = "testFileCppInt16.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  const int16_t left[4] = { 0, 1000, -1000, INT16_MAX };
+  const int16_t right[4] = { INT16_MIN + 1, 5, -5, 0 };
+  const int16_t* channels[numChannels] = { left, right };
+  {
+    tinywav::Writer<int16_t, TW_SPLIT, numChannels> writer(testFile, 8000, TW_INT16);
+    REQUIRE(writer.write(channels, 4) == 4);
+    
+    // options of the C API are not applied by the kernels, writing is refused instead of silently ignoring them
+    TinyWav& tw = const_cast<TinyWav&>(writer.handle());
+    REQUIRE(tinywav_set_dither(&tw, TW_DITHER_TPDF, 1) == 0);
+    REQUIRE(writer.write(channels, 4) == -1);
+    REQUIRE(tinywav_set_dither(&tw, TW_DITHER_NONE, 0) == 0);
+    TinyWavStats stats[numChannels];
+    REQUIRE(tinywav_set_stats(&tw, stats) == 0);
+    REQUIRE(writer.write(channels, 4) == -1);
+    REQUIRE(tinywav_set_stats(&tw, nullptr) == 0);
+  }
+  const std::vector<int16_t> interleaved = readAllWithReader<int16_t, TW_INTERLEAVED, numChannels>(testFile, 16);
+  REQUIRE(interleaved == std::vector<int16_t>{ 0, INT16_MIN + 1, 1000, 5, -1000, -5, INT16_MAX, 0 });
+}
+
+TEST_CASE("C++ Reader - int16 samples of G.711 files")
+{
+  const char* testFile = "testFileCppG711.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const uint16_t audioFormat = GENERATE(TW_FORMAT_ALAW, TW_FORMAT_MULAW);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 128; // every code exactly once
+  std::vector<uint8_t> codes(numChannels*numFrames);
+  for (int i = 0; i < numChannels*numFrames; ++i) {
+    codes[i] = static_cast<uint8_t>(i);
+  }
+  TestCommon::writeWavFile(testFile, audioFormat, numChannels, 8000, 8, numChannels, codes);
+  CAPTURE(audioFormat);
+  
+  // the linear values of the codes, as decoded by the C API
+  std::vector<int16_t> reference(numChannels*numFrames);
+  TinyWav tw;
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tinywav_read_int16(&tw, reference.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  if (audioFormat == TW_FORMAT_MULAW) {
+    REQUIRE(reference[0x00] == -32124);
+    REQUIRE(reference[0x80] == 32124);
+    REQUIRE(reference[0x7F] == 0);
+  } else {
+    REQUIRE(reference[0x55] == -8);
+    REQUIRE(reference[0xD5] == 8);
+    REQUIRE(reference[0xAA] == 32256);
+  }
+  
+  // exactly these values, in every layout and without a round trip through float
+  REQUIRE((readAllWithReader<int16_t, TW_INTERLEAVED, numChannels>(testFile, 50)) == reference);
+  REQUIRE((readAllWithReader<int16_t, TW_INLINE, numChannels>(testFile, 128)) == reference);
+  REQUIRE((readAllWithReader<int16_t, TW_SPLIT, numChannels>(testFile, 33)) == reference);
+  const std::vector<float> asFloat = readAllWithReader<float, TW_INTERLEAVED, numChannels>(testFile, 64);
+  REQUIRE(asFloat == readAllWithC(testFile, numChannels));
+}
+
+TEST_CASE("C++ Reader - int16 samples of ADPCM files")
+{
+  const char* testFile = "testFileCppAdpcm.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  // one IMA ADPCM block of 9 frames: the first sample is INT16_MIN, the zero nibbles keep it (the smallest step is 7)
+  const std::vector<uint8_t> block = { 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  std::vector<uint8_t> extension;
+  TestCommon::putLE(extension, 9, 2);
+  TestCommon::writeWavFile(testFile, TW_FORMAT_IMA_ADPCM, 1, 8000, 4, 8, block, extension);
+  
+  // a round trip through float would clamp to -INT16_MAX
+  REQUIRE((readAllWithReader<int16_t, TW_INTERLEAVED, 1>(testFile, 4)) == std::vector<int16_t>(9, INT16_MIN));
+}
+
+TEST_CASE("C++ ReadHandle/WriteHandle - RAII & views")
+{
+  const char* testFile = "testFileCppHandle.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 500;
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames*numChannels, 7);
+  
+  CAPTURE(sampleFormat);
+  
+  {
+    tinywav::WriteHandle writer(testFile, numChannels, 44100, sampleFormat);
+    REQUIRE(writer.isOpen());
+    tinywav::WriteHandle moved(std::move(writer)); // ownership moves, the file is closed exactly once
+    REQUIRE_FALSE(writer.isOpen());
+    REQUIRE(moved.isOpen());
+    REQUIRE(moved.write(tinywav::Span<const float>(samples.data(), samples.size())) == numFrames);
+  }
+  const std::vector<float> reference = readAllWithC(testFile, numChannels);
+  
+  tinywav::ReadHandle reader(testFile);
+  REQUIRE(reader.isOpen());
+  REQUIRE(reader.numChannels() == numChannels);
+  REQUIRE(reader.sampleRate() == 44100);
+  REQUIRE(reader.numFrames() == numFrames);
+  
+  std::vector<float> readSamples;
+  auto first = reader.read(100);
+  REQUIRE(first.size() == 100 * numChannels);
+  readSamples.insert(readSamples.end(), first.begin(), first.end());
+  
+  tinywav::ReadHandle other = std::move(reader);
+  REQUIRE_FALSE(reader.isOpen());
+  REQUIRE(reader.read(100).empty());
+  
+  const float* previousEnd = first.data() + first.size();
+  bool isContiguous = (sampleFormat == TW_FLOAT32);
+  for (auto view = other.read(64); !view.empty(); view = other.read(64)) {
+    isContiguous = isContiguous && (view.data() == previousEnd);
+    previousEnd = view.data() + view.size();
+    readSamples.insert(readSamples.end(), view.begin(), view.end());
+  }
+  REQUIRE(readSamples == reference);
+#if TINYWAV_HAS_MMAP
+  // float files are returned as views into the mapped file
+  REQUIRE(isContiguous == (sampleFormat == TW_FLOAT32));
+#endif
+  
+  // raw bytes
+  tinywav::ReadHandle rawReader(testFile);
+  const auto raw = rawReader.readRaw(numFrames + 10);
+  REQUIRE(raw.size() == static_cast<size_t>(numFrames * numChannels * sampleFormat));
+  REQUIRE(rawReader.readRaw(1).empty());
+  
+  // moving into an open handle closes it
+  rawReader = tinywav::ReadHandle(testFile);
+  REQUIRE(rawReader.read(1).size() == numChannels);
+}
+
+TEST_CASE("C++ ReadHandle - options set with the C API")
+{
+  const char* testFile = "testFileCppHandle.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 500;
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_FLOAT32, TW_INT16);
+  const std::vector<float> samples = TestCommon::createRandomVector(numFrames*numChannels, 11);
+  
+  CAPTURE(sampleFormat);
+  
+  {
+    tinywav::WriteHandle writer(testFile, numChannels, 44100, sampleFormat);
+    REQUIRE(writer.write(tinywav::Span<const float>(samples.data(), samples.size())) == numFrames);
+  }
+  const std::vector<float> reference = readAllWithC(testFile, numChannels);
+  
+  // hash and statistics with the C API
+  TinyWavHash referenceHash;
+  TinyWavStats referenceStats[numChannels];
+  {
+    TinyWav tw;
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_set_hash(&tw, &referenceHash, TW_HASH_XXH64) == 0);
+    REQUIRE(tinywav_set_stats(&tw, referenceStats) == 0);
+    std::vector<float> buffer(numFrames * numChannels);
+    REQUIRE(tinywav_read_f(&tw, buffer.data(), numFrames) == numFrames);
+    tinywav_close_read(&tw);
+  }
+  
+  SECTION("hash and statistics are accumulated by read()") {
+    TinyWavHash hash;
+    TinyWavStats stats[numChannels];
+    tinywav::ReadHandle reader(testFile);
+    REQUIRE(tinywav_set_hash(&reader.handle(), &hash, TW_HASH_XXH64) == 0);
+    REQUIRE(tinywav_set_stats(&reader.handle(), stats) == 0);
+    std::vector<float> readSamples;
+    for (auto view = reader.read(64); !view.empty(); view = reader.read(64)) {
+      readSamples.insert(readSamples.end(), view.begin(), view.end());
+    }
+    REQUIRE(readSamples == reference);
+    reader.close();
+    REQUIRE(hash.length == static_cast<uint64_t>(numFrames * numChannels * sampleFormat));
+    REQUIRE(hash.xxh64 == referenceHash.xxh64);
+    for (int c = 0; c < numChannels; ++c) {
+      REQUIRE(stats[c].numSamples == numFrames);
+      REQUIRE(stats[c].peak == referenceStats[c].peak);
+      REQUIRE(stats[c].rms == referenceStats[c].rms);
+    }
+  }
+  
+  SECTION("hash is accumulated by readRaw()") {
+    TinyWavHash hash;
+    tinywav::ReadHandle reader(testFile);
+    REQUIRE(tinywav_set_hash(&reader.handle(), &hash, TW_HASH_XXH64) == 0);
+    size_t numBytes = 0;
+    for (auto view = reader.readRaw(100); !view.empty(); view = reader.readRaw(100)) {
+      numBytes += view.size();
+    }
+    REQUIRE(numBytes == static_cast<size_t>(numFrames * numChannels * sampleFormat));
+    reader.close();
+    REQUIRE(hash.xxh64 == referenceHash.xxh64);
+  }
+  
+  SECTION("channel selection") {
+    const int channels[1] = { 1 };
+    tinywav::ReadHandle reader(testFile);
+    REQUIRE(tinywav_select_channels(&reader.handle(), channels, 1) == 0);
+    const auto view = reader.read(numFrames);
+    REQUIRE(view.size() == numFrames);
+    for (int j = 0; j < numFrames; ++j) {
+      REQUIRE(view[j] == reference[j*numChannels + 1]);
+    }
+  }
+  
+  SECTION("mapped reads and C reads can be mixed") {
+    tinywav::ReadHandle reader(testFile);
+    const auto first = reader.read(100);
+    std::vector<float> readSamples(first.begin(), first.end());
+    std::vector<float> rest((numFrames - 100) * numChannels);
+    REQUIRE(tinywav_read_f(&reader.handle(), rest.data(), numFrames) == numFrames - 100);
+    readSamples.insert(readSamples.end(), rest.begin(), rest.end());
+    REQUIRE(readSamples == reference);
+  }
+}
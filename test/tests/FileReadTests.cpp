@@ -181,3 +181,223 @@ TEST_CASE("Read wave file 'LIST' & 'INFO' afer fmt")
   REQUIRE(tw.numFramesInHeader == 230);
 }
   
+
+TEST_CASE("Read chunk table and metadata chunks")
+{
+  const char* testFile = "testFileChunks.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  
+  // RIFF: JUNK, fmt, bext (odd size, padded), data, LIST
+  const std::string bext = "tinywav bext!"; // 13 bytes
+  const std::string list = "INFOISFT\x04\0\0\0tiny";
+  const std::vector<int16_t> samples = { 100, -100, 200, -200, 300, -300 };
+  std::vector<uint8_t> bytes;
+  auto putID = [&bytes](const char* id) { bytes.insert(bytes.end(), id, id + 4); };
+  putID("RIFF");
+  TestCommon::putLE(bytes, 0, 4); // patched below
+  putID("WAVE");
+  putID("JUNK");
+  TestCommon::putLE(bytes, 6, 4);
+  bytes.insert(bytes.end(), 6, 0);
+  putID("fmt ");
+  TestCommon::putLE(bytes, 16, 4);
+  TestCommon::putLE(bytes, 1, 2);     // PCM
+  TestCommon::putLE(bytes, 2, 2);     // stereo
+  TestCommon::putLE(bytes, 8000, 4);
+  TestCommon::putLE(bytes, 32000, 4);
+  TestCommon::putLE(bytes, 4, 2);
+  TestCommon::putLE(bytes, 16, 2);
+  putID("bext");
+  TestCommon::putLE(bytes, static_cast<uint32_t>(bext.size()), 4);
+  const size_t bextOffset = bytes.size();
+  bytes.insert(bytes.end(), bext.begin(), bext.end());
+  bytes.push_back(0); // pad byte
+  putID("data");
+  TestCommon::putLE(bytes, static_cast<uint32_t>(samples.size() * 2), 4);
+  const size_t dataOffset = bytes.size();
+  for (int16_t s : samples) TestCommon::putLE(bytes, static_cast<uint16_t>(s), 2);
+  putID("LIST");
+  TestCommon::putLE(bytes, static_cast<uint32_t>(list.size()), 4);
+  const size_t listOffset = bytes.size();
+  bytes.insert(bytes.end(), list.begin(), list.end());
+  const uint32_t riffSize = static_cast<uint32_t>(bytes.size() - 8);
+  for (int i = 0; i < 4; ++i) bytes[4+i] = static_cast<uint8_t>(riffSize >> (8*i));
+  {
+    std::ofstream f(testFile, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  }
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tw.sampFmt == TW_INT16);
+  REQUIRE(tw.numFramesInHeader == 3);
+  
+  REQUIRE(tw.numChunks == 5);
+  const char* expectedIDs[] = { "JUNK", "fmt ", "bext", "data", "LIST" };
+  for (int i = 0; i < tw.numChunks; ++i) {
+    REQUIRE(std::string(tw.chunks[i].id, 4) == expectedIDs[i]);
+  }
+  REQUIRE(tinywav_find_chunk(&tw, "data")->offset == dataOffset);
+  REQUIRE(tinywav_find_chunk(&tw, "cue ") == nullptr);
+  
+  // read one frame, then fetch metadata, then continue reading
+  float frame[2];
+  REQUIRE(tinywav_read_f(&tw, frame, 1) == 1);
+  REQUIRE(frame[0] == Approx(100.0f / INT16_MAX));
+  
+  const TinyWavChunk* bextChunk = tinywav_find_chunk(&tw, "bext");
+  REQUIRE(bextChunk != nullptr);
+  REQUIRE(bextChunk->offset == bextOffset);
+  REQUIRE(bextChunk->size == bext.size());
+  char buffer[64];
+  REQUIRE(tinywav_read_chunk(&tw, bextChunk, buffer, sizeof(buffer)) == static_cast<int>(bext.size()));
+  REQUIRE(std::string(buffer, bext.size()) == bext);
+  
+  const TinyWavChunk* listChunk = tinywav_find_chunk(&tw, "LIST");
+  REQUIRE(listChunk != nullptr);
+  REQUIRE(listChunk->offset == listOffset);
+  REQUIRE(tinywav_read_chunk(&tw, listChunk, buffer, 4) == 4);
+  REQUIRE(std::string(buffer, 4) == "INFO");
+  
+  REQUIRE(tinywav_read_f(&tw, frame, 1) == 1);
+  REQUIRE(frame[0] == Approx(200.0f / INT16_MAX));
+  REQUIRE(frame[1] == Approx(-200.0f / INT16_MAX));
+  tinywav_close_read(&tw);
+}
+
+TEST_CASE("Probe file format without opening")
+{
+  const char* testFile = "testFileProbe.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  
+  SECTION("header within the probe buffer") {
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, 2, 44100, TW_FLOAT32, TW_INTERLEAVED, testFile) == 0);
+    std::vector<float> samples(2 * 100, 0.5f);
+    REQUIRE(tinywav_write_f(&tw, samples.data(), 100) == 100);
+    tinywav_close_write(&tw);
+    
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.audioFormat == TW_FORMAT_IEEE_FLOAT);
+    REQUIRE(info.numChannels == 2);
+    REQUIRE(info.sampleRate == 44100);
+    REQUIRE(info.bitsPerSample == 32);
+    REQUIRE(info.blockAlign == 8);
+    REQUIRE(info.numFrames == 100);
+    REQUIRE(info.dataOffset == 44);
+    REQUIRE(info.dataSize == 800);
+    REQUIRE(info.sampFmt == TW_FLOAT32);
+    REQUIRE(info.isSupported);
+  }
+  
+  SECTION("header beyond the probe buffer") {
+    // a JUNK chunk larger than the probe buffer pushes 'fmt ' and 'data' out of it
+    const uint32_t junkSize = TINYWAV_PROBE_SIZE + 1001;
+    const std::vector<int16_t> samples = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    std::vector<uint8_t> bytes;
+    auto putID = [&bytes](const char* id) { bytes.insert(bytes.end(), id, id + 4); };
+    putID("RIFF");
+    TestCommon::putLE(bytes, 4 + (8 + junkSize + 1) + (8 + 16) + (8 + 18), 4);
+    putID("WAVE");
+    putID("JUNK");
+    TestCommon::putLE(bytes, junkSize, 4);
+    bytes.insert(bytes.end(), junkSize + 1, 0); // odd size, padded
+    putID("fmt ");
+    TestCommon::putLE(bytes, 16, 4);
+    TestCommon::putLE(bytes, 1, 2);     // PCM
+    TestCommon::putLE(bytes, 3, 2);     // 3 channels
+    TestCommon::putLE(bytes, 22050, 4);
+    TestCommon::putLE(bytes, 22050 * 6, 4);
+    TestCommon::putLE(bytes, 6, 2);
+    TestCommon::putLE(bytes, 16, 2);
+    putID("data");
+    TestCommon::putLE(bytes, static_cast<uint32_t>(samples.size() * 2), 4);
+    const size_t dataOffset = bytes.size();
+    for (int16_t s : samples) TestCommon::putLE(bytes, static_cast<uint16_t>(s), 2);
+    {
+      std::ofstream f(testFile, std::ios::binary);
+      f.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+    
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.audioFormat == TW_FORMAT_PCM);
+    REQUIRE(info.numChannels == 3);
+    REQUIRE(info.sampleRate == 22050);
+    REQUIRE(info.numFrames == 3);
+    REQUIRE(info.dataOffset == dataOffset);
+    REQUIRE(info.sampFmt == TW_INT16);
+    
+    // the reader takes the same path through the header
+    TinyWav tw;
+    REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tw.numFramesInHeader == info.numFrames);
+    REQUIRE(tinywav_find_chunk(&tw, "data")->offset == dataOffset);
+    float frame[3];
+    REQUIRE(tinywav_read_f(&tw, frame, 1) == 1);
+    REQUIRE(frame[2] == Approx(3.0f / INT16_MAX));
+    tinywav_close_read(&tw);
+  }
+  
+  SECTION("not a wave file") {
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe("does-not-exist.wav", &info) == -1);
+    {
+      std::ofstream f(testFile, std::ios::binary);
+      f << "RIFF\x04\0\0\0AIFF";
+    }
+    REQUIRE(tinywav_probe(testFile, &info) == -1);
+    REQUIRE(tinywav_probe(nullptr, &info) == -1);
+  }
+}
+
+TEST_CASE("Probe many files concurrently")
+{
+  // every third file is not a wave file
+  const int numFiles = 30;
+  std::vector<std::string> files;
+  for (int i = 0; i < numFiles; ++i) {
+    files.push_back("testFileProbeBatch" + std::to_string(i) + ".wav");
+    if (i % 3 == 2) {
+      std::ofstream f(files.back(), std::ios::binary);
+      f << "not a wave file";
+      continue;
+    }
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, static_cast<int16_t>(1 + i % 4), 8000 + i, TW_INT16, TW_INTERLEAVED,
+                               files.back().c_str()) == 0);
+    std::vector<float> samples((1 + i % 4) * (i + 1), 0.0f);
+    REQUIRE(tinywav_write_f(&tw, samples.data(), i + 1) == i + 1);
+    tinywav_close_write(&tw);
+  }
+  std::vector<const char*> paths;
+  for (const auto& f : files) paths.push_back(f.c_str());
+  paths.push_back("does-not-exist.wav");
+  const int numPaths = static_cast<int>(paths.size());
+  
+  for (int numThreads : { 0, 1, 4, 100 }) {
+    std::vector<TinyWavInfo> infos(numPaths);
+    std::vector<int> errors(numPaths, 42);
+    REQUIRE(tinywav_probe_batch(paths.data(), numPaths, infos.data(), errors.data(), numThreads) == 20);
+    for (int i = 0; i < numPaths; ++i) {
+      TinyWavInfo info;
+      const int err = tinywav_probe(paths[i], &info);
+      REQUIRE(errors[i] == err);
+      if (err == 0) {
+        REQUIRE(infos[i].numChannels == 1 + i % 4);
+        REQUIRE(infos[i].sampleRate == static_cast<uint32_t>(8000 + i));
+        REQUIRE(infos[i].numFrames == i + 1);
+      } else {
+        REQUIRE(infos[i].numChannels == 0);
+      }
+    }
+  }
+  
+  std::vector<TinyWavInfo> infos(numPaths);
+  REQUIRE(tinywav_probe_batch(paths.data(), numPaths, infos.data(), nullptr, 0) == 20);
+  REQUIRE(tinywav_probe_batch(paths.data(), 0, infos.data(), nullptr, 0) == 0);
+  REQUIRE(tinywav_probe_batch(nullptr, numPaths, infos.data(), nullptr, 0) == -1);
+  
+  for (const auto& f : files) std::remove(f.c_str());
+}
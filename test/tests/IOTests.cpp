@@ -0,0 +1,644 @@
+
+#include <catch2/catch.hpp>
+#include "tinywav.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "TestCommon.hpp"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+TEST_CASE("Tinywav - I/O statistics")
+{
+  const char* testFile = "testFileIO.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const char* truncatedFile = "testFileIOTruncated.wav";
+  const TestCommon::ScopedFile removeTruncatedFile(truncatedFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 1000;
+  constexpr int blockSize = 100;
+  constexpr int headerSize = 44;
+  std::vector<float> samples(numFrames * numChannels, 0.25f);
+  
+  TinyWav tw;
+  TinyWavIOStats io;
+  TinyWavOpenOptions options = {};
+  options.ioStats = &io;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile, &options) == 0);
+  REQUIRE(io.bytesWritten == headerSize);
+  REQUIRE(tinywav_write_f(&tw, samples.data(), 300) == 300);
+  for (int frame = 300; frame < numFrames; frame += blockSize) {
+    REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+  }
+  const uint64_t numWrites = io.numWrites;
+  tinywav_close_write(&tw);
+  REQUIRE(tw.ioStats == nullptr);
+  REQUIRE(io.bytesWritten == headerSize + numFrames * numChannels * 2 + 8); // header sizes are written again on close
+  REQUIRE(io.numWrites == numWrites + 2);
+  REQUIRE(io.numSeeks == 2);
+  REQUIRE(io.maxBlockSize == 300);
+  REQUIRE(io.numReads == 0);
+  REQUIRE(io.ioNanoseconds + io.conversionNanoseconds > 0);
+  
+  SECTION("reading") {
+    REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+    REQUIRE(io.bytesWritten == 0); // reset on opening
+    REQUIRE(io.numReads == 1); // the whole header fits into the first read
+    REQUIRE(io.numShortReads == 1); // ... which asks for more than the file holds
+    REQUIRE(io.numSeeks == 1);
+    const uint64_t headerBytes = io.bytesRead;
+    REQUIRE(headerBytes == headerSize + numFrames * numChannels * 2);
+    int frames = 0;
+    for (int n; (n = tinywav_read_f(&tw, samples.data(), blockSize)) > 0;) frames += n;
+    REQUIRE(frames == numFrames);
+    REQUIRE(io.bytesRead == headerBytes + numFrames * numChannels * 2);
+    REQUIRE(io.numReads == 1 + numFrames / blockSize);
+    REQUIRE(io.numShortReads == 1);
+    REQUIRE(io.maxBlockSize == blockSize);
+    tinywav_close_read(&tw);
+  }
+  
+  SECTION("short reads of a truncated file") {
+    std::ifstream in(testFile, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    const int keptFrames = 450;
+    std::ofstream out(truncatedFile, std::ios::binary);
+    out.write(bytes.data(), headerSize + keptFrames * numChannels * 2);
+    out.close();
+    
+    REQUIRE(tinywav_open_read_ex(&tw, truncatedFile, TW_INTERLEAVED, &options) == 0);
+    const uint64_t numShortReads = io.numShortReads;
+    int frames = 0;
+    for (int n; (n = tinywav_read_f(&tw, samples.data(), blockSize)) > 0;) frames += n;
+    REQUIRE(frames == keptFrames);
+    REQUIRE(io.numShortReads == numShortReads + 2); // the partial block and the one finding the end of the file
+    tinywav_close_read(&tw);
+  }
+}
+
+TEST_CASE("Tinywav - Trace hooks")
+{
+  const char* testFile = "testFileTrace.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int blockSize = 64;
+  std::vector<float> samples(blockSize * numChannels, 0.5f);
+  
+  struct Event { bool isBegin; TinyWavTraceEvent event; int64_t value; };
+  std::vector<Event> events;
+  TinyWavTraceHooks hooks;
+  hooks.begin = [](void* userData, TinyWavTraceEvent event, int64_t value) {
+    static_cast<std::vector<Event>*>(userData)->push_back({ true, event, value });
+  };
+  hooks.end = [](void* userData, TinyWavTraceEvent event, int64_t value) {
+    static_cast<std::vector<Event>*>(userData)->push_back({ false, event, value });
+  };
+  hooks.userData = &events;
+  TinyWavOpenOptions options = {};
+  options.trace = &hooks;
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == 0);
+  REQUIRE(!events.empty()); // the header
+  events.clear();
+  REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+  REQUIRE(events.size() == 4);
+  REQUIRE((events[0].isBegin && events[0].event == TW_TRACE_WRITE_F && events[0].value == blockSize));
+  REQUIRE((events[1].isBegin && events[1].event == TW_TRACE_FWRITE && events[1].value == blockSize * numChannels * 4));
+  REQUIRE((!events[2].isBegin && events[2].event == TW_TRACE_FWRITE && events[2].value == blockSize * numChannels * 4));
+  REQUIRE((!events[3].isBegin && events[3].event == TW_TRACE_WRITE_F && events[3].value == blockSize));
+  tinywav_close_write(&tw);
+  REQUIRE(tw.trace == nullptr);
+  
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+  events.clear();
+  REQUIRE(tinywav_read_f(&tw, samples.data(), 2 * blockSize) == blockSize);
+  REQUIRE(events.size() == 4);
+  REQUIRE((events[0].isBegin && events[0].event == TW_TRACE_READ_F && events[0].value == 2 * blockSize));
+  REQUIRE((events[1].isBegin && events[1].event == TW_TRACE_FREAD));
+  REQUIRE((!events[2].isBegin && events[2].event == TW_TRACE_FREAD && events[2].value == blockSize * numChannels * 4));
+  REQUIRE((!events[3].isBegin && events[3].event == TW_TRACE_READ_F && events[3].value == blockSize));
+  tinywav_close_read(&tw);
+  
+  // hooks may be left out
+  hooks.begin = nullptr;
+  events.clear();
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+  REQUIRE(tinywav_read_f(&tw, samples.data(), blockSize) == blockSize);
+  tinywav_close_read(&tw);
+  REQUIRE(std::none_of(events.begin(), events.end(), [](const Event& e) { return e.isBegin; }));
+}
+
+TEST_CASE("Tinywav - Configurable I/O buffer")
+{
+  const char* testFile = "testFileBuffer.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 4800;
+  constexpr int blockSize = 16;
+  std::vector<float> samples(numFrames * numChannels);
+  for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i % 1000) / 1000.0f;
+  
+  std::vector<char> buffer(1 << 20);
+  TinyWavOpenOptions options = {};
+  options.bufferSize = buffer.size();
+  options.buffer = GENERATE(true, false) ? buffer.data() : nullptr;
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == 0);
+  if (options.buffer != nullptr) {
+    REQUIRE(std::string(buffer.data(), 4) == "RIFF"); // the header is held in the caller's buffer
+  }
+  for (int frame = 0; frame < numFrames; frame += blockSize) {
+    REQUIRE(tinywav_write_f(&tw, samples.data() + frame * numChannels, blockSize) == blockSize);
+  }
+  tinywav_close_write(&tw);
+  
+  TinyWavIOStats io;
+  options.ioStats = &io;
+  std::vector<float> read(numFrames * numChannels);
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+  for (int frame = 0; frame < numFrames; frame += blockSize) {
+    REQUIRE(tinywav_read_f(&tw, read.data() + frame * numChannels, blockSize) == blockSize);
+  }
+  tinywav_close_read(&tw);
+  REQUIRE(read == samples);
+  REQUIRE(io.numReads == 1 + numFrames / blockSize);
+}
+
+TEST_CASE("Tinywav - Direct I/O")
+{
+  const char* testFile = "testFileDirect.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 10007; // the data does not end on a block boundary
+  constexpr int blockSize = 300;
+  std::vector<float> samples(numFrames * numChannels);
+  for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i % 2000) / 2000.0f - 0.5f;
+  
+  std::vector<char> memory(4 * TINYWAV_DIRECT_ALIGNMENT + TINYWAV_DIRECT_ALIGNMENT);
+  const uintptr_t address = reinterpret_cast<uintptr_t>(memory.data());
+  char* aligned = memory.data() + (TINYWAV_DIRECT_ALIGNMENT - address % TINYWAV_DIRECT_ALIGNMENT) % TINYWAV_DIRECT_ALIGNMENT;
+  
+  TinyWav tw;
+  TinyWavOpenOptions options = {};
+  options.directIO = true;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == -1);
+  options.buffer = aligned + 1;
+  options.bufferSize = 4 * TINYWAV_DIRECT_ALIGNMENT;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == -1);
+  options.buffer = aligned;
+  
+#if defined(__linux__)
+  const TinyWavSampleFormat sampleFormat = GENERATE(TW_INT16, TW_FLOAT32);
+  CAPTURE(sampleFormat);
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, sampleFormat, TW_INTERLEAVED, testFile, &options) == 0);
+  for (int frame = 0; frame < numFrames; frame += blockSize) {
+    const int n = std::min(blockSize, numFrames - frame);
+    REQUIRE(tinywav_write_f(&tw, samples.data() + frame * numChannels, n) == n);
+  }
+  tinywav_close_write(&tw);
+  
+  // the file is complete for a regular reader ...
+  std::vector<float> expected(numFrames * numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  REQUIRE(tinywav_read_f(&tw, expected.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    REQUIRE(expected[i] == Approx(samples[i]).margin(1e-4));
+  }
+  
+  // ... and reads the same with direct I/O
+  std::vector<float> read(numFrames * numChannels);
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  int frames = 0;
+  for (int n; (n = tinywav_read_f(&tw, read.data() + frames * numChannels, blockSize)) > 0;) frames += n;
+  tinywav_close_read(&tw);
+  REQUIRE(frames == numFrames);
+  REQUIRE(read == expected);
+#else
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == -1);
+#endif
+}
+
+#if defined(__linux__)
+TEST_CASE("Tinywav - Direct I/O write errors")
+{
+  const char* testFile = "testFileDirectError.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int blockSize = 300;
+  constexpr rlim_t fileSizeLimit = 64 * 1024; // a multiple of the buffer size, the flush which crosses it fails
+  std::vector<float> samples(blockSize * numChannels);
+  for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i) / samples.size() - 0.5f;
+  
+  std::vector<char> memory(4 * TINYWAV_DIRECT_ALIGNMENT + TINYWAV_DIRECT_ALIGNMENT);
+  const uintptr_t address = reinterpret_cast<uintptr_t>(memory.data());
+  TinyWavOpenOptions options = {};
+  options.directIO = true;
+  options.buffer = memory.data() + (TINYWAV_DIRECT_ALIGNMENT - address % TINYWAV_DIRECT_ALIGNMENT) % TINYWAV_DIRECT_ALIGNMENT;
+  options.bufferSize = 4 * TINYWAV_DIRECT_ALIGNMENT;
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == 0);
+  REQUIRE_FALSE(tw.hasWriteError);
+  
+  // writing past the limit fails with EFBIG instead of raising SIGXFSZ
+  rlimit limit;
+  REQUIRE(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+  const rlimit previousLimit = limit;
+  limit.rlim_cur = fileSizeLimit;
+  auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+  REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+  
+  int framesWritten = 0;
+  int ret;
+  for (int i = 0; i < 100 && (ret = tinywav_write_f(&tw, samples.data(), blockSize)) > 0; ++i) {
+    framesWritten += ret;
+  }
+  const bool hasWriteError = tw.hasWriteError;
+  const int retAfterError = tinywav_write_f(&tw, samples.data(), blockSize);
+  const uint32_t framesCounted = tw.totalFramesReadWritten;
+  tinywav_close_write(&tw);
+  
+  setrlimit(RLIMIT_FSIZE, &previousLimit);
+  std::signal(SIGXFSZ, previousHandler);
+  
+  // the failed write is reported and not counted, and the handle stays failed
+  REQUIRE(ret == -1);
+  REQUIRE(hasWriteError);
+  REQUIRE(retAfterError == -1);
+  REQUIRE(framesCounted == static_cast<uint32_t>(framesWritten));
+  
+  // the header counts only the frames on file, which hold what was written
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  const int numFrames = static_cast<int>(tw.numFramesInHeader);
+  REQUIRE(numFrames > 0);
+  REQUIRE(numFrames <= framesWritten);
+  REQUIRE(44 + static_cast<long>(numFrames) * numChannels * sizeof(float) <= static_cast<long>(fileSizeLimit));
+  std::vector<float> read(numFrames * numChannels);
+  REQUIRE(tinywav_read_f(&tw, read.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  for (int i = 0; i < numFrames * numChannels; ++i) {
+    REQUIRE(read[i] == samples[i % samples.size()]);
+  }
+}
+#endif
+
+TEST_CASE("Tinywav - Preallocation and sequential access hints")
+{
+  const char* testFile = "testFilePreallocated.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int headerSize = 44;
+  const int numFrames = GENERATE(1000, 5000); // fewer and more than expected
+  constexpr int expectedFrames = 4800;
+  std::vector<float> samples(numFrames * numChannels, 0.125f);
+  
+  auto fileSize = [&]() {
+    std::ifstream f(testFile, std::ios::binary | std::ios::ate);
+    return static_cast<long>(f.tellg());
+  };
+  
+#if defined(__linux__)
+  auto allocatedSize = [&]() {
+    struct stat st;
+    REQUIRE(stat(testFile, &st) == 0);
+    return static_cast<long>(st.st_blocks) * 512;
+  };
+#endif
+  
+  TinyWav tw;
+  TinyWavOpenOptions options = {};
+  options.expectedFrames = expectedFrames;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == 0);
+#if defined(__linux__)
+  const long preallocatedSize = static_cast<long>(tw.preallocatedSize);
+  REQUIRE(preallocatedSize == headerSize + expectedFrames * numChannels * 4);
+  REQUIRE(allocatedSize() >= preallocatedSize);
+  REQUIRE(fileSize() <= headerSize); // the file only grows as frames are written
+#endif
+  REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  REQUIRE(fileSize() == headerSize + numFrames * numChannels * 4); // nothing left over
+#if defined(__linux__)
+  if (numFrames < expectedFrames) {
+    REQUIRE(allocatedSize() < preallocatedSize); // the space which was not written is given back
+  }
+#endif
+  
+  TinyWavOpenOptions readOptions = {};
+  readOptions.sequentialAccess = true;
+  std::vector<float> read(numFrames * numChannels);
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &readOptions) == 0);
+  REQUIRE(tw.numFramesInHeader == numFrames);
+  REQUIRE(tinywav_read_f(&tw, read.data(), numFrames) == numFrames);
+  tinywav_close_read(&tw);
+  REQUIRE(read == samples);
+}
+
+TEST_CASE("Tinywav - Periodic header updates")
+{
+  const char* testFile = "testFileCheckpoint.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int blockSize = 100;
+  std::vector<float> samples(blockSize * numChannels, 0.25f);
+  
+  TinyWav tw;
+  TinyWavOpenOptions options = {};
+  options.headerUpdateFrames = 480;
+  options.syncInterval = 2;
+  
+  SECTION("buffered") {
+    REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile, &options) == 0);
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.numFrames == 0);
+    for (int i = 0; i < 10; ++i) {
+      REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+    }
+    REQUIRE(tw.numHeaderUpdates == 2); // after 500 and 1000 frames
+    REQUIRE(tw.numHeaderUpdateErrors == 0);
+    
+    // a crash now would leave a complete file
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.numFrames == 1000);
+    TinyWav reader;
+    std::vector<float> read(1000 * numChannels);
+    REQUIRE(tinywav_open_read(&reader, testFile, TW_INTERLEAVED) == 0);
+    REQUIRE(tinywav_read_f(&reader, read.data(), 1000) == 1000);
+    REQUIRE(read[1999] == Approx(0.25f).margin(1e-4));
+    tinywav_close_read(&reader);
+    
+    REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+    tinywav_close_write(&tw);
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.numFrames == 1100);
+  }
+  
+#if defined(__linux__)
+  SECTION("direct I/O") {
+    std::vector<char> memory(5 * TINYWAV_DIRECT_ALIGNMENT);
+    const uintptr_t address = reinterpret_cast<uintptr_t>(memory.data());
+    options.buffer = memory.data() + (TINYWAV_DIRECT_ALIGNMENT - address % TINYWAV_DIRECT_ALIGNMENT) % TINYWAV_DIRECT_ALIGNMENT;
+    options.bufferSize = 4 * TINYWAV_DIRECT_ALIGNMENT;
+    options.directIO = true;
+    REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_FLOAT32, TW_INTERLEAVED, testFile, &options) == 0);
+    for (int i = 0; i < 50; ++i) {
+      REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+    }
+    // the header covers the whole frames of the buffers which have been written to the file
+    TinyWavInfo info;
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.numFrames == (2 * 4 * TINYWAV_DIRECT_ALIGNMENT - 44) / (numChannels * 4));
+    tinywav_close_write(&tw);
+    REQUIRE(tinywav_probe(testFile, &info) == 0);
+    REQUIRE(info.numFrames == 5000);
+  }
+  
+  SECTION("failing") {
+    // the data stays in the stdio buffer until the update flushes it past the size limit
+    options.bufferSize = 64 * 1024;
+    REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile, &options) == 0);
+    
+    rlimit limit;
+    REQUIRE(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+    const rlimit previousLimit = limit;
+    limit.rlim_cur = 44 + 1000 * numChannels * 2;
+    auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+    REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    int numWritten = 0;
+    for (int i = 0; i < 20; ++i) {
+      numWritten += (tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+    }
+    const int32_t numHeaderUpdates = tw.numHeaderUpdates;
+    const int32_t numHeaderUpdateErrors = tw.numHeaderUpdateErrors;
+    TinyWavInfo info;
+    const int probed = tinywav_probe(testFile, &info);
+    tinywav_close_write(&tw);
+    setrlimit(RLIMIT_FSIZE, &previousLimit);
+    std::signal(SIGXFSZ, previousHandler);
+    
+    // the frames went into the buffer, the updates after 1500 and 2000 frames could not flush them
+    REQUIRE(numWritten == 20);
+    REQUIRE(numHeaderUpdates == 2);
+    REQUIRE(numHeaderUpdateErrors == 2);
+    REQUIRE(probed == 0);
+    REQUIRE(info.numFrames == 1000); // as of the last successful update
+  }
+#endif
+}
+
+TEST_CASE("Tinywav - Recover a preallocated recording after a crash")
+{
+  const char* testFile = "testFileCrash.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int blockSize = 100;
+  std::vector<float> samples(blockSize * numChannels, 0.25f);
+  const int headerUpdateFrames = GENERATE(0, 480);
+  CAPTURE(headerUpdateFrames);
+  
+  TinyWav tw;
+  TinyWavOpenOptions options = {};
+  options.expectedFrames = 48000;
+  options.headerUpdateFrames = headerUpdateFrames;
+  REQUIRE(tinywav_open_write_ex(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile, &options) == 0);
+  for (int i = 0; i < 12; ++i) {
+    REQUIRE(tinywav_write_f(&tw, samples.data(), blockSize) == blockSize);
+  }
+  // the process dies here: what has been written reaches the file, the header is not finished
+  fflush(tw.f);
+  
+  // without updates, the size is derived from the file, which ends after the last frame instead of the reserved
+  // space. With updates, the header holds the size of the last one, after 1000 frames.
+  const int expectedFrames = (headerUpdateFrames > 0) ? 1000 : 1200;
+  TinyWav reader;
+  TinyWavOpenOptions readOptions = {};
+  readOptions.recover = true;
+  std::vector<float> read(48000 * numChannels);
+  REQUIRE(tinywav_open_read_ex(&reader, testFile, TW_INTERLEAVED, &readOptions) == 0);
+  REQUIRE(reader.numFramesInHeader == expectedFrames);
+  REQUIRE(tinywav_read_f(&reader, read.data(), 48000) == expectedFrames);
+  tinywav_close_read(&reader);
+  for (int i = 0; i < expectedFrames * numChannels; ++i) {
+    REQUIRE(read[i] == Approx(0.25f).margin(1e-4));
+  }
+  fclose(tw.f); // without finishing the file
+}
+
+TEST_CASE("Tinywav - Recover files with a broken data size")
+{
+  const char* testFile = "testFileRecover.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  constexpr int numChannels = 2;
+  constexpr int numFrames = 1000;
+  constexpr int headerSize = 44;
+  std::vector<float> samples(numFrames * numChannels);
+  for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i % 100) / 100.0f;
+  
+  TinyWav tw;
+  REQUIRE(tinywav_open_write(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile) == 0);
+  REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+  tinywav_close_write(&tw);
+  
+  // break the header like a crash would, or cut off the end of the file
+  std::ifstream in(testFile, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  int expectedFrames = numFrames;
+  const uint32_t brokenSize = GENERATE(0u, 0xFFFFFFFFu, 4000u * 4);
+  CAPTURE(brokenSize);
+  if (brokenSize == 4000u * 4) {
+    expectedFrames = 600;
+    bytes.resize(headerSize + expectedFrames * numChannels * 2 + 3); // and a partial frame
+  }
+  auto patch = [&](size_t offset, uint32_t value) {
+    for (int i = 0; i < 4; ++i) bytes[offset + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+  };
+  patch(40, brokenSize); // Subchunk2Size
+  patch(4, 0xFFFFFFFFu); // ChunkSize, claims that there is more after the data chunk
+  std::ofstream out(testFile, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+  out.close();
+  
+  std::vector<float> read(numFrames * numChannels);
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE(tw.numFramesInHeader != expectedFrames);
+  REQUIRE(tw.numChunks == 2); // the audio data is not mistaken for chunk headers
+  tinywav_close_read(&tw);
+  
+  TinyWavOpenOptions options = {};
+  options.recover = true;
+  options.repairHeader = GENERATE(false, true);
+  REQUIRE(tinywav_open_read_ex(&tw, testFile, TW_INTERLEAVED, &options) == 0);
+  REQUIRE(tw.numFramesInHeader == expectedFrames);
+  REQUIRE(tinywav_read_f(&tw, read.data(), numFrames) == expectedFrames);
+  tinywav_close_read(&tw);
+  for (int i = 0; i < expectedFrames * numChannels; ++i) {
+    REQUIRE(read[i] == Approx(samples[i]).margin(1e-4));
+  }
+  
+  // repairing makes the file readable without recovery
+  REQUIRE(tinywav_open_read(&tw, testFile, TW_INTERLEAVED) == 0);
+  REQUIRE((tw.numFramesInHeader == expectedFrames) == options.repairHeader);
+  tinywav_close_read(&tw);
+}
+
+TEST_CASE("Tinywav - Load a whole file at once")
+{
+  const char* testFile = "testFileLoadAll.wav";
+  const TestCommon::ScopedFile removeTestFile(testFile);
+  const TinyWavChannelFormat channelFormat = GENERATE(TW_INTERLEAVED, TW_INLINE);
+  CAPTURE(channelFormat);
+  
+  // reads the file block by block, the way tinywav_load_all replaces
+  auto readAll = [&](int numFrames, int numChannels) {
+    std::vector<float> samples(numFrames * numChannels);
+    TinyWav tw;
+    REQUIRE(tinywav_open_read(&tw, testFile, channelFormat) == 0);
+    REQUIRE(tinywav_read_f(&tw, samples.data(), numFrames) == numFrames);
+    tinywav_close_read(&tw);
+    return samples;
+  };
+  
+  SECTION("16-bit int and 32-bit float") {
+    const TinyWavSampleFormat sampleFormat = GENERATE(TW_INT16, TW_FLOAT32);
+    const int numChannels = GENERATE(1, 2, 8);
+    constexpr int numFrames = 3001;
+    CAPTURE(sampleFormat, numChannels);
+    std::vector<float> samples(numFrames * numChannels);
+    for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i % 977) / 977.0f - 0.5f;
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, static_cast<int16_t>(numChannels), 44100, sampleFormat, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+    tinywav_close_write(&tw);
+    
+    float* data = nullptr;
+    int32_t frames = 0;
+    TinyWavInfo info;
+    REQUIRE(tinywav_load_all(testFile, channelFormat, &data, &frames, &info) == 0);
+    REQUIRE(frames == numFrames);
+    REQUIRE(info.numChannels == numChannels);
+    REQUIRE(info.sampleRate == 44100);
+    REQUIRE(info.numFrames == numFrames);
+    REQUIRE(info.sampFmt == sampleFormat);
+    REQUIRE(info.isSupported);
+    TinyWavInfo probed;
+    REQUIRE(tinywav_probe(testFile, &probed) == 0);
+    REQUIRE(info.blockAlign == probed.blockAlign);
+    REQUIRE(info.dataOffset == probed.dataOffset);
+    REQUIRE(info.dataSize == probed.dataSize);
+    REQUIRE(std::vector<float>(data, data + numFrames * numChannels) == readAll(numFrames, numChannels));
+    free(data);
+  }
+  
+  SECTION("G.711 is decoded") {
+    const int numChannels = GENERATE(2, 64); // the blocks get shorter with more channels
+    constexpr int numFrames = 5000; // more than one block
+    CAPTURE(numChannels);
+    std::vector<uint8_t> encoded(numFrames * numChannels);
+    for (size_t i = 0; i < encoded.size(); ++i) encoded[i] = static_cast<uint8_t>(i * 7);
+    TestCommon::writeWavFile(testFile, TW_FORMAT_MULAW, numChannels, 8000, 8, numChannels, encoded);
+    
+    float* data = nullptr;
+    int32_t frames = 0;
+    REQUIRE(tinywav_load_all(testFile, channelFormat, &data, &frames, nullptr) == 0);
+    REQUIRE(frames == numFrames);
+    REQUIRE(std::vector<float>(data, data + numFrames * numChannels) == readAll(numFrames, numChannels));
+    free(data);
+  }
+  
+  SECTION("truncated file") {
+    constexpr int numChannels = 3;
+    constexpr int numFrames = 2000;
+    std::vector<float> samples(numFrames * numChannels);
+    for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<float>(i % 101) / 101.0f;
+    TinyWav tw;
+    REQUIRE(tinywav_open_write(&tw, numChannels, 48000, TW_INT16, TW_INTERLEAVED, testFile) == 0);
+    REQUIRE(tinywav_write_f(&tw, samples.data(), numFrames) == numFrames);
+    tinywav_close_write(&tw);
+    std::ifstream in(testFile, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    constexpr int keptFrames = 1234;
+    const size_t headerSize = bytes.size() - numFrames * numChannels * 2;
+    std::ofstream out(testFile, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(headerSize + keptFrames * numChannels * 2));
+    out.close();
+    
+    float* data = nullptr;
+    int32_t frames = 0;
+    TinyWavInfo info;
+    REQUIRE(tinywav_load_all(testFile, channelFormat, &data, &frames, &info) == 0);
+    REQUIRE(frames == keptFrames);
+    REQUIRE(info.numFrames == keptFrames); // as recovered, not as declared in the header
+    REQUIRE(info.dataSize == keptFrames * numChannels * 2);
+    REQUIRE(info.dataOffset == headerSize);
+    for (int i = 0; i < keptFrames; ++i) {
+      for (int c = 0; c < numChannels; ++c) {
+        const float v = (channelFormat == TW_INTERLEAVED) ? data[i * numChannels + c] : data[c * keptFrames + i];
+        REQUIRE(v == Approx(samples[i * numChannels + c]).margin(1e-4));
+      }
+    }
+    free(data);
+  }
+  
+  float* data = nullptr;
+  int32_t frames = 0;
+  REQUIRE(tinywav_load_all("does-not-exist.wav", channelFormat, &data, &frames, nullptr) == -1);
+  REQUIRE(data == nullptr);
+  REQUIRE(tinywav_load_all(testFile, TW_SPLIT, &data, &frames, nullptr) == -1);
+}
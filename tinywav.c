@@ -14,8 +14,52 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <string.h> // for memcpy
+// The CMake script sets the feature test macros. Builds without it which set none of their own get the same here.
+#if !defined(_WIN32) && !defined(_GNU_SOURCE) && !defined(_XOPEN_SOURCE) && !defined(_POSIX_C_SOURCE) \
+    && !defined(_DEFAULT_SOURCE)
+  #if defined(__linux__)
+    #define _GNU_SOURCE // for pread, O_DIRECT
+  #else
+    #define _XOPEN_SOURCE 700 // for pread
+  #endif
+#endif
+
+#include <math.h>   // for sqrt, sqrtf, sin, cos, fabsf, copysignf
+#include <stdlib.h> // for malloc in tinywav_load_all
+#include <string.h> // for memcpy, memset
+#include <time.h>   // for the timestamp of the 'levl' chunk, clock_gettime
+#if _WIN32
+  #include <io.h> // for _sopen_s, _read, _lseeki64, _close
+  #include <fcntl.h>
+  #include <share.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>  // for open, O_DIRECT
+  #include <sys/stat.h> // for fstat
+  #include <unistd.h> // for pread, pwrite, close
+  #if defined(O_DIRECT)
+    #define TINYWAV_HAS_DIRECT_IO 1
+  #endif
+  #if defined(__linux__)
+    #define TINYWAV_HAS_FILE_HINTS 1 // posix_fadvise
+  #endif
+  #if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    #define TINYWAV_HAS_PREALLOCATION 1 // fallocate
+  #endif
+#endif
+#if _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h> // for CreateThread, QueryPerformanceCounter
+#elif TINYWAV_USE_THREADS
+  #include <pthread.h>
+#endif
 #include "tinywav.h"
+#if TINYWAV_USE_USDT
+  #include <sys/sdt.h> // static tracepoints for perf, bpftrace, SystemTap, ...
+  #define TW_USDT(name, tw, value) DTRACE_PROBE2(tinywav, name, tw, value)
+#else
+  #define TW_USDT(name, tw, value)
+#endif
 
 // MARK: Processor Helpers
 #if !defined(TINYWAV_USE_ALLOCA) && !defined(TINYWAV_USE_VLA) && !defined(TINYWAV_USE_MALLOC)
@@ -63,257 +107,2803 @@ static bool chunkIDMatches(char chunk[4], const char* chunkName)
   return true;
 }
 
-// MARK: public functions
+static uint16_t readUInt16LE(const uint8_t *p) {
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
 
-int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate, TinyWavSampleFormat sampFmt,
-                       TinyWavChannelFormat chanFmt, const char *path) {
-  
-  if (tw == NULL || path == NULL || numChannels < 1 || samplerate < 1) {
+static uint32_t readUInt32LE(const uint8_t *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void writeUInt16LE(uint8_t *p, uint16_t x) {
+  p[0] = (uint8_t) (x & 0xFF);
+  p[1] = (uint8_t) (x >> 8);
+}
+
+static void writeUInt32LE(uint8_t *p, uint32_t x) {
+  writeUInt16LE(p, (uint16_t) (x & 0xFFFF));
+  writeUInt16LE(p + 2, (uint16_t) (x >> 16));
+}
+
+/** The trailing 14 bytes shared by all KSDATAFORMAT_SUBTYPE_* GUIDs. The first two bytes hold the format tag. */
+static const uint8_t kSubFormatGuidTail[14] = {
+  0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+/**
+ * @returns the format tag of the file, taken from the SubFormat GUID if the file is WAVE_FORMAT_EXTENSIBLE. A GUID
+ * which is no KSDATAFORMAT_SUBTYPE_* (e.g. Ambisonic B-format or a vendor format) leaves TW_FORMAT_EXTENSIBLE.
+ */
+static uint16_t resolveAudioFormat(const TinyWavHeader *h)
+{
+  if (h->AudioFormat == TW_FORMAT_EXTENSIBLE && h->cbSize >= 22 &&
+      memcmp(h->SubFormat + 2, kSubFormatGuidTail, sizeof(kSubFormatGuidTail)) == 0) {
+    return (uint16_t) (h->SubFormat[0] | (h->SubFormat[1] << 8));
+  }
+  return h->AudioFormat;
+}
+
+// MARK: file I/O
+
+/** @returns a monotonic time in nanoseconds */
+static uint64_t nowNanoseconds(void) {
+#if _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+#endif
+}
+
+/** Calls the begin hook of the handle, if any */
+static inline void traceBegin(const TinyWav *tw, TinyWavTraceEvent event, int64_t value) {
+  if (tw->trace != NULL && tw->trace->begin != NULL) {
+    tw->trace->begin(tw->trace->userData, event, value);
+  }
+}
+
+/** Calls the end hook of the handle, if any */
+static inline void traceEnd(const TinyWav *tw, TinyWavTraceEvent event, int64_t value) {
+  if (tw->trace != NULL && tw->trace->end != NULL) {
+    tw->trace->end(tw->trace->userData, event, value);
+  }
+}
+
+#if TINYWAV_HAS_DIRECT_IO
+/** Turns O_DIRECT on or off for the file descriptor. @return  The error code. Zero if no error. */
+static int setDirectFlag(int fd, bool isDirect) {
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
     return -1;
   }
-  
+  return fcntl(fd, F_SETFL, isDirect ? (flags | O_DIRECT) : (flags & ~O_DIRECT));
+}
+
+/**
+ * Writes the pending bytes of the direct I/O buffer. Whole aligned blocks bypass the page cache. An unaligned
+ * remainder (the header patched on close, the tail of the data) is written with O_DIRECT turned off for the moment.
+ * @return  The error code. Zero if no error.
+ */
+static int flushDirect(TinyWav *tw) {
+  TinyWavDirectIO *d = &tw->direct;
+  if (!d->isDirty) {
+    return 0;
+  }
+  const bool isAligned = (d->start % TINYWAV_DIRECT_ALIGNMENT) == 0 && (d->len % TINYWAV_DIRECT_ALIGNMENT) == 0;
+  if (!isAligned && setDirectFlag(d->fd, false) != 0) {
+    return -1;
+  }
+  const ssize_t n = pwrite(d->fd, d->buffer, d->len, (off_t) d->start);
+  if (!isAligned) {
+    setDirectFlag(d->fd, true);
+  }
+  if (n != (ssize_t) d->len) {
+    return -1; // the buffer stays dirty, so the bytes are not lost and the flush can be retried
+  }
+  d->isDirty = false;
+  d->len = 0;
+  return 0;
+}
+
+/** Reads len bytes at the current position through the direct I/O buffer. @return  The number of bytes read */
+static size_t directRead(TinyWav *tw, void *data, size_t len) {
+  TinyWavDirectIO *d = &tw->direct;
+  uint8_t *p = (uint8_t *) data;
+  size_t done = 0;
+  while (done < len) {
+    if (d->position >= d->start && d->position < d->start + (int64_t) d->len) {
+      const size_t offset = (size_t) (d->position - d->start);
+      const size_t n = (d->len - offset < len - done) ? d->len - offset : len - done;
+      memcpy(p + done, d->buffer + offset, n);
+      done += n;
+      d->position += (int64_t) n;
+      continue;
+    }
+    if (flushDirect(tw) != 0) {
+      break;
+    }
+    // read the aligned block around the position
+    const int64_t start = d->position - (d->position % TINYWAV_DIRECT_ALIGNMENT);
+    const ssize_t n = pread(d->fd, d->buffer, d->size, (off_t) start);
+    d->start = start;
+    d->len = (n > 0) ? (size_t) n : 0;
+    if (d->position >= start + (int64_t) d->len) {
+      break; // end of file
+    }
+  }
+  return done;
+}
+
+/**
+ * Writes len bytes at the current position through the direct I/O buffer. If the buffer cannot be flushed, none of the
+ * bytes count as written: they are dropped from the buffer and the position goes back to where it was, while the
+ * bytes of earlier writes stay pending. tw->hasWriteError is set.
+ * @return  The number of bytes written, len or 0
+ */
+static size_t directWrite(TinyWav *tw, const void *data, size_t len) {
+  TinyWavDirectIO *d = &tw->direct;
+  const uint8_t *p = (const uint8_t *) data;
+  if (d->isDirty && d->position != d->start + (int64_t) d->len && flushDirect(tw) != 0) {
+    tw->hasWriteError = true;
+    return 0;
+  }
+  const int64_t position = d->position;
+  size_t pending = 0; // bytes of this call which are in the buffer only
+  size_t done = 0;
+  while (done < len) {
+    if (!d->isDirty) {
+      d->start = d->position;
+      d->len = 0;
+      d->isDirty = true;
+    }
+    const size_t n = (d->size - d->len < len - done) ? d->size - d->len : len - done;
+    memcpy(d->buffer + d->len, p + done, n);
+    d->len += n;
+    done += n;
+    pending += n;
+    d->position += (int64_t) n;
+    if (d->len == d->size) {
+      if (flushDirect(tw) != 0) {
+        d->len -= pending;
+        d->isDirty = (d->len > 0);
+        d->position = position; // bytes of this call which did reach the file are overwritten by the next write
+        tw->hasWriteError = true;
+        return 0;
+      }
+      pending = 0;
+    }
+  }
+  return done;
+}
+#endif // TINYWAV_HAS_DIRECT_IO
+
+/** fread from the file of the handle, or from its direct I/O buffer */
+static size_t readFile(TinyWav *tw, void *data, size_t size, size_t n) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    return (size > 0) ? directRead(tw, data, size * n) / size : 0;
+  }
+#endif
+  return fread(data, size, n, tw->f);
+}
+
+/** fwrite to the file of the handle, or to its direct I/O buffer */
+static size_t writeFile(TinyWav *tw, const void *data, size_t size, size_t n) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    return (size > 0) ? directWrite(tw, data, size * n) / size : 0;
+  }
+#endif
+  return fwrite(data, size, n, tw->f);
+}
+
+/** fseek in the file of the handle, or in its direct I/O buffer */
+static int seekFile(TinyWav *tw, long offset, int whence) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    const int64_t position = (int64_t) offset + ((whence == SEEK_CUR) ? tw->direct.position : 0);
+    if ((whence != SEEK_SET && whence != SEEK_CUR) || position < 0) {
+      return -1;
+    }
+    tw->direct.position = position;
+    return 0;
+  }
+#endif
+  return fseek(tw->f, offset, whence);
+}
+
+/** ftell of the file of the handle */
+static long tellFile(TinyWav *tw) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    return (long) tw->direct.position;
+  }
+#endif
+  return ftell(tw->f);
+}
+
+#if !_WIN32
+/** @return  The file descriptor of the file of the handle */
+static int fileDescriptor(TinyWav *tw) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    return tw->direct.fd;
+  }
+#endif
+  return fileno(tw->f);
+}
+#endif
+
+/**
+ * Reserves the first size bytes of the file, so that it is allocated in one piece. The size of the file stays that of
+ * the data written so far, so that after a crash the reserved space is not mistaken for audio data by a recovering
+ * reader. The space which is not written is given back by truncateFile() on close.
+ * @return  true if successful
+ */
+static bool preallocateFile(TinyWav *tw, int64_t size) {
+#if TINYWAV_HAS_PREALLOCATION
+  return fallocate(fileDescriptor(tw), FALLOC_FL_KEEP_SIZE, 0, (off_t) size) == 0;
+#else
+  (void) tw; (void) size;
+  return false;
+#endif
+}
+
+/** Advises the OS that len bytes at offset will be read sequentially and soon, so that it reads ahead */
+static void adviseSequential(TinyWav *tw, int64_t offset, int64_t len) {
+#if TINYWAV_HAS_FILE_HINTS
+  posix_fadvise(fileDescriptor(tw), (off_t) offset, (off_t) len, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fileDescriptor(tw), (off_t) offset, (off_t) len, POSIX_FADV_WILLNEED);
+#else
+  (void) tw; (void) offset; (void) len;
+#endif
+}
+
+/** Cuts the file to size bytes, after writing what is pending. This also gives back space reserved beyond size. */
+static void truncateFile(TinyWav *tw, int64_t size) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    flushDirect(tw);
+  }
+#endif
+  fflush(tw->f);
 #if _WIN32
-  errno_t err = fopen_s(&tw->f, path, "wb");
-  if (err != 0) { tw->f = NULL; }
+  _chsize_s(_fileno(tw->f), size);
 #else
-  tw->f = fopen(path, "wb");
+  if (ftruncate(fileDescriptor(tw), (off_t) size) != 0) {
+    perror("[tinywav] Failed to truncate file");
+  }
 #endif
-  
-  if (tw->f == NULL) {
-    perror("[tinywav] Failed to open file for writing");
+}
+
+/**
+ * Writes len bytes at offset without moving the position of the next read or write. Anything pending must have been
+ * flushed before.
+ * @return  The error code. Zero if no error.
+ */
+static int writeFileAt(TinyWav *tw, int64_t offset, const void *data, size_t len) {
+#if _WIN32
+  const long position = ftell(tw->f);
+  const bool isWritten = fseek(tw->f, (long) offset, SEEK_SET) == 0 && fwrite(data, 1, len, tw->f) == len;
+  return (fseek(tw->f, position, SEEK_SET) == 0 && isWritten) ? 0 : -1;
+#else
+#if TINYWAV_HAS_DIRECT_IO
+  // a few bytes of the header are never aligned
+  const bool isDirect = (tw->direct.buffer != NULL);
+  if (isDirect && setDirectFlag(tw->direct.fd, false) != 0) {
     return -1;
   }
+#endif
+  const ssize_t n = pwrite(fileDescriptor(tw), data, len, (off_t) offset);
+#if TINYWAV_HAS_DIRECT_IO
+  if (isDirect) {
+    setDirectFlag(tw->direct.fd, true);
+  }
+#endif
+  return (n == (ssize_t) len) ? 0 : -1;
+#endif
+}
 
-  tw->numChannels = numChannels;
-  tw->numFramesInHeader = -1; // not used for writer
-  tw->totalFramesReadWritten = 0;
-  tw->sampFmt = sampFmt;
-  tw->chanFmt = chanFmt;
+/** @return  The size of the file in bytes, -1 if unknown */
+static int64_t fileSize(TinyWav *tw) {
+#if _WIN32
+  return (int64_t) _filelengthi64(_fileno(tw->f));
+#else
+  struct stat st;
+  return (fstat(fileDescriptor(tw), &st) == 0) ? (int64_t) st.st_size : -1;
+#endif
+}
 
-  // prepare WAV header
-  /**@note: We do this byte-by-byte to avoid dependencies (htonl() et al.) and because struct padding depends on
-   * specific compiler implementation ('slurping' directly into the header struct is therefore dangerous). */
-  tw->h.ChunkID[0] = 'R';
-  tw->h.ChunkID[1] = 'I';
-  tw->h.ChunkID[2] = 'F';
-  tw->h.ChunkID[3] = 'F';
-  tw->h.ChunkSize = 0; // fill this in on file-close
-  tw->h.Format[0] = 'W';
-  tw->h.Format[1] = 'A';
-  tw->h.Format[2] = 'V';
-  tw->h.Format[3] = 'E';
-  tw->h.Subchunk1ID[0] = 'f';
-  tw->h.Subchunk1ID[1] = 'm';
-  tw->h.Subchunk1ID[2] = 't';
-  tw->h.Subchunk1ID[3] = ' ';
-  tw->h.Subchunk1Size = 16; // PCM
-  tw->h.AudioFormat = (uint16_t) (tw->sampFmt - 1); // 1 PCM, 3 IEEE float
-  tw->h.NumChannels = (uint16_t) numChannels;
-  tw->h.SampleRate = samplerate;
-  tw->h.ByteRate = samplerate * numChannels * tw->sampFmt;
-  tw->h.BlockAlign = (uint16_t) (numChannels * tw->sampFmt);
-  tw->h.BitsPerSample = (uint16_t) (8 * tw->sampFmt);
-  tw->h.Subchunk2ID[0] = 'd';
-  tw->h.Subchunk2ID[1] = 'a';
-  tw->h.Subchunk2ID[2] = 't';
-  tw->h.Subchunk2ID[3] = 'a';
-  tw->h.Subchunk2Size = 0; // fill this in on file-close
+/**
+ * Makes what has been written to the file so far durable, without its metadata (fdatasync)
+ * @return  The error code. Zero if no error.
+ */
+static int syncFile(TinyWav *tw) {
+#if _WIN32
+  return _commit(_fileno(tw->f));
+#elif defined(__linux__)
+  return fdatasync(fileDescriptor(tw));
+#else
+  return fsync(fileDescriptor(tw));
+#endif
+}
 
-  // write WAV header
-  size_t elementCount = fwrite(tw->h.ChunkID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.ChunkSize, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(tw->h.Format, sizeof(char), 4, tw->f);
-  elementCount += fwrite(tw->h.Subchunk1ID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.Subchunk1Size, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.AudioFormat, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.NumChannels, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.SampleRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.ByteRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.BlockAlign, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.BitsPerSample, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(tw->h.Subchunk2ID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.Subchunk2Size, sizeof(uint32_t), 1, tw->f);
-  if (elementCount != 25) {
+/** Writes what is pending and closes the file of the handle */
+static void closeFile(TinyWav *tw) {
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL) {
+    flushDirect(tw);
+    tw->direct.buffer = NULL;
+  }
+#endif
+  fclose(tw->f);
+  tw->f = NULL;
+}
+
+/** fread from the file of the handle, counted in its I/O statistics */
+static size_t ioRead(TinyWav *tw, void *data, size_t size, size_t n) {
+  TW_USDT(fread_begin, tw, size * n);
+  traceBegin(tw, TW_TRACE_FREAD, (int64_t) (size * n));
+  TinyWavIOStats *io = tw->ioStats;
+  size_t count;
+  if (io == NULL) {
+    count = readFile(tw, data, size, n);
+  } else {
+    const uint64_t start = nowNanoseconds();
+    count = readFile(tw, data, size, n);
+    io->ioNanoseconds += nowNanoseconds() - start;
+    io->numReads++;
+    io->bytesRead += (uint64_t) count * size;
+    io->numShortReads += (count < n);
+  }
+  traceEnd(tw, TW_TRACE_FREAD, (int64_t) (count * size));
+  TW_USDT(fread_end, tw, count * size);
+  return count;
+}
+
+/** fwrite to the file of the handle, counted in its I/O statistics */
+static size_t ioWrite(TinyWav *tw, const void *data, size_t size, size_t n) {
+  TW_USDT(fwrite_begin, tw, size * n);
+  traceBegin(tw, TW_TRACE_FWRITE, (int64_t) (size * n));
+  TinyWavIOStats *io = tw->ioStats;
+  size_t count;
+  if (io == NULL) {
+    count = writeFile(tw, data, size, n);
+  } else {
+    const uint64_t start = nowNanoseconds();
+    count = writeFile(tw, data, size, n);
+    io->ioNanoseconds += nowNanoseconds() - start;
+    io->numWrites++;
+    io->bytesWritten += (uint64_t) count * size;
+  }
+  traceEnd(tw, TW_TRACE_FWRITE, (int64_t) (count * size));
+  TW_USDT(fwrite_end, tw, count * size);
+  return count;
+}
+
+/** fseek in the file of the handle, counted in its I/O statistics */
+static int ioSeek(TinyWav *tw, long offset, int whence) {
+  TinyWavIOStats *io = tw->ioStats;
+  if (io == NULL) {
+    return seekFile(tw, offset, whence);
+  }
+  const uint64_t start = nowNanoseconds();
+  const int result = seekFile(tw, offset, whence);
+  io->ioNanoseconds += nowNanoseconds() - start;
+  io->numSeeks++;
+  return result;
+}
+
+/** Starts timing a call of tinywav_read_f() or tinywav_write_f() of len frames */
+static uint64_t beginTimedCall(TinyWav *tw, int len) {
+  TinyWavIOStats *io = tw->ioStats;
+  if (io == NULL) {
+    return 0;
+  }
+  if (len > io->maxBlockSize) {
+    io->maxBlockSize = len;
+  }
+  return nowNanoseconds() - io->ioNanoseconds;
+}
+
+/** Attributes the time since beginTimedCall() that was not spent in I/O to conversion */
+static void endTimedCall(TinyWav *tw, uint64_t start) {
+  TinyWavIOStats *io = tw->ioStats;
+  if (io != NULL) {
+    io->conversionNanoseconds += nowNanoseconds() - io->ioNanoseconds - start;
+  }
+}
+
+// MARK: hashing
+
+static const uint64_t kXxh64Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kXxh64Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kXxh64Prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kXxh64Prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kXxh64Prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t readUInt64LE(const uint8_t *p) {
+  return (uint64_t) readUInt32LE(p) | ((uint64_t) readUInt32LE(p + 4) << 32);
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint32_t rotl32(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+static uint64_t xxh64Round(uint64_t acc, uint64_t input) {
+  return rotl64(acc + input * kXxh64Prime2, 31) * kXxh64Prime1;
+}
+
+static uint64_t xxh64MergeRound(uint64_t acc, uint64_t value) {
+  return (acc ^ xxh64Round(0, value)) * kXxh64Prime1 + kXxh64Prime4;
+}
+
+/** Processes 32-byte stripes of input */
+static void xxh64Stripes(uint64_t v[4], const uint8_t *p, size_t numStripes) {
+  for (size_t i = 0; i < numStripes; ++i, p += 32) {
+    v[0] = xxh64Round(v[0], readUInt64LE(p));
+    v[1] = xxh64Round(v[1], readUInt64LE(p + 8));
+    v[2] = xxh64Round(v[2], readUInt64LE(p + 16));
+    v[3] = xxh64Round(v[3], readUInt64LE(p + 24));
+  }
+}
+
+static uint64_t xxh64Digest(const TinyWavHash *hash) {
+  const uint64_t *v = hash->xxh64State;
+  uint64_t h;
+  if (hash->length >= 32) {
+    h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+    for (int i = 0; i < 4; ++i) {
+      h = xxh64MergeRound(h, v[i]);
+    }
+  } else {
+    h = kXxh64Prime5; // seed 0
+  }
+  h += hash->length;
+
+  const uint8_t *p = hash->xxh64Buffer;
+  size_t remaining = (size_t) (hash->length % 32);
+  for (; remaining >= 8; remaining -= 8, p += 8) {
+    h = rotl64(h ^ xxh64Round(0, readUInt64LE(p)), 27) * kXxh64Prime1 + kXxh64Prime4;
+  }
+  if (remaining >= 4) {
+    h = rotl64(h ^ ((uint64_t) readUInt32LE(p) * kXxh64Prime1), 23) * kXxh64Prime2 + kXxh64Prime3;
+    remaining -= 4;
+    p += 4;
+  }
+  for (; remaining > 0; --remaining, ++p) {
+    h = rotl64(h ^ (*p * kXxh64Prime5), 11) * kXxh64Prime1;
+  }
+
+  h ^= h >> 33;
+  h *= kXxh64Prime2;
+  h ^= h >> 29;
+  h *= kXxh64Prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+/** MD5 sine table, see RFC 1321 */
+static const uint32_t kMd5K[64] = {
+  0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+  0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+  0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+  0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+  0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+  0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+  0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+  0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+};
+
+/** MD5 rotation amounts per round */
+static const uint8_t kMd5Shift[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+/** Processes 64-byte blocks of input */
+static void md5Blocks(uint32_t state[4], const uint8_t *p, size_t numBlocks) {
+  for (size_t block = 0; block < numBlocks; ++block, p += 64) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) {
+      m[i] = readUInt32LE(p + 4*i);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t f;
+      int g;
+      switch (i >> 4) {
+        case 0: f = (b & c) | (~b & d); g = i; break;
+        case 1: f = (d & b) | (~d & c); g = (5*i + 1) & 15; break;
+        case 2: f = b ^ c ^ d; g = (3*i + 5) & 15; break;
+        default: f = c ^ (b | ~d); g = (7*i) & 15; break;
+      }
+      f += a + kMd5K[i] + m[g];
+      a = d;
+      d = c;
+      c = b;
+      b += rotl32(f, kMd5Shift[((i >> 4) << 2) | (i & 3)]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+}
+
+static void md5Digest(TinyWavHash *hash) {
+  const size_t buffered = (size_t) (hash->length % 64);
+  uint8_t tail[128];
+  memcpy(tail, hash->md5Buffer, buffered);
+  // padding: a single 1 bit, zeros up to 56 mod 64 bytes, then the message length in bits
+  const size_t tailLen = (buffered < 56) ? 64 : 128;
+  memset(tail + buffered, 0, tailLen - buffered);
+  tail[buffered] = 0x80;
+  writeUInt32LE(tail + tailLen - 8, (uint32_t) (hash->length << 3));
+  writeUInt32LE(tail + tailLen - 4, (uint32_t) (hash->length >> 29));
+  md5Blocks(hash->md5State, tail, tailLen / 64);
+  for (int i = 0; i < 4; ++i) {
+    writeUInt32LE(hash->md5 + 4*i, hash->md5State[i]);
+  }
+}
+
+/** Appends data to a block-wise hash, buffering what does not fill a whole block */
+static void hashBlocks(void (*process)(void *state, const uint8_t *p, size_t numBlocks), void *state,
+                       uint8_t *buffer, size_t blockSize, uint64_t length, const uint8_t *p, size_t len) {
+  size_t buffered = (size_t) (length % blockSize);
+  if (buffered > 0) {
+    const size_t n = (len < blockSize - buffered) ? len : blockSize - buffered;
+    memcpy(buffer + buffered, p, n);
+    p += n;
+    len -= n;
+    buffered += n;
+    if (buffered < blockSize) {
+      return;
+    }
+    process(state, buffer, 1);
+  }
+  process(state, p, len / blockSize);
+  memcpy(buffer, p + len - len % blockSize, len % blockSize);
+}
+
+static void xxh64Process(void *state, const uint8_t *p, size_t numBlocks) {
+  xxh64Stripes((uint64_t *) state, p, numBlocks);
+}
+
+static void md5Process(void *state, const uint8_t *p, size_t numBlocks) {
+  md5Blocks((uint32_t *) state, p, numBlocks);
+}
+
+/**
+ * Adds bytes of the data chunk to the hashes of tw, if any.
+ * @param offset  the position of data within the data chunk. Bytes which have been hashed already are skipped, as
+ *                some readers read parts of the data chunk more than once (e.g. ADPCM blocks).
+ */
+static void hashData(TinyWav *tw, uint64_t offset, const void *data, size_t len) {
+  TinyWavHash *hash = tw->hash;
+  if (hash == NULL || offset > hash->length || offset + len <= hash->length) {
+    return;
+  }
+  const size_t skip = (size_t) (hash->length - offset);
+  const uint8_t *p = (const uint8_t *) data + skip;
+  len -= skip;
+  if (hash->types & TW_HASH_XXH64) {
+    hashBlocks(xxh64Process, hash->xxh64State, hash->xxh64Buffer, 32, hash->length, p, len);
+  }
+  if (hash->types & TW_HASH_MD5) {
+    hashBlocks(md5Process, hash->md5State, hash->md5Buffer, 64, hash->length, p, len);
+  }
+  hash->length += len;
+}
+
+/** Adds bytes read from the data chunk to the hashes of tw. Reads may extend beyond the end of the data chunk. */
+static void hashReadData(TinyWav *tw, uint64_t offset, const void *data, size_t len) {
+  if (offset + len > tw->h.Subchunk2Size) {
+    len = (offset < tw->h.Subchunk2Size) ? (size_t) (tw->h.Subchunk2Size - offset) : 0;
+  }
+  hashData(tw, offset, data, len);
+}
+
+// MARK: channel statistics
+
+/**
+ * Statistics of one channel over a block of samples. The loops converting the samples accumulate them while they hold
+ * each sample anyway, so collecting statistics costs no extra pass over the samples.
+ */
+typedef struct StatsAccumulator {
+  float peak;
+  uint32_t numClipped;
+  double sum;
+  double sumSquares;
+} StatsAccumulator;
+
+static inline StatsAccumulator beginStats(const TinyWavStats *stats) {
+  StatsAccumulator a = { stats->peak, 0, 0.0, 0.0 };
+  return a;
+}
+
+static inline void addToStats(StatsAccumulator *a, float v) {
+  const float m = fabsf(v);
+  a->peak = (m > a->peak) ? m : a->peak;
+  a->numClipped += (m >= 1.0f);
+  a->sum += v;
+  a->sumSquares += (double) v * v;
+}
+
+/** Adds a block of n samples to the statistics of the channel */
+static inline void endStats(TinyWavStats *stats, const StatsAccumulator *a, int n) {
+  stats->peak = a->peak;
+  stats->numSamples += (uint64_t) n;
+  stats->numClipped += a->numClipped;
+  stats->sum += a->sum;
+  stats->sumSquares += a->sumSquares;
+}
+
+/** Derives the RMS and DC offset of each channel from the accumulated sums */
+static void updateStats(TinyWavStats *stats, int numChannels) {
+  for (int c = 0; c < numChannels; ++c) {
+    const double n = (stats[c].numSamples > 0) ? (double) stats[c].numSamples : 1.0;
+    stats[c].rms = (float) sqrt(stats[c].sumSquares / n);
+    stats[c].dc = (float) (stats[c].sum / n);
+  }
+}
+
+// MARK: channel selection & mixing
+
+/** @returns the number of channels exchanged with the caller by tinywav_read_f() and tinywav_write_f() */
+static int numUserChannels(const TinyWav *tw) {
+  if (tw->mixMatrix != NULL) {
+    return tw->numMixOutputs;
+  }
+  return (tw->selectedChannels != NULL) ? tw->numSelectedChannels : tw->numChannels;
+}
+
+/** @returns true if reads deliver something else than all channels of the file */
+static bool hasChannelMapping(const TinyWav *tw) {
+  return tw->selectedChannels != NULL || tw->mixMatrix != NULL;
+}
+
+/**
+ * @returns true if reads convert the samples channel by channel in gatherChannels(): to deliver only some of the
+ * channels or a mix of them, or to collect the statistics of each channel in the same loop
+ */
+static bool isGathered(const TinyWav *tw) {
+  return hasChannelMapping(tw) || tw->stats != NULL;
+}
+
+/**
+ * Converts interleaved samples to float in the channel format of tw, delivering all channels, only the selected ones
+ * or the mix of the channels. Each output channel is computed in a single pass over the interleaved samples, with the
+ * conversion to float folded into the mixing coefficients and its statistics accumulated on the way, if collected.
+ * @param table  the expansion table if the samples are 8-bit G.711 codes, NULL if they are in the format of tw->sampFmt
+ */
+static int gatherChannels(const TinyWav *tw, const void *interleaved_data, const int16_t *table, int frames, void *data) {
+  const int numChannels = tw->numChannels;
+  const int numOut = numUserChannels(tw);
+  const float scale = (table != NULL || tw->sampFmt == TW_INT16) ? 1.0f / INT16_MAX : 1.0f;
+  TW_ALLOC(float, coefficients, numChannels);
+  for (int k = 0; k < numOut; ++k) {
+    float *out;
+    int step;
+    switch (tw->chanFmt) {
+      case TW_INTERLEAVED: out = (float *) data + k; step = numOut; break; // e.g. [LRLRLRLR]
+      case TW_INLINE: out = (float *) data + k * frames; step = 1; break;  // e.g. [LLLLRRRR]
+      case TW_SPLIT: out = ((float **) data)[k]; step = 1; break;          // e.g. [[LLLL],[RRRR]]
+      default: TW_DEALLOC(coefficients); return 0;
+    }
+    
+    StatsAccumulator stats;
+    StatsAccumulator *const a = (tw->stats != NULL) ? &stats : NULL;
+    if (a != NULL) {
+      stats = beginStats(&tw->stats[k]);
+    }
+    
+    if (tw->mixMatrix == NULL) {
+      const int c = (tw->selectedChannels != NULL) ? tw->selectedChannels[k] : k;
+      if (table != NULL) {
+        const uint8_t *x = (const uint8_t *) interleaved_data + c;
+        for (int j = 0; j < frames; ++j) {
+          const float v = (float) table[x[j*numChannels]] / INT16_MAX;
+          if (a != NULL) addToStats(a, v);
+          out[j*step] = v;
+        }
+      } else if (tw->sampFmt == TW_INT16) {
+        const int16_t *x = (const int16_t *) interleaved_data + c;
+        for (int j = 0; j < frames; ++j) {
+          const float v = (float) x[j*numChannels] / INT16_MAX;
+          if (a != NULL) addToStats(a, v);
+          out[j*step] = v;
+        }
+      } else {
+        const float *x = (const float *) interleaved_data + c;
+        for (int j = 0; j < frames; ++j) {
+          const float v = x[j*numChannels];
+          if (a != NULL) addToStats(a, v);
+          out[j*step] = v;
+        }
+      }
+    } else {
+      const float gain = (tw->mixGains != NULL) ? tw->mixGains[k] * scale : scale;
+      for (int c = 0; c < numChannels; ++c) {
+        coefficients[c] = tw->mixMatrix[k*numChannels + c] * gain;
+      }
+      if (table != NULL) {
+        const uint8_t *x = (const uint8_t *) interleaved_data;
+        for (int j = 0; j < frames; ++j, x += numChannels) {
+          float sum = 0.0f;
+          for (int c = 0; c < numChannels; ++c) sum += coefficients[c] * (float) table[x[c]];
+          if (a != NULL) addToStats(a, sum);
+          out[j*step] = sum;
+        }
+      } else if (tw->sampFmt == TW_INT16) {
+        const int16_t *x = (const int16_t *) interleaved_data;
+        for (int j = 0; j < frames; ++j, x += numChannels) {
+          float sum = 0.0f;
+          for (int c = 0; c < numChannels; ++c) sum += coefficients[c] * (float) x[c];
+          if (a != NULL) addToStats(a, sum);
+          out[j*step] = sum;
+        }
+      } else {
+        const float *x = (const float *) interleaved_data;
+        for (int j = 0; j < frames; ++j, x += numChannels) {
+          float sum = 0.0f;
+          for (int c = 0; c < numChannels; ++c) sum += coefficients[c] * x[c];
+          if (a != NULL) addToStats(a, sum);
+          out[j*step] = sum;
+        }
+      }
+    }
+    
+    if (a != NULL) {
+      endStats(&tw->stats[k], a, frames);
+    }
+  }
+  TW_DEALLOC(coefficients);
+  return frames;
+}
+
+// MARK: G.711
+
+/** G.711 A-law code to 16-bit linear PCM */
+static const int16_t kALawTable[256] = {
+   -5504,  -5248,  -6016,  -5760,  -4480,  -4224,  -4992,  -4736,
+   -7552,  -7296,  -8064,  -7808,  -6528,  -6272,  -7040,  -6784,
+   -2752,  -2624,  -3008,  -2880,  -2240,  -2112,  -2496,  -2368,
+   -3776,  -3648,  -4032,  -3904,  -3264,  -3136,  -3520,  -3392,
+  -22016, -20992, -24064, -23040, -17920, -16896, -19968, -18944,
+  -30208, -29184, -32256, -31232, -26112, -25088, -28160, -27136,
+  -11008, -10496, -12032, -11520,  -8960,  -8448,  -9984,  -9472,
+  -15104, -14592, -16128, -15616, -13056, -12544, -14080, -13568,
+    -344,   -328,   -376,   -360,   -280,   -264,   -312,   -296,
+    -472,   -456,   -504,   -488,   -408,   -392,   -440,   -424,
+     -88,    -72,   -120,   -104,    -24,     -8,    -56,    -40,
+    -216,   -200,   -248,   -232,   -152,   -136,   -184,   -168,
+   -1376,  -1312,  -1504,  -1440,  -1120,  -1056,  -1248,  -1184,
+   -1888,  -1824,  -2016,  -1952,  -1632,  -1568,  -1760,  -1696,
+    -688,   -656,   -752,   -720,   -560,   -528,   -624,   -592,
+    -944,   -912,  -1008,   -976,   -816,   -784,   -880,   -848,
+    5504,   5248,   6016,   5760,   4480,   4224,   4992,   4736,
+    7552,   7296,   8064,   7808,   6528,   6272,   7040,   6784,
+    2752,   2624,   3008,   2880,   2240,   2112,   2496,   2368,
+    3776,   3648,   4032,   3904,   3264,   3136,   3520,   3392,
+   22016,  20992,  24064,  23040,  17920,  16896,  19968,  18944,
+   30208,  29184,  32256,  31232,  26112,  25088,  28160,  27136,
+   11008,  10496,  12032,  11520,   8960,   8448,   9984,   9472,
+   15104,  14592,  16128,  15616,  13056,  12544,  14080,  13568,
+     344,    328,    376,    360,    280,    264,    312,    296,
+     472,    456,    504,    488,    408,    392,    440,    424,
+      88,     72,    120,    104,     24,      8,     56,     40,
+     216,    200,    248,    232,    152,    136,    184,    168,
+    1376,   1312,   1504,   1440,   1120,   1056,   1248,   1184,
+    1888,   1824,   2016,   1952,   1632,   1568,   1760,   1696,
+     688,    656,    752,    720,    560,    528,    624,    592,
+     944,    912,   1008,    976,    816,    784,    880,    848
+};
+
+/** G.711 mu-law code to 16-bit linear PCM */
+static const int16_t kMuLawTable[256] = {
+  -32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+  -23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+  -15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+  -11900, -11388, -10876, -10364,  -9852,  -9340,  -8828,  -8316,
+   -7932,  -7676,  -7420,  -7164,  -6908,  -6652,  -6396,  -6140,
+   -5884,  -5628,  -5372,  -5116,  -4860,  -4604,  -4348,  -4092,
+   -3900,  -3772,  -3644,  -3516,  -3388,  -3260,  -3132,  -3004,
+   -2876,  -2748,  -2620,  -2492,  -2364,  -2236,  -2108,  -1980,
+   -1884,  -1820,  -1756,  -1692,  -1628,  -1564,  -1500,  -1436,
+   -1372,  -1308,  -1244,  -1180,  -1116,  -1052,   -988,   -924,
+    -876,   -844,   -812,   -780,   -748,   -716,   -684,   -652,
+    -620,   -588,   -556,   -524,   -492,   -460,   -428,   -396,
+    -372,   -356,   -340,   -324,   -308,   -292,   -276,   -260,
+    -244,   -228,   -212,   -196,   -180,   -164,   -148,   -132,
+    -120,   -112,   -104,    -96,    -88,    -80,    -72,    -64,
+     -56,    -48,    -40,    -32,    -24,    -16,     -8,      0,
+   32124,  31100,  30076,  29052,  28028,  27004,  25980,  24956,
+   23932,  22908,  21884,  20860,  19836,  18812,  17788,  16764,
+   15996,  15484,  14972,  14460,  13948,  13436,  12924,  12412,
+   11900,  11388,  10876,  10364,   9852,   9340,   8828,   8316,
+    7932,   7676,   7420,   7164,   6908,   6652,   6396,   6140,
+    5884,   5628,   5372,   5116,   4860,   4604,   4348,   4092,
+    3900,   3772,   3644,   3516,   3388,   3260,   3132,   3004,
+    2876,   2748,   2620,   2492,   2364,   2236,   2108,   1980,
+    1884,   1820,   1756,   1692,   1628,   1564,   1500,   1436,
+    1372,   1308,   1244,   1180,   1116,   1052,    988,    924,
+     876,    844,    812,    780,    748,    716,    684,    652,
+     620,    588,    556,    524,    492,    460,    428,    396,
+     372,    356,    340,    324,    308,    292,    276,    260,
+     244,    228,    212,    196,    180,    164,    148,    132,
+     120,    112,    104,     96,     88,     80,     72,     64,
+      56,     48,     40,     32,     24,     16,      8,      0
+};
+
+/**
+ * Reads G.711 (A-law or mu-law) encoded samples. Every 8-bit code is expanded with a single table lookup, fused into
+ * the loop that arranges the samples in the requested channel format. With isInt16, the linear samples are returned
+ * interleaved as they are, without channel mapping or conversion to float.
+ */
+static int readG711(TinyWav *tw, void *data, int len, bool isInt16) {
+  const int16_t *const table = (tw->audioFormat == TW_FORMAT_ALAW) ? kALawTable : kMuLawTable;
+  TW_ALLOC(uint8_t, encoded_data, tw->numChannels*len);
+  size_t samples_read = ioRead(tw, encoded_data, sizeof(uint8_t), tw->numChannels*len);
+  hashReadData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, encoded_data, samples_read);
+  uint32_t frames_read_u32 = (uint32_t) (samples_read / tw->numChannels);
+  tw->totalFramesReadWritten += frames_read_u32;
+  int frames_read = (int) frames_read_u32;
+  if (isInt16) {
+    for (int pos = 0; pos < tw->numChannels * frames_read; pos++) {
+      ((int16_t *) data)[pos] = table[encoded_data[pos]];
+    }
+    TW_DEALLOC(encoded_data);
+    return frames_read;
+  }
+  if (isGathered(tw)) {
+    gatherChannels(tw, encoded_data, table, frames_read, data);
+    TW_DEALLOC(encoded_data);
+    return frames_read;
+  }
+  switch (tw->chanFmt) {
+    case TW_INTERLEAVED: { // channel buffer is interleaved e.g. [LRLRLRLR]
+      for (int pos = 0; pos < tw->numChannels * frames_read; pos++) {
+        ((float *) data)[pos] = (float) table[encoded_data[pos]] / INT16_MAX;
+      }
+      break;
+    }
+    case TW_INLINE: { // channel buffer is inlined e.g. [LLLLRRRR]
+      for (int i = 0, pos = 0; i < tw->numChannels; i++) {
+        for (int j = i; j < frames_read * tw->numChannels; j += tw->numChannels, ++pos) {
+          ((float *) data)[pos] = (float) table[encoded_data[j]] / INT16_MAX;
+        }
+      }
+      break;
+    }
+    case TW_SPLIT: { // channel buffer is split e.g. [[LLLL],[RRRR]]
+      for (int i = 0; i < tw->numChannels; i++) {
+        for (int j = 0; j < frames_read; j++) {
+          ((float **) data)[i][j] = (float) table[encoded_data[j*tw->numChannels + i]] / INT16_MAX;
+        }
+      }
+      break;
+    }
+    default: frames_read = 0; break;
+  }
+  TW_DEALLOC(encoded_data);
+  return frames_read;
+}
+
+// MARK: ADPCM
+
+/** IMA ADPCM quantizer step sizes */
+static const int16_t kImaStepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+/** IMA ADPCM step index adjustment per nibble */
+static const int8_t kImaIndexTable[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/** MS ADPCM delta adaptation per nibble (fixed point, 8 fractional bits) */
+static const int16_t kMsAdaptationTable[16] = {
+  230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230
+};
+
+/**
+ * MS ADPCM predictor coefficients (fixed point, 8 fractional bits). The standard requires every file to start its
+ * coefficient table with these seven pairs, and in practice no encoder writes more. Files with another table are
+ * refused when their header is parsed.
+ */
+static const int16_t kMsCoefficients[7][2] = {
+  {256, 0}, {512, -256}, {0, 0}, {192, 64}, {240, 0}, {460, -208}, {392, -232}
+};
+
+static int16_t clampInt16(int32_t x) {
+  return (int16_t) ((x > INT16_MAX) ? INT16_MAX : ((x < INT16_MIN) ? INT16_MIN : x));
+}
+
+static int16_t readInt16LE(const uint8_t *p) {
+  return (int16_t) (p[0] | (p[1] << 8));
+}
+
+static bool isAdpcm(uint16_t audioFormat) {
+  return audioFormat == TW_FORMAT_IMA_ADPCM || audioFormat == TW_FORMAT_MS_ADPCM;
+}
+
+/** @returns the number of frames encoded in an ADPCM block of the given size (the last block of a file may be short) */
+static int adpcmFramesInBlock(uint16_t audioFormat, int numChannels, int blockBytes) {
+  if (audioFormat == TW_FORMAT_IMA_ADPCM) {
+    // per channel: 4 byte header (incl. first sample), followed by interleaved groups of 4 bytes (8 samples)
+    const int headerBytes = 4 * numChannels;
+    return (blockBytes < headerBytes) ? 0 : 1 + ((blockBytes - headerBytes) / headerBytes) * 8;
+  } else {
+    // per channel: 7 byte header (incl. first two samples), followed by interleaved nibbles
+    const int headerBytes = 7 * numChannels;
+    return (blockBytes < headerBytes) ? 0 : 2 + ((blockBytes - headerBytes) * 2) / numChannels;
+  }
+}
+
+static void decodeImaBlock(const uint8_t *block, int numChannels, int numFrames, int16_t *out) {
+  const uint8_t *const payload = block + 4 * numChannels;
+  for (int c = 0; c < numChannels; ++c) {
+    int32_t predictor = readInt16LE(block + 4*c);
+    int index = block[4*c + 2];
+    if (index > 88) index = 88;
+    out[c] = (int16_t) predictor;
+    for (int i = 1; i < numFrames; ++i) {
+      const int group = (i - 1) >> 3; // 4 bytes (8 nibbles) per channel and group
+      const int nibbleIndex = (i - 1) & 7;
+      const uint8_t byte = payload[(group * numChannels + c) * 4 + (nibbleIndex >> 1)];
+      const int nibble = (nibbleIndex & 1) ? (byte >> 4) : (byte & 0x0F); // low nibble first
+      const int step = kImaStepTable[index];
+      int32_t diff = step >> 3;
+      if (nibble & 1) diff += step >> 2;
+      if (nibble & 2) diff += step >> 1;
+      if (nibble & 4) diff += step;
+      predictor = clampInt16((nibble & 8) ? predictor - diff : predictor + diff);
+      index += kImaIndexTable[nibble];
+      index = (index < 0) ? 0 : ((index > 88) ? 88 : index);
+      out[i*numChannels + c] = (int16_t) predictor;
+    }
+  }
+}
+
+static void decodeMsBlock(const uint8_t *block, int numChannels, int numFrames, int16_t *out) {
+  const uint8_t *const payload = block + 7 * numChannels;
+  for (int c = 0; c < numChannels; ++c) {
+    const int predictor = (block[c] < 7) ? block[c] : 0;
+    const int32_t coef1 = kMsCoefficients[predictor][0];
+    const int32_t coef2 = kMsCoefficients[predictor][1];
+    int32_t delta = readInt16LE(block + numChannels + 2*c);
+    int32_t sample1 = readInt16LE(block + 3*numChannels + 2*c);
+    int32_t sample2 = readInt16LE(block + 5*numChannels + 2*c);
+    out[c] = (int16_t) sample2; // the older sample comes first
+    if (numFrames > 1) out[numChannels + c] = (int16_t) sample1;
+    for (int i = 2; i < numFrames; ++i) {
+      const int n = (i - 2) * numChannels + c; // nibbles are interleaved across channels
+      const uint8_t byte = payload[n >> 1];
+      const int nibble = (n & 1) ? (byte & 0x0F) : (byte >> 4); // high nibble first
+      const int32_t signedNibble = (nibble & 8) ? nibble - 16 : nibble;
+      const int32_t predicted = (sample1 * coef1 + sample2 * coef2) / 256;
+      sample2 = sample1;
+      sample1 = clampInt16(predicted + signedNibble * delta);
+      delta = (kMsAdaptationTable[nibble] * delta) / 256;
+      if (delta < 16) delta = 16;
+      out[i*numChannels + c] = (int16_t) sample1;
+    }
+  }
+}
+
+/**
+ * Decodes one ADPCM block into interleaved int16 samples. Blocks carry their complete decoder state in their
+ * header, so blocks can be decoded independently of each other (and in parallel).
+ */
+static void decodeAdpcmBlock(uint16_t audioFormat, int numChannels, int numFrames, const uint8_t *block, int16_t *out) {
+  if (audioFormat == TW_FORMAT_IMA_ADPCM) {
+    decodeImaBlock(block, numChannels, numFrames, out);
+  } else {
+    decodeMsBlock(block, numChannels, numFrames, out);
+  }
+}
+
+// MARK: sample conversion
+
+/** Converts interleaved int16 samples to float, arranged in the channel format of the TinyWav struct. */
+static int int16ToFloat(const TinyWav *tw, const int16_t *interleaved_data, int frames, void *data) {
+  if (isGathered(tw)) {
+    return gatherChannels(tw, interleaved_data, NULL, frames, data);
+  }
+  switch (tw->chanFmt) {
+    case TW_INTERLEAVED: { // channel buffer is interleaved e.g. [LRLRLRLR]
+      for (int pos = 0; pos < tw->numChannels * frames; pos++) {
+        ((float *) data)[pos] = (float) interleaved_data[pos] / INT16_MAX;
+      }
+      return frames;
+    }
+    case TW_INLINE: { // channel buffer is inlined e.g. [LLLLRRRR]
+      for (int i = 0, pos = 0; i < tw->numChannels; i++) {
+        for (int j = i; j < frames * tw->numChannels; j += tw->numChannels, ++pos) {
+          ((float *) data)[pos] = (float) interleaved_data[j] / INT16_MAX;
+        }
+      }
+      return frames;
+    }
+    case TW_SPLIT: { // channel buffer is split e.g. [[LLLL],[RRRR]]
+      for (int i = 0; i < tw->numChannels; i++) {
+        for (int j = 0; j < frames; j++) {
+          ((float **) data)[i][j] = (float) interleaved_data[j*tw->numChannels + i] / INT16_MAX;
+        }
+      }
+      return frames;
+    }
+    default: return 0;
+  }
+}
+
+/**
+ * Reads ADPCM encoded samples. Only whole blocks are read from the file: if the last block is not consumed entirely,
+ * the file position is moved back to its start so that the next read decodes it again. With isInt16, the decoded
+ * samples are returned interleaved as they are, without channel mapping or conversion to float.
+ */
+static int readAdpcm(TinyWav *tw, void *data, int len, bool isInt16) {
+  const int numChannels = tw->numChannels;
+  const int blockAlign = tw->h.BlockAlign;
+  const int framesPerBlock = tw->h.SamplesPerBlock;
+  
+  if (tw->numFramesInHeader < 0 || tw->totalFramesReadWritten >= (uint32_t) tw->numFramesInHeader) {
+    return 0; // there's nothing more to read, not an error.
+  }
+  const uint32_t framesRemaining = (uint32_t) tw->numFramesInHeader - tw->totalFramesReadWritten;
+  if ((uint32_t) len > framesRemaining) {
+    len = (int) framesRemaining;
+  }
+  if (len == 0) {
+    return 0;
+  }
+  
+  const int framesToSkip = (int) (tw->totalFramesReadWritten % (uint32_t) framesPerBlock); // delivered by the last read
+  const int numBlocks = (framesToSkip + len + framesPerBlock - 1) / framesPerBlock;
+  TW_ALLOC(uint8_t, encoded_data, numBlocks*blockAlign);
+  TW_ALLOC(int16_t, interleaved_data, numBlocks*framesPerBlock*numChannels);
+  
+  const int bytes_read = (int) ioRead(tw, encoded_data, sizeof(uint8_t), numBlocks*blockAlign);
+  const uint64_t firstBlock = tw->totalFramesReadWritten / (uint32_t) framesPerBlock;
+  hashReadData(tw, firstBlock * (uint64_t) blockAlign, encoded_data, (size_t) (bytes_read > 0 ? bytes_read : 0));
+  const int numBlocksRead = (bytes_read + blockAlign - 1) / blockAlign;
+  const int lastBlockBytes = bytes_read - (numBlocksRead - 1) * blockAlign;
+  
+  for (int b = 0; b < numBlocksRead; ++b) {
+    const int blockBytes = (b == numBlocksRead - 1) ? lastBlockBytes : blockAlign;
+    int numFrames = adpcmFramesInBlock(tw->audioFormat, numChannels, blockBytes);
+    if (numFrames > framesPerBlock) numFrames = framesPerBlock;
+    decodeAdpcmBlock(tw->audioFormat, numChannels, numFrames, encoded_data + b*blockAlign,
+                     interleaved_data + b*framesPerBlock*numChannels);
+  }
+  
+  int framesDecoded = 0;
+  if (numBlocksRead > 0) {
+    int lastBlockFrames = adpcmFramesInBlock(tw->audioFormat, numChannels, lastBlockBytes);
+    if (lastBlockFrames > framesPerBlock) lastBlockFrames = framesPerBlock;
+    framesDecoded = (numBlocksRead - 1) * framesPerBlock + lastBlockFrames;
+  }
+  int frames_read = framesDecoded - framesToSkip;
+  if (frames_read < 0) frames_read = 0;
+  if (frames_read > len) frames_read = len;
+  
+  if (framesToSkip + frames_read < framesDecoded) {
+    ioSeek(tw, -(long) lastBlockBytes, SEEK_CUR); // the last block is only partially consumed
+  }
+  
+  tw->totalFramesReadWritten += (uint32_t) frames_read;
+  int ret = frames_read;
+  if (isInt16) {
+    memcpy(data, interleaved_data + framesToSkip*numChannels, (size_t) frames_read * numChannels * sizeof(int16_t));
+  } else {
+    ret = int16ToFloat(tw, interleaved_data + framesToSkip*numChannels, frames_read, data);
+  }
+  TW_DEALLOC(interleaved_data);
+  TW_DEALLOC(encoded_data);
+  return ret;
+}
+
+/** Chunks are padded to an even number of bytes */
+static long paddedChunkSize(uint32_t size) {
+  return (long) size + (long) (size & 1);
+}
+
+/** Adds a chunk to the chunk table. The offset is the one of its payload. */
+static void recordChunk(TinyWav *tw, const char id[4], long offset, uint32_t size) {
+  if (tw->numChunks >= TINYWAV_MAX_CHUNKS) {
+    return;
+  }
+  TinyWavChunk *chunk = &tw->chunks[tw->numChunks++];
+  memcpy(chunk->id, id, 4);
+  chunk->offset = (uint32_t) offset;
+  chunk->size = size;
+}
+
+// MARK: header parsing
+
+/**
+ * The bytes of a file as seen by the header parser. The first bytes of the file are read into a buffer in one go, as
+ * the whole header usually fits into it. Anything beyond is read from the file directly.
+ */
+typedef struct HeaderSource {
+  TinyWav *tw; ///< the handle whose file is read, if not NULL
+  int fd;      ///< the file descriptor to read from otherwise
+  uint8_t buffer[TINYWAV_PROBE_SIZE];
+  size_t bufferLen; ///< number of valid bytes in buffer
+} HeaderSource;
+
+/** What the header parser finds besides the header fields */
+typedef struct HeaderExtras {
+  long dataOffset; ///< file offset of the sample data
+  bool hasFact;
+  uint32_t factSampleLength; ///< number of frames according to the 'fact' chunk of compressed formats
+  bool isDataSizeRecovered;  ///< the size of the data chunk was derived from the file size, see recoverDataSize()
+} HeaderExtras;
+
+/** Fills the buffer of the source with the first bytes of the file */
+static void fillHeaderSource(HeaderSource *src) {
+  src->bufferLen = 0;
+  if (src->tw != NULL) {
+    src->bufferLen = ioRead(src->tw, src->buffer, 1, sizeof(src->buffer));
+    return;
+  }
+#if _WIN32
+  const int n = _read(src->fd, src->buffer, (unsigned int) sizeof(src->buffer));
+#else
+  const ssize_t n = pread(src->fd, src->buffer, sizeof(src->buffer), 0);
+#endif
+  src->bufferLen = (n > 0) ? (size_t) n : 0;
+}
+
+/** Reads len bytes at offset, from the buffer if possible. @returns the number of bytes read */
+static size_t readHeaderSource(HeaderSource *src, long offset, void *data, size_t len) {
+  if (offset < 0) {
+    return 0;
+  }
+  if ((size_t) offset + len <= src->bufferLen) {
+    memcpy(data, src->buffer + offset, len);
+    return len;
+  }
+  if (src->tw != NULL) {
+    return (ioSeek(src->tw, offset, SEEK_SET) == 0) ? ioRead(src->tw, data, 1, len) : 0;
+  }
+#if _WIN32
+  if (_lseeki64(src->fd, offset, SEEK_SET) < 0) {
+    return 0;
+  }
+  const int n = _read(src->fd, data, (unsigned int) len);
+#else
+  const ssize_t n = pread(src->fd, data, len, (off_t) offset);
+#endif
+  return (n > 0) ? (size_t) n : 0;
+}
+
+/**
+ * @returns true if the MS ADPCM fmt chunk of len bytes holds the standard coefficient table (wNumCoef at offset 20).
+ * Files with other or additional coefficients are not supported, the decoder only knows the standard ones.
+ */
+static bool hasStandardMsCoefficients(const uint8_t *fmt, size_t len) {
+  if (readUInt16LE(fmt + 20) != 7 || len < 22 + sizeof(kMsCoefficients)) {
+    return false;
+  }
+  for (int i = 0; i < 7; ++i) {
+    if ((int16_t) readUInt16LE(fmt + 22 + 4*i) != kMsCoefficients[i][0] ||
+        (int16_t) readUInt16LE(fmt + 24 + 4*i) != kMsCoefficients[i][1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/** Parses the payload of the 'fmt ' chunk at offset into the header. @returns zero if no error */
+static int parseFmtChunk(HeaderSource *src, long offset, TinyWavHeader *h) {
+  uint8_t fmt[50]; // the largest fmt chunk we care about is the one of MS ADPCM with its coefficient table
+  const size_t len = (h->Subchunk1Size < sizeof(fmt)) ? h->Subchunk1Size : sizeof(fmt);
+  if (h->Subchunk1Size < 16 || readHeaderSource(src, offset, fmt, len) != len) {
+    return -1;
+  }
+  h->AudioFormat = readUInt16LE(fmt);
+  h->NumChannels = readUInt16LE(fmt + 2);
+  h->SampleRate = readUInt32LE(fmt + 4);
+  h->ByteRate = readUInt32LE(fmt + 8);
+  h->BlockAlign = readUInt16LE(fmt + 12);
+  h->BitsPerSample = readUInt16LE(fmt + 14);
+
+  // fmt extension (cbSize is only present if the fmt chunk is larger than 16 bytes)
+  h->cbSize = (len >= 18) ? readUInt16LE(fmt + 16) : 0;
+  h->ValidBitsPerSample = 0;
+  h->ChannelMask = 0;
+  memset(h->SubFormat, 0, sizeof(h->SubFormat));
+  h->SamplesPerBlock = 0;
+  if (isAdpcm(h->AudioFormat) && h->cbSize >= 2 && len >= 20) {
+    h->SamplesPerBlock = readUInt16LE(fmt + 18);
+  }
+  if (h->AudioFormat == TW_FORMAT_MS_ADPCM && h->cbSize >= 4 && len >= 22 && !hasStandardMsCoefficients(fmt, len)) {
+    return -1; // the blocks would be decoded with the wrong predictors
+  }
+  if (h->AudioFormat == TW_FORMAT_EXTENSIBLE) {
+    if (h->cbSize < 22 || len < 40) {
+      return -1;
+    }
+    h->ValidBitsPerSample = readUInt16LE(fmt + 18);
+    h->ChannelMask = readUInt32LE(fmt + 20);
+    memcpy(h->SubFormat, fmt + 24, 16);
+  }
+  return 0;
+}
+
+/**
+ * Parses the WAV header into tw->h and records every chunk in the chunk table.
+ * @returns zero if the file has a RIFF/WAVE header with 'fmt ' and 'data' chunks
+ */
+static int parseHeader(HeaderSource *src, TinyWav *tw, HeaderExtras *extras) {
+  /** @note: We do this byte-by-byte to avoid dependencies (htonl() et al.) and because struct padding depends on
+   *  specific compiler implementation ('slurping' directly into the header struct is therefore dangerous).
+   *  The RIFF format specifies little-endian order for the data stream. */
+  TinyWavHeader *h = &tw->h;
+  uint8_t bytes[12];
+
+  // RIFF Chunk, WAVE Subchunk
+  if (readHeaderSource(src, 0, bytes, 12) != 12) {
+    return -1;
+  }
+  memcpy(h->ChunkID, bytes, 4);
+  h->ChunkSize = readUInt32LE(bytes + 4);
+  memcpy(h->Format, bytes + 8, 4);
+  if (!chunkIDMatches(h->ChunkID, "RIFF") || !chunkIDMatches(h->Format, "WAVE")) {
+    return -1;
+  }
+
+  // Go through all subchunks. There are sometimes JUNK or other chunks before 'fmt ' and 'data', and metadata is
+  // often stored after the 'data' chunk as well (e.g. LIST). Every chunk is recorded in the chunk table, so that
+  // metadata can be fetched later on.
+  tw->numChunks = 0;
+  extras->hasFact = false;
+  extras->factSampleLength = 0;
+  extras->isDataSizeRecovered = false;
+  bool hasFmt = false;
+  bool hasData = false;
+  long chunkOffset = 12; // file offset of the next chunk header
+  while (readHeaderSource(src, chunkOffset, bytes, 8) == 8) {
+    char chunkID[4];
+    memcpy(chunkID, bytes, 4);
+    const uint32_t chunkSize = readUInt32LE(bytes + 4);
+    const long payloadOffset = chunkOffset + 8;
+    recordChunk(tw, chunkID, payloadOffset, chunkSize);
+
+    if (!hasFmt && chunkIDMatches(chunkID, "fmt ")) {
+      memcpy(h->Subchunk1ID, chunkID, 4);
+      h->Subchunk1Size = chunkSize;
+      if (parseFmtChunk(src, payloadOffset, h) != 0) {
+        return -1;
+      }
+      hasFmt = true;
+    } else if (!hasData && chunkIDMatches(chunkID, "data")) {
+      memcpy(h->Subchunk2ID, chunkID, 4);
+      h->Subchunk2Size = chunkSize;
+      extras->dataOffset = payloadOffset;
+      hasData = true;
+      if (chunkSize == 0 || chunkSize == 0xFFFFFFFF) {
+        break; // unknown length (unfinished file), the data runs to the end of the file and is no chunk header
+      }
+    } else if (chunkIDMatches(chunkID, "fact") && chunkSize >= 4) {
+      extras->hasFact = (readHeaderSource(src, payloadOffset, bytes, 4) == 4);
+      extras->factSampleLength = readUInt32LE(bytes);
+    }
+
+    chunkOffset = payloadOffset + paddedChunkSize(chunkSize);
+    // chunks after 'data' are only looked for if the RIFF size says there are any (it is 0 in unfinished files)
+    if (hasData && hasFmt && chunkOffset + 8 > (long) h->ChunkSize + 8) {
+      break;
+    }
+  }
+  return (hasFmt && hasData) ? 0 : -1;
+}
+
+/**
+ * Derives the sample format and number of frames of a parsed header.
+ * @returns zero if no error. isSupported is false if the samples are not natively supported and read as float.
+ */
+static int resolveSampleFormat(TinyWav *tw, const HeaderExtras *extras, bool *isSupported) {
+  tw->numChannels = (int16_t) tw->h.NumChannels;
+  tw->audioFormat = resolveAudioFormat(&tw->h);
+  *isSupported = true;
+  if (tw->audioFormat == TW_FORMAT_EXTENSIBLE) {
+    return -1; // the SubFormat GUID is not one of the known formats, its samples cannot be interpreted
+  }
+  if (tw->h.AudioFormat == TW_FORMAT_EXTENSIBLE && tw->h.ValidBitsPerSample != 0 &&
+      (tw->h.ValidBitsPerSample > tw->h.BitsPerSample ||
+       (tw->audioFormat == TW_FORMAT_IEEE_FLOAT && tw->h.ValidBitsPerSample != tw->h.BitsPerSample))) {
+    return -1; // more valid bits than the container holds, or a float with some of its bits unused
+  }
+
+  int bytesPerSample = 0;
+  if (tw->h.BitsPerSample == 32 && tw->audioFormat == TW_FORMAT_IEEE_FLOAT) {
+    tw->sampFmt = TW_FLOAT32; // file has 32-bit IEEE float samples
+  } else if (tw->h.BitsPerSample == 16 && tw->audioFormat == TW_FORMAT_PCM) {
+    tw->sampFmt = TW_INT16; // file has 16-bit int samples
+  } else if (tw->h.BitsPerSample == 8 && (tw->audioFormat == TW_FORMAT_ALAW || tw->audioFormat == TW_FORMAT_MULAW)) {
+    tw->sampFmt = TW_INT16; // file has 8-bit G.711 samples, which expand to 16-bit int
+    bytesPerSample = 1;
+  } else if (tw->h.BitsPerSample == 4 && isAdpcm(tw->audioFormat)) {
+    tw->sampFmt = TW_INT16; // file has 4-bit ADPCM samples, which decode to 16-bit int
+    const int maxFramesPerBlock = adpcmFramesInBlock(tw->audioFormat, tw->numChannels, tw->h.BlockAlign);
+    if (tw->numChannels < 1 || maxFramesPerBlock < 2) {
+      return -1;
+    }
+    if (tw->h.SamplesPerBlock == 0 || tw->h.SamplesPerBlock > maxFramesPerBlock) {
+      tw->h.SamplesPerBlock = (uint16_t) maxFramesPerBlock;
+    }
+  } else {
+    tw->sampFmt = TW_FLOAT32;
+    *isSupported = false;
+  }
+
+  if (tw->numChannels < 1) {
+    return -1;
+  }
+  if (isAdpcm(tw->audioFormat)) {
+    const uint32_t numFullBlocks = tw->h.Subchunk2Size / tw->h.BlockAlign;
+    const int lastBlockBytes = (int) (tw->h.Subchunk2Size % tw->h.BlockAlign);
+    int lastBlockFrames = adpcmFramesInBlock(tw->audioFormat, tw->numChannels, lastBlockBytes);
+    if (lastBlockFrames > tw->h.SamplesPerBlock) lastBlockFrames = tw->h.SamplesPerBlock;
+    uint32_t numFrames = numFullBlocks * tw->h.SamplesPerBlock + (uint32_t) lastBlockFrames;
+    // the last block may be padded. A writer which left the data size unfinished did not finish its fact chunk either
+    if (extras->hasFact && !extras->isDataSizeRecovered && extras->factSampleLength < numFrames) {
+      numFrames = extras->factSampleLength;
+    }
+    tw->numFramesInHeader = (int32_t) numFrames;
+  } else {
+    if (bytesPerSample == 0) {
+      bytesPerSample = tw->sampFmt;
+    }
+    tw->numFramesInHeader = tw->h.Subchunk2Size / (tw->numChannels * bytesPerSample);
+  }
+  return 0;
+}
+
+// MARK: waveform overview
+
+/** Completes the bin following the completed ones. Until then, its rms holds the sum of squares. */
+static void completePeakBin(TinyWavPeaks *p) {
+  TinyWavPeak *bin = p->bins + p->numBins * p->numChannels;
+  for (int c = 0; c < p->numChannels; ++c) {
+    bin[c].rms = sqrtf(bin[c].rms / (float) p->framesInBin);
+  }
+  ++p->numBins;
+  p->framesInBin = 0;
+}
+
+/**
+ * Accumulates frames of float samples in the given channel format into the overview.
+ * @param stride  the distance between channels for TW_INLINE
+ */
+static void accumulatePeaks(TinyWavPeaks *p, TinyWavChannelFormat chanFmt, const void *data, int stride, int frames) {
+  for (int frame = 0; frame < frames;) {
+    if (p->numBins == p->maxBins) {
+      if (!p->isAdaptive || p->maxBins < 2) {
+        return;
+      }
+      // all bins are complete and hold the same number of frames, so merging them is exact
+      p->numBins = tinywav_reduce_peaks(p->bins, p->numBins, p->numChannels, 2, p->bins);
+      p->framesPerBin *= 2;
+    }
+    int n = p->framesPerBin - p->framesInBin;
+    if (n > frames - frame) n = frames - frame;
+    TinyWavPeak *bin = p->bins + p->numBins * p->numChannels;
+    for (int c = 0; c < p->numChannels; ++c) {
+      const float *x;
+      int step;
+      switch (chanFmt) {
+        case TW_INTERLEAVED: x = (const float *) data + frame * p->numChannels + c; step = p->numChannels; break;
+        case TW_INLINE: x = (const float *) data + c * stride + frame; step = 1; break;
+        case TW_SPLIT: x = ((const float *const *) data)[c] + frame; step = 1; break;
+        default: return;
+      }
+      float lo = x[0], hi = x[0], sumSquares = 0.0f;
+      if (p->framesInBin > 0) {
+        lo = bin[c].min;
+        hi = bin[c].max;
+        sumSquares = bin[c].rms;
+      }
+      for (int i = 0; i < n; ++i) {
+        const float v = x[i*step];
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+        sumSquares += v * v;
+      }
+      bin[c].min = lo;
+      bin[c].max = hi;
+      bin[c].rms = sumSquares;
+    }
+    frame += n;
+    p->framesInBin += n;
+    if (p->framesInBin == p->framesPerBin) {
+      completePeakBin(p);
+    }
+  }
+}
+
+/**
+ * Peak magnitude as stored in a 'levl' chunk with 16-bit values, full scale being INT16_MAX. Larger peaks and NaN are
+ * clamped to full scale.
+ */
+static uint16_t levlValue(float x) {
+  if (x <= 0.0f) return 0;
+  if (!(x < 1.0f)) return INT16_MAX;
+  return (uint16_t) (x * (float) INT16_MAX + 0.5f);
+}
+
+/**
+ * Writes a 'levl' chunk with the completed bins of the overview at the current position of the file.
+ * @returns the size of the chunk including its header, 0 on error
+ */
+static uint32_t writeLevlChunk(TinyWav *tw, const TinyWavPeaks *p) {
+  const uint32_t kHeaderSize = 128; // up to and including the reserved bytes, i.e. dwOffsetToPeaks
+  const uint32_t peakDataSize = (uint32_t) p->numBins * (uint32_t) p->numChannels * 2 * sizeof(uint16_t);
+  uint8_t header[128];
+  memset(header, 0, sizeof(header));
+  memcpy(header, "levl", 4);
+  writeUInt32LE(header + 4, kHeaderSize - 8 + peakDataSize);
+  writeUInt32LE(header + 8, 0);                           // dwVersion
+  writeUInt32LE(header + 12, 2);                          // dwFormat: unsigned short
+  writeUInt32LE(header + 16, 2);                          // dwPointsPerValue: positive and negative peak
+  writeUInt32LE(header + 20, (uint32_t) p->framesPerBin); // dwBlockSize
+  writeUInt32LE(header + 24, (uint32_t) p->numChannels);  // dwPeakChannels
+  writeUInt32LE(header + 28, (uint32_t) p->numBins);      // dwNumPeakFrames
+  writeUInt32LE(header + 32, 0xFFFFFFFF);                 // dwPosPeakOfPeaks: unknown
+  writeUInt32LE(header + 36, kHeaderSize);                // dwOffsetToPeaks
+  const time_t now = time(NULL);
+  struct tm t;
+#if _WIN32
+  const bool hasTime = (localtime_s(&t, &now) == 0);
+#else
+  const bool hasTime = (localtime_r(&now, &t) != NULL);
+#endif
+  if (hasTime) { // strTimestamp, "YYYY:MM:DD:hh-mm-ss:uuu"
+    char timestamp[80]; // large enough for any int in each field, so the compiler can tell nothing is truncated
+    snprintf(timestamp, sizeof(timestamp), "%04d:%02d:%02d:%02d-%02d-%02d:000",
+        t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+    memcpy(header + 40, timestamp, 23);
+  }
+  if (ioWrite(tw, header, sizeof(header), 1) != 1) {
+    return 0;
+  }
+
+  // peak data, for each block and channel the positive and the absolute of the negative peak
+  uint8_t values[256 * 2 * sizeof(uint16_t)];
+  const int numPeaks = p->numBins * p->numChannels;
+  for (int first = 0; first < numPeaks; first += 256) {
+    const int n = (numPeaks - first < 256) ? (numPeaks - first) : 256;
+    for (int i = 0; i < n; ++i) {
+      writeUInt16LE(values + 4*i, levlValue(p->bins[first + i].max));
+      writeUInt16LE(values + 4*i + 2, levlValue(-p->bins[first + i].min));
+    }
+    if (ioWrite(tw, values, 4, (size_t) n) != (size_t) n) {
+      return 0;
+    }
+  }
+  return kHeaderSize + peakDataSize;
+}
+
+// MARK: conversion for writing
+
+/**
+ * Clamps a float sample to full scale and scales it to the range of 16-bit int. NaN becomes full scale. The clamp is a
+ * single select on the magnitude, which compiles to a mask and a blend, so the conversion loops stay branch-free and
+ * vectorize.
+ */
+static inline float floatToInt16Scale(float x) {
+  const float y = x * (float) INT16_MAX;
+  return (fabsf(y) <= (float) INT16_MAX) ? y : copysignf((float) INT16_MAX, y);
+}
+
+/** Converts a float sample to 16-bit int, clamping it to full scale */
+static inline int16_t floatToInt16(float x) {
+  return (int16_t) floatToInt16Scale(x);
+}
+
+/**
+ * Converts frames of float samples in the writer's channel format to the interleaved samples of the file, channel by
+ * channel, accumulating the statistics of each channel in the same loop. 16-bit int samples are clamped to full scale.
+ * @param z  numChannels*frames samples in the format of tw->sampFmt
+ * @return  false if the channel format is not supported
+ */
+static bool convertWithStats(TinyWav *tw, const void *data, int frames, void *z) {
+  const int nc = tw->numChannels;
+  for (int c = 0; c < nc; ++c) {
+    const float *x;
+    int step;
+    switch (tw->chanFmt) {
+      case TW_INTERLEAVED: x = (const float *) data + c; step = nc; break;
+      case TW_INLINE: x = (const float *) data + c * frames; step = 1; break;
+      case TW_SPLIT: x = ((const float *const *) data)[c]; step = 1; break;
+      default: return false;
+    }
+    StatsAccumulator a = beginStats(&tw->stats[c]);
+    if (tw->sampFmt == TW_INT16) {
+      int16_t *y = (int16_t *) z + c;
+      for (int i = 0; i < frames; ++i) {
+        const float v = x[i*step];
+        addToStats(&a, v);
+        y[i*nc] = floatToInt16(v);
+      }
+    } else {
+      float *y = (float *) z + c;
+      for (int i = 0; i < frames; ++i) {
+        const float v = x[i*step];
+        addToStats(&a, v);
+        y[i*nc] = v;
+      }
+    }
+    endStats(&tw->stats[c], &a, frames);
+  }
+  return true;
+}
+
+// MARK: dithering
+
+/** Hashes a counter to 32 random bits, so that the noise of each sample can be generated independently of the others */
+static inline uint32_t ditherNoise(uint32_t counter) {
+  uint32_t h = counter * 0x9E3779B9u;
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * Converts frames of float samples in the writer's channel format to interleaved 16-bit int with TPDF dither: the sum
+ * of two uniform values of +-0.5 LSB is added before rounding. With noise shaping, the quantization error of the
+ * previous sample of the channel is subtracted, which gives the noise a first-order highpass spectrum. The statistics
+ * of each channel are accumulated in the same loop, if collected.
+ * @return  false if the channel format is not supported
+ */
+static bool ditherToInt16(TinyWav *tw, const void *data, int frames, int16_t *z) {
+  const int nc = tw->numChannels;
+  for (int c = 0; c < nc; ++c) {
+    const float *x;
+    int step;
+    switch (tw->chanFmt) {
+      case TW_INTERLEAVED: x = (const float *) data + c; step = nc; break;
+      case TW_INLINE: x = (const float *) data + c * frames; step = 1; break;
+      case TW_SPLIT: x = ((const float *const *) data)[c]; step = 1; break;
+      default: return false;
+    }
+    const uint32_t counter = tw->ditherRandom + (uint32_t) c * (uint32_t) frames;
+    StatsAccumulator stats;
+    StatsAccumulator *const a = (tw->stats != NULL) ? &stats : NULL;
+    if (a != NULL) {
+      stats = beginStats(&tw->stats[c]);
+    }
+    if (tw->dither == TW_DITHER_TPDF_SHAPED) {
+      float e = tw->ditherError[c];
+      for (int i = 0; i < frames; ++i) {
+        const uint32_t r = ditherNoise(counter + (uint32_t) i);
+        const float d = (float) ((r & 0xFFFFu) + (r >> 16)) * (1.0f / 65536.0f) - 1.0f;
+        if (a != NULL) addToStats(a, x[i*step]);
+        const float v = floatToInt16Scale(x[i*step]) - e;
+        float y = floorf(v + d + 0.5f);
+        y = (y > (float) INT16_MAX) ? (float) INT16_MAX : ((y < (float) -INT16_MAX) ? (float) -INT16_MAX : y);
+        // bound the feedback, so that clipping does not make the shaping unstable
+        e = y - v;
+        e = (e > 2.0f) ? 2.0f : ((e < -2.0f) ? -2.0f : e);
+        z[i*nc + c] = (int16_t) y;
+      }
+      tw->ditherError[c] = e;
+    } else {
+      for (int i = 0; i < frames; ++i) {
+        const uint32_t r = ditherNoise(counter + (uint32_t) i);
+        const float d = (float) ((r & 0xFFFFu) + (r >> 16)) * (1.0f / 65536.0f) - 1.0f;
+        if (a != NULL) addToStats(a, x[i*step]);
+        float y = floorf(floatToInt16Scale(x[i*step]) + d + 0.5f);
+        y = (y > (float) INT16_MAX) ? (float) INT16_MAX : ((y < (float) -INT16_MAX) ? (float) -INT16_MAX : y);
+        z[i*nc + c] = (int16_t) y;
+      }
+    }
+    if (a != NULL) {
+      endStats(&tw->stats[c], a, frames);
+    }
+  }
+  tw->ditherRandom += (uint32_t) nc * (uint32_t) frames;
+  return true;
+}
+
+// MARK: resampling
+
+#define TINYWAV_RESAMPLER_ZERO_CROSSINGS 16 // of the filter on either side, at the lower of both rates
+#define TINYWAV_RESAMPLER_BLOCK_SIZE 256    // number of input frames read at once
+
+static const double kPi = 3.14159265358979323846;
+
+static int greatestCommonDivisor(int a, int b) {
+  while (b != 0) {
+    const int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/** Gets the rate ratio and filter length of a conversion. @returns false if it is not supported */
+static bool resamplerGeometry(int32_t inRate, int32_t outRate, int *upFactor, int *downFactor, int *numTaps) {
+  if (inRate < 1 || outRate < 1) {
+    return false;
+  }
+  const int d = greatestCommonDivisor(inRate, outRate);
+  *upFactor = outRate / d;
+  *downFactor = inRate / d;
+  if (*upFactor > TINYWAV_RESAMPLER_MAX_PHASES) {
+    return false;
+  }
+  // when downsampling, the filter must be longer to keep the same transition band relative to the output rate
+  const int taps = (2 * TINYWAV_RESAMPLER_ZERO_CROSSINGS * *downFactor + *upFactor - 1) / *upFactor;
+  *numTaps = (taps < 2 * TINYWAV_RESAMPLER_ZERO_CROSSINGS) ? 2 * TINYWAV_RESAMPLER_ZERO_CROSSINGS : (taps + 1) & ~1;
+  return true;
+}
+
+/**
+ * Designs the polyphase filter: a Blackman-windowed sinc low-pass at 90% of the lower Nyquist frequency, running at
+ * upFactor times the input rate. Phase p holds the coefficients applied to the input frames at, before, ... the
+ * output frame, each phase normalized to unity gain.
+ */
+static void designResamplerFilter(float *filter, int upFactor, int downFactor, int numTaps) {
+  const int length = upFactor * numTaps;
+  const double center = 0.5 * length;
+  const double cutoff = 0.45 / ((upFactor > downFactor) ? upFactor : downFactor); // cycles per upsampled frame
+  for (int p = 0; p < upFactor; ++p) {
+    double sum = 0.0;
+    for (int k = 0; k < numTaps; ++k) {
+      const double t = (double) (p + k*upFactor) - center;
+      const double x = 2.0 * cutoff * t;
+      const double sinc = (x == 0.0) ? 1.0 : sin(kPi * x) / (kPi * x);
+      const double window = 0.42 + 0.5 * cos(2.0 * kPi * t / length) + 0.08 * cos(4.0 * kPi * t / length);
+      filter[p*numTaps + k] = (float) (sinc * window);
+      sum += sinc * window;
+    }
+    for (int k = 0; k < numTaps; ++k) {
+      filter[p*numTaps + k] = (float) (filter[p*numTaps + k] / sum);
+    }
+  }
+}
+
+static int readFrames(TinyWav *tw, void *data, int len);
+
+/**
+ * Makes sure that the buffer of the resampler holds the input frame at index last, reading from the file as needed.
+ * Frames beyond the end of the file are zero. Frames which are not needed anymore are dropped.
+ */
+static void fillResampler(TinyWav *tw, TinyWavResampler *rs, int64_t last) {
+  const int numTaps = rs->numTaps;
+  while (last >= rs->bufferStart + rs->fill) {
+    // drop the frames before the oldest one needed for the next output frame
+    const int drop = (int) (rs->inputPos + numTaps/2 - (numTaps - 1) - rs->bufferStart);
+    if (drop > 0) {
+      for (int c = 0; c < rs->numChannels; ++c) {
+        float *channel = rs->buffer + c * rs->capacity;
+        memmove(channel, channel + drop, (size_t) (rs->fill - drop) * sizeof(float));
+      }
+      rs->bufferStart += drop;
+      rs->fill -= drop;
+    }
+    
+    const int space = rs->capacity - rs->fill;
+    int numRead = 0;
+    if (!rs->isAtEnd) {
+      // read straight into the buffer, one channel after the other
+      TW_ALLOC(float *, channels, rs->numChannels);
+      for (int c = 0; c < rs->numChannels; ++c) {
+        channels[c] = rs->buffer + c * rs->capacity + rs->fill;
+      }
+      // the statistics are of the resampled frames, see readResampled()
+      const TinyWavChannelFormat chanFmt = tw->chanFmt;
+      TinyWavStats *const stats = tw->stats;
+      tw->chanFmt = TW_SPLIT;
+      tw->stats = NULL;
+      numRead = readFrames(tw, channels, space);
+      tw->chanFmt = chanFmt;
+      tw->stats = stats;
+      TW_DEALLOC(channels);
+      if (numRead <= 0) {
+        numRead = 0;
+        rs->isAtEnd = true;
+        rs->numInput = rs->bufferStart + rs->fill;
+      }
+    }
+    if (rs->isAtEnd) {
+      numRead = (int) (last + 1 - (rs->bufferStart + rs->fill));
+      for (int c = 0; c < rs->numChannels; ++c) {
+        memset(rs->buffer + c * rs->capacity + rs->fill, 0, (size_t) numRead * sizeof(float));
+      }
+    }
+    rs->fill += numRead;
+  }
+}
+
+/** Reads frames at the output rate of the resampler, in the channel format of tw */
+static int readResampled(TinyWav *tw, void *data, int len) {
+  TinyWavResampler *rs = tw->resampler;
+  const int numChannels = rs->numChannels;
+  const int numTaps = rs->numTaps;
+  TW_ALLOC(StatsAccumulator, stats, numChannels);
+  for (int c = 0; c < numChannels && tw->stats != NULL; ++c) {
+    stats[c] = beginStats(&tw->stats[c]);
+  }
+  int n = 0;
+  for (; n < len; ++n) {
+    // the output frame is centered between the input frames at inputPos and inputPos + 1
+    const int64_t last = rs->inputPos + numTaps/2;
+    fillResampler(tw, rs, last);
+    if (rs->isAtEnd && rs->numOutput * rs->downFactor >= rs->numInput * rs->upFactor) {
+      break;
+    }
+    
+    const float *h = rs->filter + rs->phase * numTaps;
+    const int newest = (int) (last - rs->bufferStart);
+    for (int c = 0; c < numChannels; ++c) {
+      const float *x = rs->buffer + c * rs->capacity + newest;
+      float sum = 0.0f;
+      for (int k = 0; k < numTaps; ++k) {
+        sum += h[k] * x[-k];
+      }
+      if (tw->stats != NULL) {
+        addToStats(&stats[c], sum);
+      }
+      switch (tw->chanFmt) {
+        case TW_INTERLEAVED: ((float *) data)[n * numChannels + c] = sum; break;
+        case TW_INLINE: ((float *) data)[c * len + n] = sum; break;
+        case TW_SPLIT: ((float **) data)[c][n] = sum; break;
+        default: TW_DEALLOC(stats); return 0;
+      }
+    }
+    
+    rs->phase += rs->downFactor;
+    rs->inputPos += rs->phase / rs->upFactor;
+    rs->phase %= rs->upFactor;
+    ++rs->numOutput;
+  }
+  for (int c = 0; c < numChannels && tw->stats != NULL; ++c) {
+    endStats(&tw->stats[c], &stats[c], n);
+  }
+  TW_DEALLOC(stats);
+  
+  if (n < len && tw->chanFmt == TW_INLINE) {
+    // the channels were laid out for len frames, move them together
+    for (int c = 1; c < numChannels; ++c) {
+      memmove((float *) data + c * n, (float *) data + c * len, (size_t) n * sizeof(float));
+    }
+  }
+  return n;
+}
+
+// MARK: batch probing
+
+/** A share of the files of tinywav_probe_batch(): every stride-th file, starting at first */
+typedef struct ProbeWorker {
+  const char *const *paths;
+  TinyWavInfo *infos;
+  int *errors;
+  int numFiles;
+  int first;
+  int stride;
+  int numSucceeded;
+} ProbeWorker;
+
+static void runProbeWorker(ProbeWorker *w) {
+  for (int i = w->first; i < w->numFiles; i += w->stride) {
+    const int err = tinywav_probe(w->paths[i], &w->infos[i]);
+    if (err == 0) {
+      ++w->numSucceeded;
+    } else {
+      memset(&w->infos[i], 0, sizeof(TinyWavInfo));
+    }
+    if (w->errors != NULL) {
+      w->errors[i] = err;
+    }
+  }
+}
+
+#if TINYWAV_USE_THREADS
+#if _WIN32
+static DWORD WINAPI probeThread(LPVOID arg) {
+  runProbeWorker((ProbeWorker *) arg);
+  return 0;
+}
+#else
+static void *probeThread(void *arg) {
+  runProbeWorker((ProbeWorker *) arg);
+  return NULL;
+}
+#endif
+#endif // TINYWAV_USE_THREADS
+
+// MARK: public functions
+
+/**
+ * Opens the file of the handle. With the directIO option, the file descriptor is opened with O_DIRECT and all I/O
+ * goes through the aligned buffer of the options; the FILE only owns the descriptor.
+ * @return  The error code. Zero if no error.
+ */
+static int openFile(TinyWav *tw, const char *path, bool isWrite, const TinyWavOpenOptions *options) {
+  tw->f = NULL;
+  tw->direct.buffer = NULL;
+  tw->hasWriteError = false;
+  tw->preallocatedSize = 0;
+  const bool isUpdate = !isWrite && options != NULL && options->recover && options->repairHeader;
+  const char *mode = isWrite ? "wb" : (isUpdate ? "r+b" : "rb");
+  if (options != NULL && options->directIO) {
+#if TINYWAV_HAS_DIRECT_IO
+    if (options->buffer == NULL || options->bufferSize == 0 || (options->bufferSize % TINYWAV_DIRECT_ALIGNMENT) != 0 ||
+        ((uintptr_t) options->buffer % TINYWAV_DIRECT_ALIGNMENT) != 0) {
+      return -1;
+    }
+    const int fd = isWrite ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666)
+                           : open(path, (isUpdate ? O_RDWR : O_RDONLY) | O_DIRECT);
+    tw->f = (fd >= 0) ? fdopen(fd, mode) : NULL;
+    if (tw->f == NULL) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      return -1;
+    }
+    tw->direct.fd = fd;
+    tw->direct.buffer = (uint8_t *) options->buffer;
+    tw->direct.size = options->bufferSize;
+    tw->direct.start = 0;
+    tw->direct.len = 0;
+    tw->direct.position = 0;
+    tw->direct.isDirty = false;
+    return 0;
+#else
+    return -1; // not supported on this platform
+#endif
+  }
+#if _WIN32
+  errno_t err = fopen_s(&tw->f, path, mode);
+  if (err != 0) { tw->f = NULL; }
+#else
+  tw->f = fopen(path, mode);
+#endif
+  return (tw->f != NULL) ? 0 : -1;
+}
+
+/**
+ * Applies the options which are common to readers and writers, right after opening the file (setvbuf must come
+ * before any other operation on it).
+ * @return  The error code. Zero if no error.
+ */
+static int applyOpenOptions(TinyWav *tw, const TinyWavOpenOptions *options) {
+  tw->ioStats = (options != NULL) ? options->ioStats : NULL;
+  tw->trace = (options != NULL) ? options->trace : NULL;
+  if (tw->ioStats != NULL) {
+    memset(tw->ioStats, 0, sizeof(TinyWavIOStats));
+  }
+  tw->headerUpdateFrames = (options != NULL && options->headerUpdateFrames > 0) ? options->headerUpdateFrames : 0;
+  tw->syncInterval = (options != NULL && options->syncInterval > 0) ? options->syncInterval : 0;
+  tw->nextHeaderUpdate = (uint32_t) tw->headerUpdateFrames;
+  tw->numHeaderUpdates = 0;
+  tw->numHeaderUpdateErrors = 0;
+  if (options != NULL && options->bufferSize > 0 && tw->direct.buffer == NULL) {
+    if (setvbuf(tw->f, (char *) options->buffer, _IOFBF, options->bufferSize) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate, TinyWavSampleFormat sampFmt,
+                       TinyWavChannelFormat chanFmt, const char *path) {
+  return tinywav_open_write_ex(tw, numChannels, samplerate, sampFmt, chanFmt, path, NULL);
+}
+
+int tinywav_open_write_ex(TinyWav *tw, int16_t numChannels, int32_t samplerate, TinyWavSampleFormat sampFmt,
+                          TinyWavChannelFormat chanFmt, const char *path, const TinyWavOpenOptions *options) {
+  
+  if (tw == NULL || path == NULL || numChannels < 1 || samplerate < 1) {
+    return -1;
+  }
+  
+  if (openFile(tw, path, true, options) != 0) {
+    perror("[tinywav] Failed to open file for writing");
+    return -1;
+  }
+  if (applyOpenOptions(tw, options) != 0) {
+    closeFile(tw);
+    return -1;
+  }
+
+  tw->numChannels = numChannels;
+  tw->numFramesInHeader = -1; // not used for writer
+  tw->numChunks = 0; // not used for writer
+  tw->peaks = NULL;
+  tw->writeLevl = false;
+  tw->hash = NULL;
+  tw->stats = NULL;
+  tw->selectedChannels = NULL;
+  tw->numSelectedChannels = 0;
+  tw->mixMatrix = NULL;
+  tw->mixGains = NULL;
+  tw->numMixOutputs = 0;
+  tw->resampler = NULL;
+  tw->dither = TW_DITHER_NONE;
+  tw->ditherRandom = 0;
+  memset(tw->ditherError, 0, sizeof(tw->ditherError));
+  tw->totalFramesReadWritten = 0;
+  tw->sampFmt = sampFmt;
+  tw->chanFmt = chanFmt;
+
+  // prepare WAV header
+  /**@note: We do this byte-by-byte to avoid dependencies (htonl() et al.) and because struct padding depends on
+   * specific compiler implementation ('slurping' directly into the header struct is therefore dangerous). */
+  tw->h.ChunkID[0] = 'R';
+  tw->h.ChunkID[1] = 'I';
+  tw->h.ChunkID[2] = 'F';
+  tw->h.ChunkID[3] = 'F';
+  tw->h.ChunkSize = 0; // fill this in on file-close
+  tw->h.Format[0] = 'W';
+  tw->h.Format[1] = 'A';
+  tw->h.Format[2] = 'V';
+  tw->h.Format[3] = 'E';
+  tw->h.Subchunk1ID[0] = 'f';
+  tw->h.Subchunk1ID[1] = 'm';
+  tw->h.Subchunk1ID[2] = 't';
+  tw->h.Subchunk1ID[3] = ' ';
+  tw->audioFormat = (uint16_t) (tw->sampFmt - 1); // 1 PCM, 3 IEEE float
+  tw->h.NumChannels = (uint16_t) numChannels;
+  tw->h.SampleRate = samplerate;
+  tw->h.ByteRate = samplerate * numChannels * tw->sampFmt;
+  tw->h.BlockAlign = (uint16_t) (numChannels * tw->sampFmt);
+  tw->h.BitsPerSample = (uint16_t) (8 * tw->sampFmt);
+  if (numChannels > 2) {
+    // WAVE_FORMAT_EXTENSIBLE is required for more than two channels
+    tw->h.Subchunk1Size = 40;
+    tw->h.AudioFormat = TW_FORMAT_EXTENSIBLE;
+    tw->h.cbSize = 22;
+    tw->h.ValidBitsPerSample = tw->h.BitsPerSample;
+    tw->h.ChannelMask = 0; // no speaker assignment, may be changed by the user before closing
+    tw->h.SubFormat[0] = (uint8_t) (tw->audioFormat & 0xFF);
+    tw->h.SubFormat[1] = (uint8_t) (tw->audioFormat >> 8);
+    memcpy(tw->h.SubFormat + 2, kSubFormatGuidTail, sizeof(kSubFormatGuidTail));
+  } else {
+    tw->h.Subchunk1Size = 16; // PCM
+    tw->h.AudioFormat = tw->audioFormat;
+    tw->h.cbSize = 0;
+    tw->h.ValidBitsPerSample = 0;
+    tw->h.ChannelMask = 0;
+    memset(tw->h.SubFormat, 0, sizeof(tw->h.SubFormat));
+  }
+  tw->h.Subchunk2ID[0] = 'd';
+  tw->h.Subchunk2ID[1] = 'a';
+  tw->h.Subchunk2ID[2] = 't';
+  tw->h.Subchunk2ID[3] = 'a';
+  tw->h.Subchunk2Size = 0; // fill this in on file-close
+
+  // write WAV header
+  size_t elementCount = ioWrite(tw, tw->h.ChunkID, sizeof(char), 4);
+  elementCount += ioWrite(tw, &tw->h.ChunkSize, sizeof(uint32_t), 1);
+  elementCount += ioWrite(tw, tw->h.Format, sizeof(char), 4);
+  elementCount += ioWrite(tw, tw->h.Subchunk1ID, sizeof(char), 4);
+  elementCount += ioWrite(tw, &tw->h.Subchunk1Size, sizeof(uint32_t), 1);
+  elementCount += ioWrite(tw, &tw->h.AudioFormat, sizeof(uint16_t), 1);
+  elementCount += ioWrite(tw, &tw->h.NumChannels, sizeof(uint16_t), 1);
+  elementCount += ioWrite(tw, &tw->h.SampleRate, sizeof(uint32_t), 1);
+  elementCount += ioWrite(tw, &tw->h.ByteRate, sizeof(uint32_t), 1);
+  elementCount += ioWrite(tw, &tw->h.BlockAlign, sizeof(uint16_t), 1);
+  elementCount += ioWrite(tw, &tw->h.BitsPerSample, sizeof(uint16_t), 1);
+  size_t expectedCount = 25;
+  if (tw->h.AudioFormat == TW_FORMAT_EXTENSIBLE) {
+    elementCount += ioWrite(tw, &tw->h.cbSize, sizeof(uint16_t), 1);
+    elementCount += ioWrite(tw, &tw->h.ValidBitsPerSample, sizeof(uint16_t), 1);
+    elementCount += ioWrite(tw, &tw->h.ChannelMask, sizeof(uint32_t), 1);
+    elementCount += ioWrite(tw, tw->h.SubFormat, sizeof(uint8_t), 16);
+    expectedCount += 19;
+  }
+  elementCount += ioWrite(tw, tw->h.Subchunk2ID, sizeof(char), 4);
+  elementCount += ioWrite(tw, &tw->h.Subchunk2Size, sizeof(uint32_t), 1);
+  if (elementCount != expectedCount) {
+    return -1;
+  }
+  
+  // reserve the space of the expected audio data, what is left over is given back on close
+  if (options != NULL && options->expectedFrames > 0) {
+    const int64_t size = 28 + (int64_t) tw->h.Subchunk1Size + (int64_t) options->expectedFrames * tw->h.BlockAlign;
+    if (preallocateFile(tw, size)) {
+      tw->preallocatedSize = size;
+    }
+  }
+  if (tw->headerUpdateFrames > 0) {
+    fflush(tw->f); // a valid (empty) file from the start
+  }
+
+  return 0;
+}
+
+/**
+ * Derives the size of the data chunk from the size of the file if the header does not know it: Subchunk2Size is 0 or
+ * 0xFFFFFFFF (unfinished recordings) or larger than the rest of the file (truncated ones). Optionally writes the
+ * derived sizes into the header.
+ * @return  The error code. Zero if no error.
+ */
+static int recoverDataSize(TinyWav *tw, long dataOffset, bool repairHeader) {
+  const int64_t size = fileSize(tw);
+  if (size < 0) {
+    return -1;
+  }
+  int64_t available = (size > dataOffset) ? size - dataOffset : 0;
+  const uint32_t declared = tw->h.Subchunk2Size;
+  if (declared != 0 && declared != 0xFFFFFFFF && (int64_t) declared <= available) {
+    return 0; // the header is fine
+  }
+  if (available > 0xFFFFFFFE - dataOffset) {
+    available = 0xFFFFFFFE - dataOffset; // as much as a RIFF file can hold
+  }
+  if (!isAdpcm(resolveAudioFormat(&tw->h)) && tw->h.BlockAlign > 0) {
+    available -= available % tw->h.BlockAlign; // whole frames only, ADPCM decodes partial blocks
+  }
+  tw->h.Subchunk2Size = (uint32_t) available;
+  tw->h.ChunkSize = (uint32_t) (dataOffset - 8 + available);
+  if (repairHeader) {
+    uint8_t bytes[4];
+    writeUInt32LE(bytes, tw->h.ChunkSize);
+    if (writeFileAt(tw, 4, bytes, 4) != 0) {
+      return -1;
+    }
+    writeUInt32LE(bytes, tw->h.Subchunk2Size);
+    if (writeFileAt(tw, dataOffset - 4, bytes, 4) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int tinywav_open_read(TinyWav *tw, const char *path, TinyWavChannelFormat chanFmt) {
+  return tinywav_open_read_ex(tw, path, chanFmt, NULL);
+}
+
+int tinywav_open_read_ex(TinyWav *tw, const char *path, TinyWavChannelFormat chanFmt,
+                         const TinyWavOpenOptions *options) {
+  
+  if (tw == NULL || path == NULL) {
+    return -1;
+  }
+  
+  if (openFile(tw, path, false, options) != 0) {
+    perror("[tinywav] Failed to open file for reading");
+    return -1;
+  }
+  if (applyOpenOptions(tw, options) != 0) {
+    closeFile(tw);
+    return -1;
+  }
+  
+  tw->peaks = NULL;
+  tw->writeLevl = false;
+  tw->hash = NULL;
+  tw->stats = NULL;
+  tw->selectedChannels = NULL;
+  tw->numSelectedChannels = 0;
+  tw->mixMatrix = NULL;
+  tw->mixGains = NULL;
+  tw->numMixOutputs = 0;
+  tw->resampler = NULL;
+  tw->dither = TW_DITHER_NONE;
+  tw->ditherRandom = 0;
+  memset(tw->ditherError, 0, sizeof(tw->ditherError));
+
+  // Parse WAV header
+  HeaderSource src;
+  src.tw = tw;
+  src.fd = -1;
+  fillHeaderSource(&src);
+  HeaderExtras extras;
+  bool isSupported = false;
+  if (parseHeader(&src, tw, &extras) != 0) {
+    tinywav_close_read(tw);
+    return -1;
+  }
+  const uint32_t declaredDataSize = tw->h.Subchunk2Size;
+  if (options != NULL && options->recover && recoverDataSize(tw, extras.dataOffset, options->repairHeader) != 0) {
+    tinywav_close_read(tw);
+    return -1;
+  }
+  extras.isDataSizeRecovered = (tw->h.Subchunk2Size != declaredDataSize);
+  if (resolveSampleFormat(tw, &extras, &isSupported) != 0) {
+    tinywav_close_read(tw);
+    return -1;
+  }
+  if (!isSupported) {
+    printf("[tinywav] Warning: wav file has %d bits per sample (int), which is not natively supported yet. Treating them as float; you may want to convert them manually after reading.\n", tw->h.BitsPerSample);
+  }
+
+  // go to the start of the audio data
+  if (ioSeek(tw, extras.dataOffset, SEEK_SET) != 0) {
+    tinywav_close_read(tw);
+    return -1;
+  }
+  if (options != NULL && options->sequentialAccess) {
+    adviseSequential(tw, extras.dataOffset, tw->h.Subchunk2Size);
+  }
+  tw->chanFmt = chanFmt;
+  tw->totalFramesReadWritten = 0;
+  
+  return 0;
+}
+
+/** Fills info from a parsed header, the data chunk starts at dataOffset. */
+static void describeFile(const TinyWav *tw, long dataOffset, bool isSupported, TinyWavInfo *info) {
+  info->audioFormat = tw->audioFormat;
+  info->numChannels = tw->h.NumChannels;
+  info->sampleRate = tw->h.SampleRate;
+  info->bitsPerSample = tw->h.BitsPerSample;
+  info->blockAlign = tw->h.BlockAlign;
+  info->numFrames = tw->numFramesInHeader;
+  info->dataOffset = (uint32_t) dataOffset;
+  info->dataSize = tw->h.Subchunk2Size;
+  info->sampFmt = tw->sampFmt;
+  info->isSupported = isSupported;
+}
+
+int tinywav_probe(const char *path, TinyWavInfo *info) {
+
+  if (path == NULL || info == NULL) {
+    return -1;
+  }
+
+  HeaderSource src;
+  src.tw = NULL;
+#if _WIN32
+  if (_sopen_s(&src.fd, path, _O_RDONLY | _O_BINARY, _SH_DENYNO, _S_IREAD) != 0) {
+    return -1;
+  }
+#else
+  src.fd = open(path, O_RDONLY);
+  if (src.fd < 0) {
+    return -1;
+  }
+#endif
+
+  fillHeaderSource(&src);
+  TinyWav tw; // only used to hold the parsed header, never opened
+  HeaderExtras extras;
+  bool isSupported = false;
+  const int err = (parseHeader(&src, &tw, &extras) != 0 || resolveSampleFormat(&tw, &extras, &isSupported) != 0);
+#if _WIN32
+  _close(src.fd);
+#else
+  close(src.fd);
+#endif
+  if (err) {
+    return -1;
+  }
+
+  describeFile(&tw, extras.dataOffset, isSupported, info);
+  return 0;
+}
+
+int tinywav_probe_batch(const char *const *paths, int numFiles, TinyWavInfo *infos, int *errors, int numThreads) {
+
+  if (paths == NULL || infos == NULL || numFiles < 0) {
+    return -1;
+  }
+#if !TINYWAV_USE_THREADS
+  numThreads = 1;
+#endif
+  if (numThreads <= 0) numThreads = 8;
+  if (numThreads > TINYWAV_MAX_PROBE_THREADS) numThreads = TINYWAV_MAX_PROBE_THREADS;
+  if (numThreads > numFiles) numThreads = numFiles;
+  if (numThreads == 0) {
+    return 0;
+  }
+
+  TW_ALLOC(ProbeWorker, workers, numThreads);
+  for (int t = 0; t < numThreads; ++t) {
+    ProbeWorker w = { paths, infos, errors, numFiles, t, numThreads, 0 };
+    workers[t] = w;
+  }
+
+#if !TINYWAV_USE_THREADS
+  runProbeWorker(&workers[0]);
+#else
+  // the calling thread takes the first share. If a thread cannot be started, its share is probed here as well.
+#if _WIN32
+  TW_ALLOC(HANDLE, threads, numThreads);
+  for (int t = 1; t < numThreads; ++t) {
+    threads[t] = CreateThread(NULL, 0, probeThread, &workers[t], 0, NULL);
+  }
+  runProbeWorker(&workers[0]);
+  for (int t = 1; t < numThreads; ++t) {
+    if (threads[t] != NULL) {
+      WaitForSingleObject(threads[t], INFINITE);
+      CloseHandle(threads[t]);
+    } else {
+      runProbeWorker(&workers[t]);
+    }
+  }
+#else
+  TW_ALLOC(pthread_t, threads, numThreads);
+  TW_ALLOC(bool, isRunning, numThreads);
+  for (int t = 1; t < numThreads; ++t) {
+    isRunning[t] = (pthread_create(&threads[t], NULL, probeThread, &workers[t]) == 0);
+  }
+  runProbeWorker(&workers[0]);
+  for (int t = 1; t < numThreads; ++t) {
+    if (isRunning[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      runProbeWorker(&workers[t]);
+    }
+  }
+  TW_DEALLOC(isRunning);
+#endif
+  TW_DEALLOC(threads);
+#endif // TINYWAV_USE_THREADS
+
+  int numSucceeded = 0;
+  for (int t = 0; t < numThreads; ++t) {
+    numSucceeded += workers[t].numSucceeded;
+  }
+  TW_DEALLOC(workers);
+  return numSucceeded;
+}
+
+/** Reads frames from the file and converts them to float in the channel format of tw */
+static int readFrames(TinyWav *tw, void *data, int len) {
+  
+  if (isAdpcm(tw->audioFormat)) {
+    return readAdpcm(tw, data, len, false); // BlockAlign is the size of an ADPCM block, not of a frame
+  }
+  
+  if (tw->totalFramesReadWritten * tw->h.BlockAlign >= tw->h.Subchunk2Size) {
+    // We are past the 'data' subchunk (size as declared in header).
+    // Sometimes there are additionl chunks *after* -- ignore these.
+    return 0; // there's nothing more to read, not an error.
+  }
+  const uint32_t framesRemaining = (tw->h.Subchunk2Size - tw->totalFramesReadWritten * tw->h.BlockAlign) / tw->h.BlockAlign;
+  if ((uint32_t) len > framesRemaining) {
+    len = (int) framesRemaining; // nor read into them
+  }
+
+  if (tw->audioFormat == TW_FORMAT_ALAW || tw->audioFormat == TW_FORMAT_MULAW) {
+    return readG711(tw, data, len, false);
+  }
+
+  int ret = 0;
+  
+  switch (tw->sampFmt) {
+    case TW_INT16: {
+      TW_ALLOC(int16_t, interleaved_data, tw->numChannels*len);
+      size_t samples_read = ioRead(tw, interleaved_data, sizeof(int16_t), tw->numChannels*len);
+      hashReadData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, interleaved_data, samples_read * sizeof(int16_t));
+      uint32_t frames_read_u32 = (uint32_t) (samples_read / tw->numChannels);
+      tw->totalFramesReadWritten += frames_read_u32;
+      ret = int16ToFloat(tw, interleaved_data, (int) frames_read_u32, data);
+      TW_DEALLOC(interleaved_data);
+      break;
+    }
+    case TW_FLOAT32: {
+      TW_ALLOC(float, interleaved_data, tw->numChannels*len);
+      size_t samples_read = ioRead(tw, interleaved_data, sizeof(float), tw->numChannels*len);
+      hashReadData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, interleaved_data, samples_read * sizeof(float));
+      uint32_t frames_read_u32 = (uint32_t) (samples_read / tw->numChannels);
+      tw->totalFramesReadWritten += frames_read_u32;
+      int frames_read = (int) frames_read_u32;
+      if (isGathered(tw)) {
+        ret = gatherChannels(tw, interleaved_data, NULL, frames_read, data);
+        TW_DEALLOC(interleaved_data);
+        break;
+      }
+      switch (tw->chanFmt) {
+        case TW_INTERLEAVED: { // channel buffer is interleaved e.g. [LRLRLRLR]
+          memcpy(data, interleaved_data, tw->numChannels*frames_read*sizeof(float));
+          ret = frames_read;
+          break;
+        }
+        case TW_INLINE: { // channel buffer is inlined e.g. [LLLLRRRR]
+          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
+            for (int j = i; j < frames_read * tw->numChannels; j += tw->numChannels, ++pos) {
+              ((float *) data)[pos] = interleaved_data[j];
+            }
+          }
+          ret = frames_read;
+          break;
+        }
+        case TW_SPLIT: { // channel buffer is split e.g. [[LLLL],[RRRR]]
+          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
+            for (int j = 0; j < frames_read; j++, ++pos) {
+              ((float **) data)[i][j] = interleaved_data[j*tw->numChannels + i];
+            }
+          }
+          ret = frames_read;
+          break;
+        }
+        default: break;
+      }
+      TW_DEALLOC(interleaved_data);
+      break;
+    }
+    default: break;
+  }
+
+  return ret;
+}
+
+int tinywav_read_f(TinyWav *tw, void *data, int len) {
+  
+  if (tw == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  
+  TW_USDT(read_f_begin, tw, len);
+  traceBegin(tw, TW_TRACE_READ_F, len);
+  const uint64_t start = beginTimedCall(tw, len);
+  const int ret = (tw->resampler != NULL) ? readResampled(tw, data, len) : readFrames(tw, data, len);
+  if (ret > 0 && tw->peaks != NULL) {
+    accumulatePeaks(tw->peaks, tw->chanFmt, data, ret, ret);
+  }
+  endTimedCall(tw, start);
+  traceEnd(tw, TW_TRACE_READ_F, ret);
+  TW_USDT(read_f_end, tw, ret);
+  return ret;
+}
+
+int tinywav_read_raw(TinyWav *tw, void *data, int len) {
+  
+  if (tw == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  if (tw->h.BlockAlign != tw->numChannels * tw->sampFmt) {
+    return -1; // compressed samples can only be read with tinywav_read_f()
+  }
+  
+  const uint32_t bytesConsumed = tw->totalFramesReadWritten * tw->h.BlockAlign;
+  if (bytesConsumed >= tw->h.Subchunk2Size) {
+    return 0; // there's nothing more to read, not an error.
+  }
+  const uint32_t framesRemaining = (tw->h.Subchunk2Size - bytesConsumed) / tw->h.BlockAlign;
+  if ((uint32_t) len > framesRemaining) {
+    len = (int) framesRemaining;
+  }
+  
+  size_t frames_read = ioRead(tw, data, tw->h.BlockAlign, (size_t) len);
+  hashReadData(tw, bytesConsumed, data, frames_read * tw->h.BlockAlign);
+  tw->totalFramesReadWritten += (uint32_t) frames_read;
+  return (int) frames_read;
+}
+
+int tinywav_read_int16(TinyWav *tw, int16_t *data, int len) {
+  
+  if (tw == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw) || tw->sampFmt != TW_INT16) {
+    return -1;
+  }
+  if (isAdpcm(tw->audioFormat)) {
+    return readAdpcm(tw, data, len, true);
+  }
+  if (tw->audioFormat != TW_FORMAT_ALAW && tw->audioFormat != TW_FORMAT_MULAW) {
+    return tinywav_read_raw(tw, data, len); // 16-bit int samples need no decoding
+  }
+  
+  const uint32_t bytesConsumed = tw->totalFramesReadWritten * tw->h.BlockAlign;
+  if (bytesConsumed >= tw->h.Subchunk2Size) {
+    return 0; // there's nothing more to read, not an error.
+  }
+  const uint32_t framesRemaining = (tw->h.Subchunk2Size - bytesConsumed) / tw->h.BlockAlign;
+  if ((uint32_t) len > framesRemaining) {
+    len = (int) framesRemaining;
+  }
+  return readG711(tw, data, len, true);
+}
+
+const TinyWavChunk *tinywav_find_chunk(const TinyWav *tw, const char *chunkID) {
+  if (tw == NULL || chunkID == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < tw->numChunks; ++i) {
+    if (memcmp(tw->chunks[i].id, chunkID, 4) == 0) {
+      return &tw->chunks[i];
+    }
+  }
+  return NULL;
+}
+
+int tinywav_read_chunk(TinyWav *tw, const TinyWavChunk *chunk, void *data, int len) {
+  if (tw == NULL || chunk == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  
+  const long position = tellFile(tw);
+  if ((uint32_t) len > chunk->size) {
+    len = (int) chunk->size;
+  }
+  if (ioSeek(tw, (long) chunk->offset, SEEK_SET) != 0) {
+    return -1;
+  }
+  size_t bytes_read = ioRead(tw, data, sizeof(uint8_t), (size_t) len);
+  ioSeek(tw, position, SEEK_SET); // continue reading samples where we left off
+  return (int) bytes_read;
+}
+
+int tinywav_set_peaks(TinyWav *tw, TinyWavPeaks *peaks, TinyWavPeak *bins, int maxBins, int framesPerBin) {
+  
+  if (tw == NULL || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  if (peaks == NULL) {
+    tw->peaks = NULL;
+    return 0;
+  }
+  if (bins == NULL || maxBins < 0 || framesPerBin < 1) {
     return -1;
   }
+  
+  peaks->bins = bins;
+  peaks->maxBins = maxBins;
+  peaks->framesPerBin = framesPerBin;
+  peaks->numChannels = numUserChannels(tw);
+  peaks->numBins = 0;
+  peaks->framesInBin = 0;
+  peaks->isAdaptive = false;
+  tw->peaks = peaks;
+  return 0;
+}
 
+int tinywav_set_levl(TinyWav *tw, TinyWavPeaks *peaks, TinyWavPeak *bins, int maxBins) {
+  
+  if (peaks == NULL || maxBins < 2 || tinywav_set_peaks(tw, peaks, bins, maxBins & ~1, 256) != 0) {
+    return -1; // an even number of bins can always be merged pairwise
+  }
+  peaks->isAdaptive = true;
+  tw->writeLevl = true;
   return 0;
 }
 
-int tinywav_open_read(TinyWav *tw, const char *path, TinyWavChannelFormat chanFmt) {
+int tinywav_reduce_peaks(const TinyWavPeak *bins, int numBins, int numChannels, int factor, TinyWavPeak *out) {
   
-  if (tw == NULL || path == NULL) {
+  if (bins == NULL || out == NULL || numBins < 0 || numChannels < 1 || factor < 1) {
     return -1;
   }
   
-#if _WIN32
-  errno_t err = fopen_s(&tw->f, path, "rb");
-  if (err != 0) { tw->f = NULL; }
-#else
-  tw->f = fopen(path, "rb");
-#endif
+  int numOut = 0;
+  for (int first = 0; first < numBins; first += factor, ++numOut) {
+    const int n = (numBins - first < factor) ? (numBins - first) : factor;
+    for (int c = 0; c < numChannels; ++c) {
+      // all input bins are read before the output bin is written, which allows out == bins
+      TinyWavPeak combined = bins[first * numChannels + c];
+      float sumSquares = combined.rms * combined.rms;
+      for (int i = 1; i < n; ++i) {
+        const TinyWavPeak *bin = &bins[(first + i) * numChannels + c];
+        if (bin->min < combined.min) combined.min = bin->min;
+        if (bin->max > combined.max) combined.max = bin->max;
+        sumSquares += bin->rms * bin->rms;
+      }
+      combined.rms = sqrtf(sumSquares / (float) n);
+      out[numOut * numChannels + c] = combined;
+    }
+  }
+  return numOut;
+}
+
+int tinywav_set_hash(TinyWav *tw, TinyWavHash *hash, int types) {
   
-  if (tw->f == NULL) {
-    perror("[tinywav] Failed to open file for reading");
+  if (tw == NULL || !tinywav_isOpen(tw)) {
     return -1;
   }
+  if (hash == NULL) {
+    tw->hash = NULL;
+    return 0;
+  }
   
-  // Parse WAV header
-  /** @note: We do this byte-by-byte to avoid dependencies (htonl() et al.) and because struct padding depends on
-   *  specific compiler implementation ('slurping' directly into the header struct is therefore dangerous).
-   *  The RIFF format specifies little-endian order for the data stream. */
+  memset(hash, 0, sizeof(TinyWavHash));
+  hash->types = types;
+  hash->xxh64State[0] = kXxh64Prime1 + kXxh64Prime2; // seed 0
+  hash->xxh64State[1] = kXxh64Prime2;
+  hash->xxh64State[2] = 0;
+  hash->xxh64State[3] = 0 - kXxh64Prime1;
+  hash->md5State[0] = 0x67452301;
+  hash->md5State[1] = 0xEFCDAB89;
+  hash->md5State[2] = 0x98BADCFE;
+  hash->md5State[3] = 0x10325476;
+  tw->hash = hash;
+  return 0;
+}
 
-  // RIFF Chunk, WAVE Subchunk
-  size_t elementCount = fread(tw->h.ChunkID, sizeof(char), 4, tw->f);
-  elementCount += fread(&tw->h.ChunkSize, sizeof(uint32_t), 1, tw->f);
-  elementCount += fread(tw->h.Format, sizeof(char), 4, tw->f);
+int tinywav_select_channels(TinyWav *tw, const int *channels, int numSelected) {
   
-  if (elementCount < 9 || !chunkIDMatches(tw->h.ChunkID, "RIFF") || !chunkIDMatches(tw->h.Format, "WAVE")) {
-    tinywav_close_read(tw);
+  if (tw == NULL || !tinywav_isOpen(tw)) {
     return -1;
   }
-  
-  // Go through subchunks until we find 'fmt '  (There are sometimes JUNK or other chunks before 'fmt ')
-  while (fread(tw->h.Subchunk1ID, sizeof(char), 4, tw->f) == 4) {
-    fread(&tw->h.Subchunk1Size, sizeof(uint32_t), 1, tw->f);
-    if (chunkIDMatches(tw->h.Subchunk1ID, "fmt ")) {
-      break;
-    } else {
-      fseek(tw->f, tw->h.Subchunk1Size, SEEK_CUR); // skip this subchunk
+  if (channels != NULL) {
+    if (numSelected < 1 || tw->mixMatrix != NULL) {
+      return -1;
+    }
+    for (int k = 0; k < numSelected; ++k) {
+      if (channels[k] < 0 || channels[k] >= tw->numChannels) {
+        return -1;
+      }
     }
   }
+  tw->selectedChannels = channels;
+  tw->numSelectedChannels = (channels != NULL) ? numSelected : 0;
+  return 0;
+}
+
+int tinywav_set_mix(TinyWav *tw, const float *matrix, const float *gains, int numOutputs) {
   
-  // fmt Subchunk
-  elementCount  = fread(&tw->h.AudioFormat, sizeof(uint16_t), 1, tw->f);
-  elementCount += fread(&tw->h.NumChannels, sizeof(uint16_t), 1, tw->f);
-  elementCount += fread(&tw->h.SampleRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fread(&tw->h.ByteRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fread(&tw->h.BlockAlign, sizeof(uint16_t), 1, tw->f);
-  elementCount += fread(&tw->h.BitsPerSample, sizeof(uint16_t), 1, tw->f);
-  if (elementCount != 6) {
-    tinywav_close_read(tw);
+  if (tw == NULL || !tinywav_isOpen(tw) || (matrix != NULL && (numOutputs < 1 || tw->selectedChannels != NULL))) {
     return -1;
   }
+  tw->mixMatrix = matrix;
+  tw->mixGains = (matrix != NULL) ? gains : NULL;
+  tw->numMixOutputs = (matrix != NULL) ? numOutputs : 0;
+  return 0;
+}
+
+size_t tinywav_resampler_size(const TinyWav *tw, int32_t outRate) {
   
-  // skip over any other chunks before the "data" chunk (e.g. JUNK, INFO, bext, ...)
-  while (fread(tw->h.Subchunk2ID, sizeof(char), 4, tw->f) == 4) {
-    fread(&tw->h.Subchunk2Size, sizeof(uint32_t), 1, tw->f);
-    if (chunkIDMatches(tw->h.Subchunk2ID, "data")) {
-      break;
-    } else {
-      fseek(tw->f, tw->h.Subchunk2Size, SEEK_CUR); // skip this subchunk
-    }
+  int upFactor, downFactor, numTaps;
+  if (tw == NULL || !resamplerGeometry((int32_t) tw->h.SampleRate, outRate, &upFactor, &downFactor, &numTaps)) {
+    return 0;
   }
-    
-  tw->numChannels = tw->h.NumChannels;
-  tw->chanFmt = chanFmt;
+  const size_t capacity = (size_t) numTaps + TINYWAV_RESAMPLER_BLOCK_SIZE;
+  return ((size_t) upFactor * numTaps + numUserChannels(tw) * capacity) * sizeof(float);
+}
 
-  if (tw->h.BitsPerSample == 32 && tw->h.AudioFormat == 3) {
-    tw->sampFmt = TW_FLOAT32; // file has 32-bit IEEE float samples
-  } else if (tw->h.BitsPerSample == 16 && tw->h.AudioFormat == 1) {
-    tw->sampFmt = TW_INT16; // file has 16-bit int samples
-  } else {
-    tw->sampFmt = TW_FLOAT32;
-    printf("[tinywav] Warning: wav file has %d bits per sample (int), which is not natively supported yet. Treating them as float; you may want to convert them manually after reading.\n", tw->h.BitsPerSample);
+int tinywav_set_resampler(TinyWav *tw, TinyWavResampler *resampler, int32_t outRate, void *memory, size_t size) {
+  
+  if (tw == NULL || !tinywav_isOpen(tw)) {
+    return -1;
   }
-
-  tw->numFramesInHeader = tw->h.Subchunk2Size / (tw->numChannels * tw->sampFmt);
-  tw->totalFramesReadWritten = 0;
+  if (resampler == NULL) {
+    tw->resampler = NULL;
+    return 0;
+  }
+  const size_t requiredSize = tinywav_resampler_size(tw, outRate);
+  if (memory == NULL || requiredSize == 0 || size < requiredSize) {
+    return -1;
+  }
+  
+  TinyWavResampler *rs = resampler;
+  resamplerGeometry((int32_t) tw->h.SampleRate, outRate, &rs->upFactor, &rs->downFactor, &rs->numTaps);
+  rs->outRate = outRate;
+  rs->numChannels = numUserChannels(tw);
+  rs->numFrames = (int32_t) (((int64_t) tw->numFramesInHeader * rs->upFactor + rs->downFactor - 1) / rs->downFactor);
+  rs->filter = (float *) memory;
+  rs->buffer = rs->filter + rs->upFactor * rs->numTaps;
+  rs->capacity = rs->numTaps + TINYWAV_RESAMPLER_BLOCK_SIZE;
+  designResamplerFilter(rs->filter, rs->upFactor, rs->downFactor, rs->numTaps);
   
+  // start with silence before the first frame, so that the filter is centered on it
+  memset(rs->buffer, 0, (size_t) rs->numChannels * rs->capacity * sizeof(float));
+  rs->fill = rs->numTaps;
+  rs->bufferStart = -rs->numTaps;
+  rs->inputPos = 0;
+  rs->phase = 0;
+  rs->numOutput = 0;
+  rs->numInput = 0;
+  rs->isAtEnd = false;
+  tw->resampler = rs;
   return 0;
 }
 
-int tinywav_read_f(TinyWav *tw, void *data, int len) {
+int tinywav_set_dither(TinyWav *tw, TinyWavDither dither, uint32_t seed) {
   
-  if (tw == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw)) {
+  if (tw == NULL || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  if (dither != TW_DITHER_NONE && tw->numChannels > TINYWAV_MAX_DITHER_CHANNELS) {
     return -1;
   }
+  tw->dither = dither;
+  tw->ditherRandom = seed;
+  memset(tw->ditherError, 0, sizeof(tw->ditherError));
+  return 0;
+}
+
+int tinywav_set_stats(TinyWav *tw, TinyWavStats *stats) {
   
-  if (tw->totalFramesReadWritten * tw->h.BlockAlign >= tw->h.Subchunk2Size) {
-    // We are past the 'data' subchunk (size as declared in header).
-    // Sometimes there are additionl chunks *after* -- ignore these.
-    return 0; // there's nothing more to read, not an error.
+  if (tw == NULL || !tinywav_isOpen(tw)) {
+    return -1;
   }
+  if (stats != NULL) {
+    memset(stats, 0, numUserChannels(tw) * sizeof(TinyWavStats));
+  }
+  tw->stats = stats;
+  return 0;
+}
 
-  int ret = 0;
+const TinyWavStats *tinywav_get_stats(TinyWav *tw) {
+  if (tw == NULL || tw->stats == NULL) {
+    return NULL;
+  }
+  updateStats(tw->stats, numUserChannels(tw));
+  return tw->stats;
+}
+
+/** Completes the hashes of the audio data */
+static void finishHash(TinyWav *tw) {
+  if (tw->hash == NULL) {
+    return;
+  }
+  if (tw->hash->types & TW_HASH_XXH64) {
+    tw->hash->xxh64 = xxh64Digest(tw->hash);
+  }
+  if (tw->hash->types & TW_HASH_MD5) {
+    md5Digest(tw->hash);
+  }
+  tw->hash = NULL;
+}
+
+/** Completes the last, partial bin of the waveform overview */
+static void finishPeaks(TinyWav *tw) {
+  if (tw->peaks != NULL && tw->peaks->framesInBin > 0) {
+    completePeakBin(tw->peaks);
+  }
+}
+
+#ifndef TINYWAV_LOAD_BLOCK_SAMPLES
+  // number of samples (of all channels) decoded at once by tinywav_load_all(), if not read in one go. tinywav_read_f()
+  // takes a scratch buffer of this size from the stack, so it bounds the stack use at 64 KB whatever the channel count
+  #define TINYWAV_LOAD_BLOCK_SAMPLES 16384
+#endif
+
+#ifndef TINYWAV_PARALLEL_BLOCKS
+  #define TINYWAV_PARALLEL_BLOCKS 64 // with OpenMP, tinywav_load_all() decodes more ADPCM blocks than this in parallel
+#endif
+
+/**
+ * Converts n 16-bit int samples at the start of the buffer to float in place. Blocks are converted from the end, each
+ * copied aside first, so that no sample is overwritten before it is converted and the inner loop can be vectorised.
+ */
+static void int16ToFloatInPlace(float *buffer, size_t n) {
+  int16_t block[1024];
+  const int16_t *samples = (const int16_t *) buffer;
+  for (size_t end = n; end > 0;) {
+    const size_t start = (end > 1024) ? end - 1024 : 0;
+    memcpy(block, samples + start, (end - start) * sizeof(int16_t));
+    float *out = buffer + start;
+    for (size_t i = 0; i < end - start; ++i) {
+      out[i] = (float) block[i] / INT16_MAX;
+    }
+    end = start;
+  }
+}
+
+/**
+ * Decodes numBlocks ADPCM blocks from the current position of tw to interleaved float. The encoded blocks are read with
+ * one call into a temporary allocation, and each block is decoded into its own part of the buffer (SamplesPerBlock
+ * frames) and converted to float in place there. As blocks are independent of each other, they are decoded in parallel
+ * with OpenMP.
+ * @return  The number of frames decoded, at most capacity. -1 on error.
+ */
+static int32_t loadAdpcm(TinyWav *tw, float *buffer, int numBlocks, int32_t capacity) {
+  const int numChannels = tw->numChannels;
+  const int blockAlign = tw->h.BlockAlign;
+  const int framesPerBlock = tw->h.SamplesPerBlock;
+  uint8_t *encoded = (uint8_t *) malloc((size_t) numBlocks * blockAlign + 1);
+  if (encoded == NULL) {
+    return -1;
+  }
+  const size_t numBytes = ioRead(tw, encoded, sizeof(uint8_t), (size_t) numBlocks * blockAlign);
+  const int numBlocksRead = (int) ((numBytes + blockAlign - 1) / blockAlign);
+  int32_t frames = 0;
+#if defined(_OPENMP)
+  #pragma omp parallel for if (numBlocksRead > TINYWAV_PARALLEL_BLOCKS) reduction(+:frames)
+#endif
+  for (int b = 0; b < numBlocksRead; ++b) {
+    const size_t offset = (size_t) b * blockAlign;
+    const int blockBytes = (numBytes - offset < (size_t) blockAlign) ? (int) (numBytes - offset) : blockAlign;
+    int n = adpcmFramesInBlock(tw->audioFormat, numChannels, blockBytes);
+    if (n > framesPerBlock) n = framesPerBlock;
+    float *out = buffer + (size_t) b * framesPerBlock * numChannels;
+    decodeAdpcmBlock(tw->audioFormat, numChannels, n, encoded + offset, (int16_t *) out);
+    int16ToFloatInPlace(out, (size_t) n * numChannels);
+    frames += n; // only the last block is short, so the frames are contiguous
+  }
+  free(encoded);
+  return (frames < capacity) ? frames : capacity;
+}
+
+int tinywav_load_all(const char *path, TinyWavChannelFormat chanFmt, float **data, int32_t *numFrames,
+                     TinyWavInfo *info) {
   
-  switch (tw->sampFmt) {
-    case TW_INT16: {
-      TW_ALLOC(int16_t, interleaved_data, tw->numChannels*len);
-      size_t samples_read = fread(interleaved_data, sizeof(int16_t), tw->numChannels*len, tw->f);
-      uint32_t frames_read_u32 = (uint32_t) (samples_read / tw->numChannels);
-      tw->totalFramesReadWritten += frames_read_u32;
-      int frames_read = (int) frames_read_u32;
-      switch (tw->chanFmt) {
-        case TW_INTERLEAVED: { // channel buffer is interleaved e.g. [LRLRLRLR]
-          for (int pos = 0; pos < tw->numChannels * frames_read; pos++) {
-            ((float *) data)[pos] = (float) interleaved_data[pos] / INT16_MAX;
-          }
-          ret = frames_read;
-          break;
-        }
-        case TW_INLINE: { // channel buffer is inlined e.g. [LLLLRRRR]
-          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
-            for (int j = i; j < frames_read * tw->numChannels; j += tw->numChannels, ++pos) {
-              ((float *) data)[pos] = (float) interleaved_data[j] / INT16_MAX;
-            }
-          }
-          ret = frames_read;
-          break;
-        }
-        case TW_SPLIT: { // channel buffer is split e.g. [[LLLL],[RRRR]]
-          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
-            for (int j = 0; j < frames_read; j++, ++pos) {
-              ((float **) data)[i][j] = (float) interleaved_data[j*tw->numChannels + i] / INT16_MAX;
-            }
-          }
-          ret = frames_read;
-          break;
+  if (path == NULL || data == NULL || numFrames == NULL || (chanFmt != TW_INTERLEAVED && chanFmt != TW_INLINE)) {
+    return -1;
+  }
+  *data = NULL;
+  *numFrames = 0;
+  
+  TinyWav tw;
+  TinyWavOpenOptions options;
+  memset(&options, 0, sizeof(options));
+  options.recover = true; // size the buffer by what the file holds, not by a broken header
+  options.sequentialAccess = true;
+  if (tinywav_open_read_ex(&tw, path, TW_INTERLEAVED, &options) != 0) {
+    return -1;
+  }
+  const long dataOffset = tellFile(&tw); // the file was left at the start of the data chunk
+  const int numChannels = tw.numChannels;
+  const int32_t capacity = (tw.numFramesInHeader > 0) ? tw.numFramesInHeader : 0;
+  // ADPCM is decoded in whole blocks, the last one may hold more frames than the file declares
+  const bool isBlockwise = (chanFmt == TW_INTERLEAVED && isAdpcm(tw.audioFormat));
+  const int numBlocks = isBlockwise ? (int) ((capacity + tw.h.SamplesPerBlock - 1) / tw.h.SamplesPerBlock) : 0;
+  const size_t bufferFrames = isBlockwise ? (size_t) numBlocks * tw.h.SamplesPerBlock : (size_t) capacity;
+  float *buffer = (float *) malloc((bufferFrames * numChannels + 1) * sizeof(float));
+  if (buffer == NULL) {
+    tinywav_close_read(&tw);
+    return -1;
+  }
+  
+  int32_t frames = 0;
+  const bool isNative = (tw.audioFormat == TW_FORMAT_PCM && tw.h.BitsPerSample == 16) ||
+                        (tw.audioFormat == TW_FORMAT_IEEE_FLOAT && tw.h.BitsPerSample == 32);
+  if (chanFmt == TW_INTERLEAVED && isNative && tw.h.BlockAlign == numChannels * tw.sampFmt) {
+    // the whole data chunk in one read, converted in place (a float is at least as large as a sample in the file)
+    frames = (int32_t) ioRead(&tw, buffer, tw.h.BlockAlign, (size_t) capacity);
+    if (tw.sampFmt == TW_INT16) {
+      int16ToFloatInPlace(buffer, (size_t) frames * numChannels);
+    }
+  } else if (isBlockwise) {
+    frames = loadAdpcm(&tw, buffer, numBlocks, capacity);
+    if (frames < 0) {
+      free(buffer);
+      tinywav_close_read(&tw);
+      return -1;
+    }
+  } else {
+    // decode in blocks, each channel straight to its place in the buffer
+    TW_ALLOC(float *, channels, numChannels);
+    tw.chanFmt = (chanFmt == TW_INLINE) ? TW_SPLIT : TW_INTERLEAVED;
+    const int blockSize = (TINYWAV_LOAD_BLOCK_SAMPLES > numChannels) ? TINYWAV_LOAD_BLOCK_SAMPLES / numChannels : 1;
+    while (frames < capacity) {
+      const int len = (capacity - frames < blockSize) ? capacity - frames : blockSize;
+      void *out = buffer + (size_t) frames * numChannels;
+      if (chanFmt == TW_INLINE) {
+        for (int c = 0; c < numChannels; ++c) {
+          channels[c] = buffer + (size_t) c * capacity + frames;
         }
-        default: break;
+        out = channels;
       }
-      TW_DEALLOC(interleaved_data);
-      break;
+      const int n = tinywav_read_f(&tw, out, len);
+      if (n <= 0) {
+        break;
+      }
+      frames += n;
     }
-    case TW_FLOAT32: {
-      TW_ALLOC(float, interleaved_data, tw->numChannels*len);
-      size_t samples_read = fread(interleaved_data, sizeof(float), tw->numChannels*len, tw->f);
-      uint32_t frames_read_u32 = (uint32_t) (samples_read / tw->numChannels);
-      tw->totalFramesReadWritten += frames_read_u32;
-      int frames_read = (int) frames_read_u32;
-      switch (tw->chanFmt) {
-        case TW_INTERLEAVED: { // channel buffer is interleaved e.g. [LRLRLRLR]
-          memcpy(data, interleaved_data, tw->numChannels*frames_read*sizeof(float));
-          ret = frames_read;
-          break;
-        }
-        case TW_INLINE: { // channel buffer is inlined e.g. [LLLLRRRR]
-          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
-            for (int j = i; j < frames_read * tw->numChannels; j += tw->numChannels, ++pos) {
-              ((float *) data)[pos] = interleaved_data[j];
-            }
-          }
-          ret = frames_read;
-          break;
-        }
-        case TW_SPLIT: { // channel buffer is split e.g. [[LLLL],[RRRR]]
-          for (int i = 0, pos = 0; i < tw->numChannels; i++) {
-            for (int j = 0; j < frames_read; j++, ++pos) {
-              ((float **) data)[i][j] = interleaved_data[j*tw->numChannels + i];
-            }
-          }
-          ret = frames_read;
-          break;
-        }
-        default: break;
+    TW_DEALLOC(channels);
+    // close the gaps between the channels if the file held fewer frames than its header said
+    if (chanFmt == TW_INLINE && frames < capacity) {
+      for (int c = 1; c < numChannels; ++c) {
+        memmove(buffer + (size_t) c * frames, buffer + (size_t) c * capacity, (size_t) frames * sizeof(float));
       }
-      TW_DEALLOC(interleaved_data);
-      break;
     }
-    default: break;
   }
-
-  return ret;
+  
+  if (info != NULL) {
+    // the format as parsed when the file was opened, rather than probing it again
+    const bool isSupported = (tw.sampFmt == TW_INT16 ||
+                              (tw.audioFormat == TW_FORMAT_IEEE_FLOAT && tw.h.BitsPerSample == 32));
+    describeFile(&tw, dataOffset, isSupported, info);
+    info->numFrames = frames; // dataSize is as recovered
+  }
+  tinywav_close_read(&tw);
+  *data = buffer;
+  *numFrames = frames;
+  return 0;
 }
 
 void tinywav_close_read(TinyWav *tw) {
@@ -321,15 +2911,18 @@ void tinywav_close_read(TinyWav *tw) {
     return; // fclose(NULL) is undefined behaviour
   }
   
-  fclose(tw->f);
-  tw->f = NULL;
+  finishPeaks(tw);
+  tw->peaks = NULL;
+  finishHash(tw);
+  tinywav_get_stats(tw); // brings the statistics up to date
+  tw->stats = NULL;
+  closeFile(tw);
+  tw->ioStats = NULL;
+  tw->trace = NULL;
 }
 
-int tinywav_write_f(TinyWav *tw, void *f, int len) {
-  
-  if (tw == NULL || f == NULL || len < 0 || !tinywav_isOpen(tw)) {
-    return -1;
-  }
+/** Converts frames of float samples in the channel format of tw and writes them to the file */
+static int writeFrames(TinyWav *tw, void *f, int len) {
   
   // 1. Bring samples into interleaved format
   // 2. write to disk
@@ -337,36 +2930,53 @@ int tinywav_write_f(TinyWav *tw, void *f, int len) {
   switch (tw->sampFmt) {
     case TW_INT16: {
       TW_ALLOC(int16_t, z, tw->numChannels*len);
-      switch (tw->chanFmt) {
-        case TW_INTERLEAVED: {
-          const float *const x = (const float *const) f;
-          for (int i = 0; i < tw->numChannels*len; ++i) {
-            z[i] = (int16_t) (x[i] * (float) INT16_MAX);
-          }
-          break;
+      if (tw->dither != TW_DITHER_NONE) {
+        if (!ditherToInt16(tw, f, len, z)) {
+          TW_DEALLOC(z);
+          return 0;
         }
-        case TW_INLINE: {
-          const float *const x = (const float *const) f;
-          for (int i = 0, k = 0; i < len; ++i) {
-            for (int j = 0; j < tw->numChannels; ++j) {
-              z[k++] = (int16_t) (x[j*len+i] * (float) INT16_MAX);
+      } else if (tw->stats != NULL) {
+        if (!convertWithStats(tw, f, len, z)) {
+          TW_DEALLOC(z);
+          return 0;
+        }
+      } else {
+        switch (tw->chanFmt) {
+          case TW_INTERLEAVED: {
+            const float *const x = (const float *const) f;
+            for (int i = 0; i < tw->numChannels*len; ++i) {
+              z[i] = floatToInt16(x[i]);
             }
+            break;
           }
-          break;
-        }
-        case TW_SPLIT: {
-          const float **const x = (const float **const) f;
-          for (int i = 0, k = 0; i < len; ++i) {
-            for (int j = 0; j < tw->numChannels; ++j) {
-              z[k++] = (int16_t) (x[j][i] * (float) INT16_MAX);
+          case TW_INLINE: {
+            const float *const x = (const float *const) f;
+            for (int i = 0, k = 0; i < len; ++i) {
+              for (int j = 0; j < tw->numChannels; ++j) {
+                z[k++] = floatToInt16(x[j*len+i]);
+              }
             }
+            break;
           }
-          break;
+          case TW_SPLIT: {
+            const float **const x = (const float **const) f;
+            for (int i = 0, k = 0; i < len; ++i) {
+              for (int j = 0; j < tw->numChannels; ++j) {
+                z[k++] = floatToInt16(x[j][i]);
+              }
+            }
+            break;
+          }
+          default: TW_DEALLOC(z); return 0;
         }
-        default: TW_DEALLOC(z); return 0;
       }
 
-      size_t samples_written = fwrite(z, sizeof(int16_t), tw->numChannels*len, tw->f);
+      size_t samples_written = ioWrite(tw, z, sizeof(int16_t), tw->numChannels*len);
+      if (tw->hasWriteError) {
+        TW_DEALLOC(z);
+        return -1;
+      }
+      hashData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, z, samples_written * sizeof(int16_t));
       uint32_t frames_written_u32 = (uint32_t) (samples_written / tw->numChannels);
       tw->totalFramesReadWritten += frames_written_u32;
       TW_DEALLOC(z);
@@ -374,36 +2984,48 @@ int tinywav_write_f(TinyWav *tw, void *f, int len) {
     }
     case TW_FLOAT32: {
       TW_ALLOC(float, z, tw->numChannels*len);
-      switch (tw->chanFmt) {
-        case TW_INTERLEAVED: {
-          const float *const x = (const float *const) f;
-          for (int i = 0; i < tw->numChannels*len; ++i) {
-            z[i] = x[i];
-          }
-          break;
+      if (tw->stats != NULL) {
+        if (!convertWithStats(tw, f, len, z)) {
+          TW_DEALLOC(z);
+          return 0;
         }
-        case TW_INLINE: {
-          const float *const x = (const float *const) f;
-          for (int i = 0, k = 0; i < len; ++i) {
-            for (int j = 0; j < tw->numChannels; ++j) {
-              z[k++] = x[j*len+i];
+      } else {
+        switch (tw->chanFmt) {
+          case TW_INTERLEAVED: {
+            const float *const x = (const float *const) f;
+            for (int i = 0; i < tw->numChannels*len; ++i) {
+              z[i] = x[i];
             }
+            break;
           }
-          break;
-        }
-        case TW_SPLIT: {
-          const float **const x = (const float **const) f;
-          for (int i = 0, k = 0; i < len; ++i) {
-            for (int j = 0; j < tw->numChannels; ++j) {
-              z[k++] = x[j][i];
+          case TW_INLINE: {
+            const float *const x = (const float *const) f;
+            for (int i = 0, k = 0; i < len; ++i) {
+              for (int j = 0; j < tw->numChannels; ++j) {
+                z[k++] = x[j*len+i];
+              }
             }
+            break;
           }
-          break;
+          case TW_SPLIT: {
+            const float **const x = (const float **const) f;
+            for (int i = 0, k = 0; i < len; ++i) {
+              for (int j = 0; j < tw->numChannels; ++j) {
+                z[k++] = x[j][i];
+              }
+            }
+            break;
+          }
+          default: TW_DEALLOC(z); return 0;
         }
-        default: TW_DEALLOC(z); return 0;
       }
 
-      size_t samples_written = fwrite(z, sizeof(float), tw->numChannels*len, tw->f);
+      size_t samples_written = ioWrite(tw, z, sizeof(float), tw->numChannels*len);
+      if (tw->hasWriteError) {
+        TW_DEALLOC(z);
+        return -1;
+      }
+      hashData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, z, samples_written * sizeof(float));
       uint32_t frames_written_u32 = (uint32_t) (samples_written / tw->numChannels);
       tw->totalFramesReadWritten += frames_written_u32;
       TW_DEALLOC(z);
@@ -413,27 +3035,150 @@ int tinywav_write_f(TinyWav *tw, void *f, int len) {
   }
 }
 
+/**
+ * Writes the sizes of the audio data which has reached the file into the header, so that the file is readable even if
+ * it is never closed. The data is flushed (and synced, every syncInterval updates) before the header claims it.
+ * A failure is counted in tw->numHeaderUpdateErrors.
+ * @return  The error code. Zero if no error.
+ */
+static int updateHeaderSizes(TinyWav *tw) {
+  if (fflush(tw->f) != 0) {
+    tw->numHeaderUpdateErrors++;
+    return -1;
+  }
+  const int64_t dataOffset = 28 + (int64_t) tw->h.Subchunk1Size;
+  int64_t dataLen = (int64_t) tw->totalFramesReadWritten * tw->h.BlockAlign;
+#if TINYWAV_HAS_DIRECT_IO
+  if (tw->direct.buffer != NULL && tw->direct.isDirty) {
+    // flushing the buffer early would misalign all later writes, only what is in the file already counts
+    const int64_t flushedLen = (tw->direct.start > dataOffset) ? tw->direct.start - dataOffset : 0;
+    if (flushedLen < dataLen) {
+      dataLen = flushedLen - flushedLen % tw->h.BlockAlign;
+    }
+  }
+#endif
+  const bool isSync = tw->syncInterval > 0 && (tw->numHeaderUpdates + 1) % tw->syncInterval == 0;
+  uint8_t chunkSize[4];
+  uint8_t dataSize[4];
+  writeUInt32LE(chunkSize, (uint32_t) (20 + tw->h.Subchunk1Size + dataLen));
+  writeUInt32LE(dataSize, (uint32_t) dataLen);
+  if ((isSync && syncFile(tw) != 0) ||
+      writeFileAt(tw, 4, chunkSize, 4) != 0 || // ChunkSize
+      writeFileAt(tw, dataOffset - 4, dataSize, 4) != 0) { // Subchunk2Size
+    tw->numHeaderUpdateErrors++;
+    return -1;
+  }
+  tw->numHeaderUpdates++;
+  return 0;
+}
+
+/**
+ * Updates the header if another headerUpdateFrames frames have been written. A failed update does not fail the write,
+ * the frames are in the file; it is retried after the next headerUpdateFrames frames.
+ * @return  The error code of the update. Zero if no error or no update.
+ */
+static int checkHeaderUpdate(TinyWav *tw) {
+  if (tw->headerUpdateFrames > 0 && tw->totalFramesReadWritten >= tw->nextHeaderUpdate) {
+    tw->nextHeaderUpdate = tw->totalFramesReadWritten + (uint32_t) tw->headerUpdateFrames;
+    return updateHeaderSizes(tw);
+  }
+  return 0;
+}
+
+int tinywav_write_f(TinyWav *tw, void *f, int len) {
+  
+  if (tw == NULL || f == NULL || len < 0 || !tinywav_isOpen(tw) || tw->hasWriteError) {
+    return -1;
+  }
+  
+  TW_USDT(write_f_begin, tw, len);
+  traceBegin(tw, TW_TRACE_WRITE_F, len);
+  const uint64_t start = beginTimedCall(tw, len);
+  const int ret = writeFrames(tw, f, len);
+  if (ret > 0 && tw->peaks != NULL) {
+    accumulatePeaks(tw->peaks, tw->chanFmt, f, len, ret);
+  }
+  checkHeaderUpdate(tw);
+  endTimedCall(tw, start);
+  traceEnd(tw, TW_TRACE_WRITE_F, ret);
+  TW_USDT(write_f_end, tw, ret);
+  return ret;
+}
+
+int tinywav_write_raw(TinyWav *tw, const void *data, int len) {
+  
+  if (tw == NULL || data == NULL || len < 0 || !tinywav_isOpen(tw) || tw->hasWriteError) {
+    return -1;
+  }
+  
+  size_t samples_written = ioWrite(tw, data, tw->sampFmt, (size_t) (tw->numChannels * len));
+  if (tw->hasWriteError) {
+    return -1;
+  }
+  hashData(tw, (uint64_t) tw->totalFramesReadWritten * tw->h.BlockAlign, data, samples_written * tw->sampFmt);
+  uint32_t frames_written_u32 = (uint32_t) (samples_written / tw->numChannels);
+  tw->totalFramesReadWritten += frames_written_u32;
+  checkHeaderUpdate(tw);
+  return (int) frames_written_u32;
+}
+
 void tinywav_close_write(TinyWav *tw) {
   if (tw == NULL || tw->f == NULL) {
     return; // fclose(NULL) is undefined behaviour
   }
   
+#if TINYWAV_HAS_DIRECT_IO
+  // audio data which cannot be flushed is dropped and not counted in the header
+  if (tw->direct.buffer != NULL && flushDirect(tw) != 0) {
+    const int64_t onFile = tw->direct.start - (28 + tw->h.Subchunk1Size); // bytes of audio data before the buffer
+    const int64_t frames = (onFile > 0) ? onFile / (tw->numChannels * tw->sampFmt) : 0;
+    if (frames < (int64_t) tw->totalFramesReadWritten) {
+      tw->totalFramesReadWritten = (uint32_t) frames;
+    }
+    tw->direct.isDirty = false;
+    tw->direct.len = 0;
+    tw->hasWriteError = true;
+  }
+#endif
   uint32_t data_len = tw->totalFramesReadWritten * tw->numChannels * tw->sampFmt;
-  uint32_t chunkSize_len = 36 + data_len; // 36 is size of header minus 8 (RIFF + this field)
+  // size of header minus 8 (RIFF + this field): "WAVE" + fmt chunk (8 + Subchunk1Size) + data chunk header (8)
+  uint32_t chunkSize_len = 20 + tw->h.Subchunk1Size + data_len;
+  
+  // append the peak envelope after the audio data
+  finishPeaks(tw);
+  if (tw->writeLevl && tw->peaks != NULL) {
+    ioSeek(tw, 28 + tw->h.Subchunk1Size + data_len, SEEK_SET); // end of the data chunk (always of even size)
+    chunkSize_len += writeLevlChunk(tw, tw->peaks);
+  }
+  tw->peaks = NULL;
+  finishHash(tw);
+  tinywav_get_stats(tw); // brings the statistics up to date
+  tw->stats = NULL;
   
   // update header struct as well
   tw->h.ChunkSize = chunkSize_len;
   tw->h.Subchunk2Size = data_len;
   
   // set length of data
-  fseek(tw->f, 4, SEEK_SET); // offset of ChunkSize
-  fwrite(&chunkSize_len, sizeof(uint32_t), 1, tw->f); // write ChunkSize
+  ioSeek(tw, 4, SEEK_SET); // offset of ChunkSize
+  ioWrite(tw, &chunkSize_len, sizeof(uint32_t), 1); // write ChunkSize
   
-  fseek(tw->f, 40, SEEK_SET); // offset Subchunk2Size
-  fwrite(&data_len, sizeof(uint32_t), 1, tw->f); // write Subchunk2Size
+  if (tw->h.AudioFormat == TW_FORMAT_EXTENSIBLE) {
+    ioSeek(tw, 40, SEEK_SET); // offset of ChannelMask, may have been set by the user
+    ioWrite(tw, &tw->h.ChannelMask, sizeof(uint32_t), 1);
+  }
   
-  fclose(tw->f);
-  tw->f = NULL;
+  ioSeek(tw, 24 + tw->h.Subchunk1Size, SEEK_SET); // offset Subchunk2Size
+  ioWrite(tw, &data_len, sizeof(uint32_t), 1); // write Subchunk2Size
+  
+  // give back the preallocated space which was not written
+  if (tw->preallocatedSize > (int64_t) chunkSize_len + 8) {
+    truncateFile(tw, (int64_t) chunkSize_len + 8);
+  }
+  
+  closeFile(tw);
+  tw->ioStats = NULL;
+  tw->trace = NULL;
 }
 
 bool tinywav_isOpen(TinyWav *tw) {
@@ -41,10 +41,26 @@ typedef struct TinyWavHeader {
   uint32_t ByteRate;
   uint16_t BlockAlign;
   uint16_t BitsPerSample;
+  uint16_t cbSize;             ///< size of the fmt extension (0 if the fmt chunk is only 16 bytes)
+  uint16_t ValidBitsPerSample; ///< WAVE_FORMAT_EXTENSIBLE only. Readers refuse more than BitsPerSample, and less for float
+  uint32_t ChannelMask;        ///< WAVE_FORMAT_EXTENSIBLE only: speaker positions (0 if not assigned)
+  uint8_t SubFormat[16];       ///< WAVE_FORMAT_EXTENSIBLE only: GUID, the first two bytes are the format tag. Readers refuse GUIDs other than KSDATAFORMAT_SUBTYPE_*
+  uint16_t SamplesPerBlock;    ///< ADPCM only: number of frames encoded in each block of BlockAlign bytes
   char Subchunk2ID[4];
   uint32_t Subchunk2Size;
 } TinyWavHeader;
   
+/** Format tags as found in the AudioFormat field (or in the SubFormat GUID for WAVE_FORMAT_EXTENSIBLE) */
+typedef enum TinyWavAudioFormat {
+  TW_FORMAT_PCM = 0x0001,
+  TW_FORMAT_MS_ADPCM = 0x0002, // Microsoft ADPCM, read only
+  TW_FORMAT_IEEE_FLOAT = 0x0003,
+  TW_FORMAT_ALAW = 0x0006,  // G.711 A-law, read only
+  TW_FORMAT_MULAW = 0x0007, // G.711 mu-law, read only
+  TW_FORMAT_IMA_ADPCM = 0x0011, // IMA/DVI ADPCM, read only
+  TW_FORMAT_EXTENSIBLE = 0xFFFE
+} TinyWavAudioFormat;
+
 typedef enum TinyWavChannelFormat {
   TW_INTERLEAVED, // channel buffer is interleaved e.g. [LRLRLRLR]
   TW_INLINE,      // channel buffer is inlined e.g. [LLLLRRRR]
@@ -56,18 +72,204 @@ typedef enum TinyWavSampleFormat {
   TW_FLOAT32 = 4 // four byte IEEE float
 } TinyWavSampleFormat;
 
+#ifndef TINYWAV_MAX_CHUNKS
+  #define TINYWAV_MAX_CHUNKS 16 ///< maximum number of chunks recorded in the chunk table of a TinyWav struct
+#endif
+
+/** Location of a chunk in the file */
+typedef struct TinyWavChunk {
+  char id[4];      ///< e.g. "bext", "LIST"
+  uint32_t offset; ///< file offset of the chunk payload (i.e. after its id and size)
+  uint32_t size;   ///< payload size as declared in the chunk header
+} TinyWavChunk;
+
+/** Minimum, maximum and RMS of the samples of one channel within one bin of frames */
+typedef struct TinyWavPeak {
+  float min;
+  float max;
+  float rms;
+} TinyWavPeak;
+
+/** Accumulates a waveform overview while samples are read or written, see tinywav_set_peaks() */
+typedef struct TinyWavPeaks {
+  TinyWavPeak *bins; ///< maxBins * numChannels entries, ordered by bin, then channel. Owned by the caller.
+  int maxBins;
+  int framesPerBin;
+  int numChannels;
+  int numBins;       ///< number of completed bins
+  int framesInBin;   ///< number of frames accumulated in the bin following the completed ones
+  bool isAdaptive;   ///< if true, the bins are merged pairwise and framesPerBin doubles when they run out
+} TinyWavPeaks;
+
+/** Statistics of the samples of one channel, see tinywav_set_stats() */
+typedef struct TinyWavStats {
+  float peak;          ///< largest absolute sample value
+  float rms;           ///< root mean square, up to date after tinywav_get_stats() or closing the file
+  float dc;            ///< mean sample value (DC offset), up to date after tinywav_get_stats() or closing the file
+  uint64_t numSamples;
+  uint64_t numClipped; ///< number of samples at or beyond full scale. Written 16-bit int samples are clamped to it.
+  double sum;
+  double sumSquares;
+} TinyWavStats;
+
+#ifndef TINYWAV_MAX_DITHER_CHANNELS
+  #define TINYWAV_MAX_DITHER_CHANNELS 32 ///< maximum number of channels which can be dithered, see tinywav_set_dither()
+#endif
+
+/** Counters of the file I/O and conversion work of a handle, see TinyWavOpenOptions */
+typedef struct TinyWavIOStats {
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t numReads;   ///< number of fread calls, including those parsing the header
+  uint64_t numWrites;  ///< number of fwrite calls, including those writing the header
+  uint64_t numSeeks;   ///< number of fseek calls
+  uint64_t numShortReads; ///< number of reads which returned less than requested, e.g. at the end of a truncated file
+  uint64_t ioNanoseconds;         ///< time spent in fread, fwrite and fseek
+  uint64_t conversionNanoseconds; ///< time spent in tinywav_read_f() and tinywav_write_f() besides I/O
+  int32_t maxBlockSize; ///< the largest number of frames passed to tinywav_read_f() or tinywav_write_f()
+} TinyWavIOStats;
+
+/** What a trace hook is called for, see TinyWavTraceHooks */
+typedef enum TinyWavTraceEvent {
+  TW_TRACE_READ_F = 0,  ///< a call of tinywav_read_f(), the value is the number of frames
+  TW_TRACE_WRITE_F = 1, ///< a call of tinywav_write_f(), the value is the number of frames
+  TW_TRACE_FREAD = 2,   ///< a read from the file, the value is the number of bytes
+  TW_TRACE_FWRITE = 3,  ///< a write to the file, the value is the number of bytes
+} TinyWavTraceEvent;
+
+/**
+ * Callbacks around the calls of a handle, e.g. to attribute deadline misses of an audio thread to TinyWav. begin
+ * receives the requested value, end the actual one. The callbacks are called on the thread calling TinyWav and must
+ * be as cheap as the code they measure. Either may be NULL.
+ */
+typedef struct TinyWavTraceHooks {
+  void (*begin)(void *userData, TinyWavTraceEvent event, int64_t value);
+  void (*end)(void *userData, TinyWavTraceEvent event, int64_t value);
+  void *userData;
+} TinyWavTraceHooks;
+
+#ifndef TINYWAV_DIRECT_ALIGNMENT
+  #define TINYWAV_DIRECT_ALIGNMENT 4096 ///< alignment of offsets, sizes and memory for O_DIRECT, see TinyWavOpenOptions
+#endif
+
+/** State of unbuffered (O_DIRECT) I/O through an aligned buffer */
+typedef struct TinyWavDirectIO {
+  int fd;
+  uint8_t *buffer;  ///< the aligned buffer of TinyWavOpenOptions, NULL if direct I/O is not used
+  size_t size;      ///< size of the buffer
+  int64_t start;    ///< file offset of the first byte of the buffer
+  size_t len;       ///< number of valid bytes in the buffer
+  int64_t position; ///< file position of the next read or write
+  bool isDirty;     ///< the buffer holds bytes which have not been written to the file yet
+} TinyWavDirectIO;
+
+/** Dither applied when writing float samples to a 16-bit int file */
+typedef enum TinyWavDither {
+  TW_DITHER_NONE = 0,        ///< truncate (default)
+  TW_DITHER_TPDF = 1,        ///< add triangular noise of +-1 LSB and round
+  TW_DITHER_TPDF_SHAPED = 2, ///< TPDF dither with first-order noise shaping, which moves the noise to high frequencies
+} TinyWavDither;
+
+#ifndef TINYWAV_RESAMPLER_MAX_PHASES
+  #define TINYWAV_RESAMPLER_MAX_PHASES 1024 ///< largest upsampling factor (after reducing the rate ratio) of the resampler
+#endif
+
+/** A streaming sample rate converter attached to a reader, see tinywav_set_resampler() */
+typedef struct TinyWavResampler {
+  int32_t outRate;
+  int upFactor;      ///< the rate ratio outRate / inRate reduced to upFactor / downFactor
+  int downFactor;
+  int numTaps;       ///< number of filter taps per phase
+  int numChannels;
+  int32_t numFrames; ///< number of frames delivered for the whole file, i.e. numFramesInHeader at outRate
+  float *filter;     ///< upFactor phases of numTaps coefficients each
+  float *buffer;     ///< the input frames of each channel, capacity frames per channel
+  int capacity;
+  int fill;          ///< number of frames in buffer
+  int64_t bufferStart; ///< the input frame index of the first frame in buffer
+  int64_t inputPos;  ///< the input frame index of the next output frame, at phase / upFactor past it
+  int phase;
+  int64_t numOutput; ///< number of frames delivered so far
+  int64_t numInput;  ///< total number of input frames, known once the end of the file is reached
+  bool isAtEnd;
+} TinyWavResampler;
+
+/** Hash functions for tinywav_set_hash(), may be combined */
+typedef enum TinyWavHashType {
+  TW_HASH_XXH64 = 1, ///< xxHash64 with seed 0, fast
+  TW_HASH_MD5 = 2,   ///< MD5, widely supported
+} TinyWavHashType;
+
+/** Hashes of the audio data accumulated while samples are read or written, see tinywav_set_hash() */
+typedef struct TinyWavHash {
+  int types;           ///< the TinyWavHashType flags of the hashes being computed
+  uint64_t length;     ///< number of bytes of the data chunk hashed so far
+  uint64_t xxh64;      ///< the xxHash64 of the data chunk, valid once the file is closed
+  uint8_t md5[16];     ///< the MD5 of the data chunk, valid once the file is closed
+  uint64_t xxh64State[4];
+  uint32_t md5State[4];
+  uint8_t xxh64Buffer[32];
+  uint8_t md5Buffer[64];
+} TinyWavHash;
+
 typedef struct TinyWav {
   FILE *f;
   TinyWavHeader h;
+  uint16_t audioFormat; ///< format tag of the file, resolved from the SubFormat GUID for WAVE_FORMAT_EXTENSIBLE
   int16_t numChannels;
   int32_t numFramesInHeader; ///< number of samples per channel declared in wav header (only populated when reading)
   uint32_t totalFramesReadWritten; ///< total numSamples per channel which have been read or written
   TinyWavChannelFormat chanFmt;
-  TinyWavSampleFormat sampFmt;
+  TinyWavSampleFormat sampFmt; ///< sample format of the file. Files with compressed samples (G.711, ADPCM) report the format they decode to.
+  TinyWavChunk chunks[TINYWAV_MAX_CHUNKS]; ///< chunks found in the file, in file order (only populated when reading)
+  int numChunks; ///< number of valid entries in chunks. Chunks beyond TINYWAV_MAX_CHUNKS are not recorded.
+  TinyWavPeaks *peaks; ///< waveform overview accumulated by tinywav_read_f() and tinywav_write_f(), NULL if none
+  bool writeLevl; ///< if true, the waveform overview is written as a 'levl' chunk when closing (only used by writer)
+  TinyWavHash *hash; ///< hashes of the audio data accumulated by reads and writes, NULL if none
+  TinyWavStats *stats; ///< per-channel statistics accumulated by tinywav_read_f() and tinywav_write_f(), NULL if none
+  const int *selectedChannels; ///< the channels of the file returned by tinywav_read_f(), NULL for all of them
+  int numSelectedChannels;
+  const float *mixMatrix; ///< numMixOutputs x numChannels matrix mixing the channels returned by tinywav_read_f(), NULL if none
+  const float *mixGains;  ///< gain of each output of the mix, NULL for unity
+  int numMixOutputs;
+  TinyWavResampler *resampler; ///< converts the sample rate of the frames returned by tinywav_read_f(), NULL if none
+  TinyWavDither dither; ///< dither applied by tinywav_write_f() to 16-bit int samples
+  uint32_t ditherRandom; ///< state of the dither noise generator
+  float ditherError[TINYWAV_MAX_DITHER_CHANNELS]; ///< last quantization error of each channel, for noise shaping
+  TinyWavIOStats *ioStats; ///< counters of file I/O, NULL if not collected
+  const TinyWavTraceHooks *trace; ///< called around calls and file I/O, NULL if none
+  TinyWavDirectIO direct; ///< unbuffered I/O, see TinyWavOpenOptions.directIO
+  bool hasWriteError; ///< set once audio data could not be written to the file (direct I/O). Later writes fail, the header counts the frames which reached the file only.
+  int64_t preallocatedSize; ///< size the file was preallocated to by the writer, 0 if not
+  int32_t headerUpdateFrames; ///< the writer rewrites the sizes in the header every this many frames, 0 only on close
+  int32_t syncInterval;       ///< the writer syncs the file every this many header updates, 0 for never
+  uint32_t nextHeaderUpdate;  ///< number of frames after which the header is updated next
+  int32_t numHeaderUpdates;      ///< number of header updates written by the writer
+  int32_t numHeaderUpdateErrors; ///< number of header updates which failed, the header may lag behind the audio data
 } TinyWav;
 
+#ifndef TINYWAV_PROBE_SIZE
+  #define TINYWAV_PROBE_SIZE 4096 ///< number of bytes read at once from the start of a file to parse its header
+#endif
+
+/** Format of a file as returned by tinywav_probe() */
+typedef struct TinyWavInfo {
+  uint16_t audioFormat;  ///< format tag of the file, resolved from the SubFormat GUID for WAVE_FORMAT_EXTENSIBLE
+  uint16_t numChannels;
+  uint32_t sampleRate;
+  uint16_t bitsPerSample;
+  uint16_t blockAlign;
+  int32_t numFrames;     ///< number of samples per channel, as tinywav_open_read() would report in numFramesInHeader
+  uint32_t dataOffset;   ///< file offset of the sample data
+  uint32_t dataSize;     ///< size of the sample data in bytes, as declared in the header
+  TinyWavSampleFormat sampFmt; ///< the format samples are decoded to
+  bool isSupported;      ///< true if tinywav_read_f() decodes the samples natively
+} TinyWavInfo;
+
 /**
  * Open a file for writing.
+ * @note Files with more than two channels are written with a WAVE_FORMAT_EXTENSIBLE header. Its ChannelMask
+ *       defaults to 0 (no speaker assignment) and can be set in tw->h.ChannelMask any time before closing the file.
  *
  * @param numChannels  The number of channels to write.
  * @param samplerate   The sample rate of the audio.
@@ -92,6 +294,129 @@ int tinywav_open_write(TinyWav *tw,
  */
 int tinywav_open_read(TinyWav *tw, const char *path, TinyWavChannelFormat chanFmt);
 
+/** Options for opening a file with tinywav_open_write_ex() or tinywav_open_read_ex(). Zero-initialise unused fields. */
+typedef struct TinyWavOpenOptions {
+  TinyWavIOStats *ioStats; ///< if not NULL, reset and then updated with the I/O of the handle until it is closed
+  const TinyWavTraceHooks *trace; ///< if not NULL, called around each read/write call and file I/O until closed
+  size_t bufferSize; ///< size of the stdio buffer of the file, e.g. 1 MB on network file systems. 0 for the default
+  void *buffer;      ///< memory for the stdio buffer, at least bufferSize bytes and valid until closed. NULL lets stdio allocate it
+  bool directIO;     ///< Linux only: bypass the page cache (O_DIRECT). Needs buffer, with address and bufferSize a multiple of TINYWAV_DIRECT_ALIGNMENT
+  int32_t expectedFrames; ///< writers: preallocate the file for this many frames (fallocate, Linux), 0 for none. The file size only grows as frames are written, so a crashed recording does not end in preallocated zeros
+  bool sequentialAccess;  ///< readers: advise the OS that the data chunk is read sequentially and soon (posix_fadvise, Linux)
+  int32_t headerUpdateFrames; ///< writers: keep the header up to date every this many frames (e.g. samplerate * 10 for every 10 seconds), so that the file survives a crash. 0 for only on close. Failed updates are counted in TinyWav.numHeaderUpdateErrors
+  int32_t syncInterval;       ///< writers: fdatasync the file every this many header updates, 0 for never
+  bool recover;      ///< readers: if Subchunk2Size is 0, 0xFFFFFFFF or beyond the end of the file (e.g. after a crash), derive it from the file size. Everything after the start of the data is then taken as audio, including chunks a writer may have appended. A size written by headerUpdateFrames is kept, frames written after the last update are lost
+  bool repairHeader; ///< readers, with recover: also write the derived sizes into the header. Opens the file for update
+} TinyWavOpenOptions;
+
+/**
+ * Same as tinywav_open_write(), with options.
+ * @param options  The options, or NULL for the defaults.
+ */
+int tinywav_open_write_ex(TinyWav *tw,
+    int16_t numChannels, int32_t samplerate,
+    TinyWavSampleFormat sampFmt, TinyWavChannelFormat chanFmt,
+    const char *path, const TinyWavOpenOptions *options);
+
+/**
+ * Same as tinywav_open_read(), with options.
+ * @param options  The options, or NULL for the defaults.
+ */
+int tinywav_open_read_ex(TinyWav *tw, const char *path, TinyWavChannelFormat chanFmt,
+                         const TinyWavOpenOptions *options);
+
+/**
+ * Get the format of a file without opening it for reading. Only the first TINYWAV_PROBE_SIZE bytes are read in one
+ * go, further chunk headers are read individually only if the header extends beyond that. No FILE is created and
+ * nothing is printed, so this is suited for cataloguing many files.
+ *
+ * @param path  The path of the file to probe.
+ * @param info  Filled with the format of the file.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_probe(const char *path, TinyWavInfo *info);
+
+#ifndef TINYWAV_MAX_PROBE_THREADS
+  #define TINYWAV_MAX_PROBE_THREADS 64 ///< upper limit on the number of threads used by tinywav_probe_batch()
+#endif
+
+/**
+ * Probe many files concurrently, e.g. to catalogue a sample library. Reading the headers of many small files is
+ * dominated by the latency of opening them. With TINYWAV_USE_THREADS (Cmake option, links pthread on POSIX), the files
+ * are spread over a number of threads which probe them in parallel. Otherwise they are probed one after another on the
+ * calling thread and numThreads is ignored.
+ *
+ * @param paths       The paths of the files to probe.
+ * @param numFiles    The number of paths.
+ * @param infos       An array of numFiles entries, filled in the order of paths. The entry of a file which cannot be
+ *                    probed is zeroed.
+ * @param errors      An array of numFiles entries receiving the error code of tinywav_probe() for each file. May be NULL.
+ * @param numThreads  The number of threads to use (including the calling one), at most TINYWAV_MAX_PROBE_THREADS.
+ *                    Zero or less selects 8.
+ *
+ * @return  The number of files which were probed successfully. -1 if the arguments are invalid.
+ */
+int tinywav_probe_batch(const char *const *paths, int numFiles, TinyWavInfo *infos, int *errors, int numThreads);
+
+/**
+ * Select the channels returned by tinywav_read_f(). Only those channels are converted and written to the destination,
+ * which then holds numSelected channels in the channel format given to tinywav_open_read(). A channel may be selected
+ * more than once.
+ * Cannot be combined with tinywav_set_mix().
+ * Call this after opening the file and before reading any samples, tinywav_set_peaks() or tinywav_set_stats().
+ *
+ * @param channels     The indices of the channels to return, in the order they are returned. The array is not copied
+ *                     and must remain valid until the file is closed. NULL to return all channels.
+ * @param numSelected  The number of entries in channels.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_select_channels(TinyWav *tw, const int *channels, int numSelected);
+
+/**
+ * Mix the channels of the file while reading, e.g. to downmix 5.1 to stereo. tinywav_read_f() then returns numOutputs
+ * channels in the channel format given to tinywav_open_read(), computed as
+ *   out[k] = gains[k] * sum over c of (matrix[k * tw->numChannels + c] * in[c])
+ * in the same pass that converts the samples to float, without deinterleaving all channels of the file first.
+ * Cannot be combined with tinywav_select_channels().
+ * Call this after opening the file and before reading any samples, tinywav_set_peaks() or tinywav_set_stats().
+ * The arrays are not copied and must remain valid until the file is closed.
+ *
+ * @param matrix      The mixing matrix of numOutputs rows and tw->numChannels columns. NULL to return all channels.
+ * @param gains       The gain of each output, NULL for unity gain.
+ * @param numOutputs  The number of output channels.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_mix(TinyWav *tw, const float *matrix, const float *gains, int numOutputs);
+
+/**
+ * Get the size of the memory needed by tinywav_set_resampler().
+ *
+ * @param tw       The TinyWav structure which has already been prepared, including any channel selection or mix.
+ * @param outRate  The sample rate at which frames are to be read.
+ *
+ * @return  The size in bytes, 0 if this conversion is not supported.
+ */
+size_t tinywav_resampler_size(const TinyWav *tw, int32_t outRate);
+
+/**
+ * Convert the sample rate while reading, e.g. to read a 48 kHz file at 16 kHz. tinywav_read_f() then returns frames at
+ * outRate, filtered by a polyphase windowed-sinc filter. The file is read in small blocks as needed, so memory use
+ * and latency do not depend on the length of the file. The resampled length of the file is in resampler->numFrames.
+ * Call this after opening the file, tinywav_select_channels() or tinywav_set_mix() and before reading any samples.
+ *
+ * @param resampler  The state of the converter, owned by the caller. It must remain valid until the file is closed.
+ * @param outRate    The sample rate at which frames are to be read.
+ * @param memory     Memory for the filter and the input frames, owned by the caller and aligned for float. It must
+ *                   remain valid until the file is closed.
+ * @param size       The size of memory, at least tinywav_resampler_size().
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_resampler(TinyWav *tw, TinyWavResampler *resampler, int32_t outRate, void *memory, size_t size);
+
 /**
  * Read sample data from the file.
  *
@@ -104,6 +429,152 @@ int tinywav_open_read(TinyWav *tw, const char *path, TinyWavChannelFormat chanFm
  */
 int tinywav_read_f(TinyWav *tw, void *data, int len);
 
+/**
+ * Read sample data from the file without any conversion, i.e. interleaved and in the sample format of the file.
+ * Only uncompressed files (16-bit int or 32-bit float) can be read this way.
+ *
+ * @param tw   The TinyWav structure which has already been prepared.
+ * @param data  A buffer of at least len * tw->h.BlockAlign bytes.
+ * @param len   The number of frames (samples per channel) to read.
+ *
+ * @return The number of frames (samples per channel) read from file. -1 if the file is compressed.
+ */
+int tinywav_read_raw(TinyWav *tw, void *data, int len);
+
+/**
+ * Read interleaved 16-bit int samples without a round trip through float: 16-bit int files as they are, G.711 and
+ * ADPCM files decoded to their exact 16-bit values. Like tinywav_read_raw(), the processing options applied by
+ * tinywav_read_f() (channel selection, mixing, resampling, peaks, statistics, trace hooks) are not applied.
+ *
+ * @param tw   The TinyWav structure which has already been prepared.
+ * @param data  A buffer of at least len * tw->numChannels samples.
+ * @param len   The number of frames (samples per channel) to read.
+ *
+ * @return The number of frames (samples per channel) read from file. -1 if the samples do not decode to 16-bit int.
+ */
+int tinywav_read_int16(TinyWav *tw, int16_t *data, int len);
+
+/**
+ * Find a chunk (e.g. "bext", "LIST", "JUNK") in the chunk table, which tinywav_open_read() fills while it walks
+ * the file header. This does not access the file.
+ *
+ * @param tw       The TinyWav structure which has already been prepared.
+ * @param chunkID  The four character chunk id.
+ *
+ * @return The first chunk with this id, NULL if there is none.
+ */
+const TinyWavChunk *tinywav_find_chunk(const TinyWav *tw, const char *chunkID);
+
+/**
+ * Read the payload of a chunk. The read position of the sample data is not affected.
+ *
+ * @param tw     The TinyWav structure which has already been prepared.
+ * @param chunk  A chunk returned by tinywav_find_chunk().
+ * @param data   A buffer of at least len bytes.
+ * @param len    The maximum number of bytes to read.
+ *
+ * @return The number of bytes read, -1 on error.
+ */
+int tinywav_read_chunk(TinyWav *tw, const TinyWavChunk *chunk, void *data, int len);
+
+/**
+ * Compute a waveform overview as samples pass through tinywav_read_f() or tinywav_write_f(), instead of making a
+ * separate pass over the file. The minimum, maximum and RMS of each channel are accumulated for bins of framesPerBin
+ * frames. The last, partial bin is completed when the file is closed.
+ * Call this after opening the file and before reading or writing any samples.
+ *
+ * @param peaks         The accumulator, owned by the caller. It must remain valid until the file is closed.
+ * @param bins          An array of maxBins entries per channel returned by reads or writes, ordered by bin, then channel.
+ * @param maxBins       The capacity of bins. Frames beyond it are not accumulated.
+ * @param framesPerBin  The number of frames per bin.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_peaks(TinyWav *tw, TinyWavPeaks *peaks, TinyWavPeak *bins, int maxBins, int framesPerBin);
+
+/**
+ * Write a peak envelope ('levl') chunk as specified by EBU Tech 3285 Supplement 3 when the file is closed, so that
+ * players can draw the waveform without scanning the audio data. The peaks are accumulated by tinywav_write_f() in
+ * blocks of 256 frames. If the bins run out, they are merged pairwise and the block size is doubled, so any length of
+ * audio can be covered by a fixed number of bins. The values are 16-bit magnitudes with full scale at 32767, as in the
+ * 16-bit samples of a WAV file; peaks beyond full scale are stored as full scale.
+ * Call this after opening the file for writing and before writing any samples.
+ *
+ * @param peaks    The accumulator, owned by the caller. It must remain valid until the file is closed.
+ * @param bins     An array of maxBins * tw->numChannels entries.
+ * @param maxBins  The capacity of bins, at least 2.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_levl(TinyWav *tw, TinyWavPeaks *peaks, TinyWavPeak *bins, int maxBins);
+
+/**
+ * Combine every factor bins of a waveform overview into one, e.g. to build the coarser levels of a multi-resolution
+ * overview. The RMS of the combined bin assumes that all bins hold the same number of frames.
+ *
+ * @param bins         numBins * numChannels entries, ordered by bin, then channel.
+ * @param out          Receives ceil(numBins / factor) * numChannels entries. May be the same as bins.
+ *
+ * @return  The number of bins written to out. -1 on error.
+ */
+int tinywav_reduce_peaks(const TinyWavPeak *bins, int numBins, int numChannels, int factor, TinyWavPeak *out);
+
+/**
+ * Hash the audio data as it is read or written, e.g. to fingerprint files regardless of their metadata chunks.
+ * The bytes of the data chunk are hashed as stored in the file, by all read and write functions. The hashes are
+ * complete when the file is closed, and cover the whole data chunk if all of it was read.
+ * Call this after opening the file and before reading or writing any samples.
+ *
+ * @param hash   The hash state, owned by the caller. It must remain valid until the file is closed, and holds the
+ *               results afterwards.
+ * @param types  The TinyWavHashType flags of the hashes to compute.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_hash(TinyWav *tw, TinyWavHash *hash, int types);
+
+/**
+ * Compute per-channel statistics (peak, RMS, DC offset, clipped samples) of the samples passing through
+ * tinywav_read_f() or tinywav_write_f(), e.g. for quality control.
+ * Call this after opening the file and before reading or writing any samples.
+ *
+ * @param stats  An array of one entry per channel returned by reads or writes, owned by the caller. It must remain valid until the file is
+ *               closed, and holds the final statistics afterwards.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_stats(TinyWav *tw, TinyWavStats *stats);
+
+/**
+ * Get the statistics of the samples read or written so far.
+ *
+ * @return  The array passed to tinywav_set_stats(), NULL if there is none.
+ */
+const TinyWavStats *tinywav_get_stats(TinyWav *tw);
+
+/**
+ * Load all samples of a file into a single allocation, e.g. instead of growing a buffer while calling tinywav_read_f()
+ * in a loop. 16-bit int and 32-bit float files are read with one call and converted in place when loaded
+ * interleaved. ADPCM files loaded interleaved are read with one call as well and their blocks decoded independently,
+ * in parallel with OpenMP (TINYWAV_USE_OPENMP). Other formats and layouts are decoded block by block. Broken data sizes
+ * are recovered from the size of the file (see TinyWavOpenOptions.recover).
+ * @note  The samples, and the encoded blocks of an ADPCM file while they are decoded, are the only allocations on the
+ *        heap made by TinyWav itself. Other than that, scratch buffers are taken from the heap instead of the stack
+ *        with TINYWAV_USE_MALLOC, tinywav_probe_batch() starts threads with TINYWAV_USE_THREADS, and stdio allocates
+ *        the buffer of each FILE unless TinyWavOpenOptions.buffer is given.
+ *
+ * @param path       The path of the file to load.
+ * @param chanFmt    TW_INTERLEAVED or TW_INLINE.
+ * @param data       Receives the samples, numFrames * numChannels floats. Release them with free().
+ * @param numFrames  Receives the number of frames loaded.
+ * @param info       Receives the format of the file as it was opened, may be NULL. Unlike tinywav_probe(), numFrames
+ *                   and dataSize are those actually loaded, which differ from the header of a broken file.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_load_all(const char *path, TinyWavChannelFormat chanFmt, float **data, int32_t *numFrames,
+                     TinyWavInfo *info);
+
 /** Stop reading the file. The Tinywav struct is now invalid. */
 void tinywav_close_read(TinyWav *tw);
 
@@ -115,10 +586,33 @@ void tinywav_close_read(TinyWav *tw);
  * @param f    A pointer to the sample data to write.
  * @param len  The number of frames (samples per channel) to write.
  *
- * @return The number of frames (samples per channel) written to file.
+ * @return The number of frames (samples per channel) written to file, -1 on error (see also TinyWav.hasWriteError).
  */
 int tinywav_write_f(TinyWav *tw, void *f, int len);
 
+/**
+ * Select the dither applied by tinywav_write_f() when converting float samples to 16-bit int. Without dither, samples
+ * are truncated, which adds distortion correlated with the signal to quiet passages.
+ * Call this after opening the file for writing and before writing any samples.
+ *
+ * @param dither  The kind of dither.
+ * @param seed    The seed of the noise generator, for reproducible output.
+ *
+ * @return  The error code. Zero if no error. Files with more than TINYWAV_MAX_DITHER_CHANNELS channels cannot be dithered.
+ */
+int tinywav_set_dither(TinyWav *tw, TinyWavDither dither, uint32_t seed);
+
+/**
+ * Write sample data to file without any conversion.
+ *
+ * @param tw    The TinyWav structure which has already been prepared.
+ * @param data  Interleaved samples in the sample format of the file (int16_t for TW_INT16, float for TW_FLOAT32).
+ * @param len   The number of frames (samples per channel) to write.
+ *
+ * @return The number of frames (samples per channel) written to file, -1 on error (see also TinyWav.hasWriteError).
+ */
+int tinywav_write_raw(TinyWav *tw, const void *data, int len);
+
 /** Stop writing to the file. The Tinywav struct is now invalid. */
 void tinywav_close_write(TinyWav *tw);
 
@@ -0,0 +1,617 @@
+/**
+ * Copyright (c) 2015-2024, Martin Roth (mhroth@gmail.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Header-only C++ layer on top of tinywav (C++14).
+ *
+ * tinywav::ReadHandle and tinywav::WriteHandle own a TinyWav struct: they are movable and close the file on
+ * destruction. Reads are returned as views (tinywav::Span) into a memory-mapped file or an internal buffer that is
+ * reused from block to block.
+ *
+ * tinywav::Reader and tinywav::Writer fix the sample type, channel layout and channel count at compile time. Their
+ * conversion kernels are instantiated for exactly that combination, so the per-frame channel loops have a constant
+ * trip count and can be unrolled/vectorized by the compiler. File I/O is done by tinywav_read_raw()/tinywav_write_raw(),
+ * files of 16-bit int, G.711 or ADPCM samples are read with tinywav_read_int16(), so int16 readers get them bit-exact.
+ * The processing options of the C API which are applied by tinywav_read_f()/tinywav_write_f() (channel selection,
+ * mixing, resampling, dither, peaks and levl, statistics, trace hooks) are therefore C API only: Reader and Writer
+ * refuse to read or write if any of them is set on their handle. Hashing and ioStats are applied to the raw I/O.
+ */
+
+#ifndef _TINY_WAV_HPP_
+#define _TINY_WAV_HPP_
+
+#include "tinywav.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+  #if __has_include(<span>)
+    #include <span>
+    #define TINYWAV_HAS_STD_SPAN 1
+  #endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #define TINYWAV_HAS_MMAP 1
+#endif
+
+namespace tinywav {
+
+namespace detail {
+
+// MARK: sample conversion
+
+template <typename DstT> struct Convert;
+
+template <> struct Convert<float>
+{
+  static float from(float x) { return x; }
+  static float from(int16_t x) { return static_cast<float>(x) / INT16_MAX; }
+};
+
+template <> struct Convert<int16_t>
+{
+  static int16_t from(int16_t x) { return x; }
+  static int16_t from(float x)
+  {
+    const float y = (x > 1.0f) ? 1.0f : ((x < -1.0f) ? -1.0f : x);
+    return static_cast<int16_t>(y * static_cast<float>(INT16_MAX));
+  }
+};
+
+// MARK: buffer types
+
+/** Buffer types of a channel layout: a single buffer for interleaved/inline, an array of channel buffers for split */
+template <typename T, TinyWavChannelFormat Layout> struct LayoutTraits
+{
+  using Pointer = T*;
+  using ConstPointer = const T*;
+};
+
+template <typename T> struct LayoutTraits<T, TW_SPLIT>
+{
+  using Pointer = T* const*;
+  using ConstPointer = const T* const*;
+};
+
+// MARK: kernels
+
+/**
+ * Converts interleaved file samples to the layout of the destination.
+ * @note Like tinywav_read_f(), inlined channels are spaced by the number of frames actually read.
+ */
+template <typename DstT, TinyWavChannelFormat Layout, int Channels> struct Deinterleave;
+
+template <typename DstT, int Channels> struct Deinterleave<DstT, TW_INTERLEAVED, Channels>
+{
+  template <typename SrcT>
+  static void run(const SrcT* src, int frames, DstT* dst)
+  {
+    for (int i = 0; i < frames * Channels; ++i) {
+      dst[i] = Convert<DstT>::from(src[i]);
+    }
+  }
+};
+
+template <typename DstT, int Channels> struct Deinterleave<DstT, TW_INLINE, Channels>
+{
+  template <typename SrcT>
+  static void run(const SrcT* src, int frames, DstT* dst)
+  {
+    for (int j = 0; j < frames; ++j) {
+      for (int c = 0; c < Channels; ++c) {
+        dst[c*frames + j] = Convert<DstT>::from(src[j*Channels + c]);
+      }
+    }
+  }
+};
+
+template <typename DstT, int Channels> struct Deinterleave<DstT, TW_SPLIT, Channels>
+{
+  template <typename SrcT>
+  static void run(const SrcT* src, int frames, DstT* const* dst)
+  {
+    for (int j = 0; j < frames; ++j) {
+      for (int c = 0; c < Channels; ++c) {
+        dst[c][j] = Convert<DstT>::from(src[j*Channels + c]);
+      }
+    }
+  }
+};
+
+/** Converts samples in the layout of the source to interleaved file samples. Inlined channels are spaced by len. */
+template <typename SrcT, TinyWavChannelFormat Layout, int Channels> struct Interleave;
+
+template <typename SrcT, int Channels> struct Interleave<SrcT, TW_INTERLEAVED, Channels>
+{
+  template <typename DstT>
+  static void run(const SrcT* src, int len, DstT* dst)
+  {
+    for (int i = 0; i < len * Channels; ++i) {
+      dst[i] = Convert<DstT>::from(src[i]);
+    }
+  }
+};
+
+template <typename SrcT, int Channels> struct Interleave<SrcT, TW_INLINE, Channels>
+{
+  template <typename DstT>
+  static void run(const SrcT* src, int len, DstT* dst)
+  {
+    for (int j = 0; j < len; ++j) {
+      for (int c = 0; c < Channels; ++c) {
+        dst[j*Channels + c] = Convert<DstT>::from(src[c*len + j]);
+      }
+    }
+  }
+};
+
+template <typename SrcT, int Channels> struct Interleave<SrcT, TW_SPLIT, Channels>
+{
+  template <typename DstT>
+  static void run(const SrcT* const* src, int len, DstT* dst)
+  {
+    for (int j = 0; j < len; ++j) {
+      for (int c = 0; c < Channels; ++c) {
+        dst[j*Channels + c] = Convert<DstT>::from(src[c][j]);
+      }
+    }
+  }
+};
+
+/** @returns true if options are set on tw which only tinywav_read_f()/tinywav_write_f() apply */
+inline bool hasCallOptions(const TinyWav& tw)
+{
+  return tw.selectedChannels != nullptr || tw.mixMatrix != nullptr || tw.resampler != nullptr
+      || tw.dither != TW_DITHER_NONE || tw.peaks != nullptr || tw.stats != nullptr || tw.trace != nullptr;
+}
+
+template <typename SampleT>
+constexpr bool isSupportedSampleType()
+{
+  return std::is_same<SampleT, float>::value || std::is_same<SampleT, int16_t>::value;
+}
+
+} // namespace detail
+
+// MARK: Span
+
+#if TINYWAV_HAS_STD_SPAN
+template <typename T> using Span = std::span<T>;
+#else
+/** Minimal stand-in for std::span (C++20): a non-owning view of size() contiguous elements */
+template <typename T>
+class Span
+{
+public:
+  constexpr Span() = default;
+  constexpr Span(T* data, size_t size) : data_(data), size_(size) {}
+
+  constexpr T* data() const { return data_; }
+  constexpr size_t size() const { return size_; }
+  constexpr bool empty() const { return size_ == 0; }
+  constexpr T& operator[](size_t i) const { return data_[i]; }
+  constexpr T* begin() const { return data_; }
+  constexpr T* end() const { return data_ + size_; }
+
+private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+};
+#endif
+
+// MARK: ReadHandle
+
+/**
+ * Owns a TinyWav struct opened for reading. Samples are always delivered interleaved.
+ *
+ * On POSIX systems, uncompressed files are memory-mapped on the first read: 32-bit float files are then returned
+ * without any copy, 16-bit int files are converted from the mapping into an internal buffer. Everything else is read
+ * with tinywav_read_f() into the internal buffer. A returned view stays valid until the next read, close or move.
+ * Options set with the C API on handle() (e.g. tinywav_select_channels(), tinywav_set_stats(), tinywav_set_hash(),
+ * trace hooks) are honoured: while any of them is set, reads go through tinywav_read_f()/tinywav_read_raw().
+ */
+class ReadHandle
+{
+public:
+  ReadHandle() = default;
+
+  /** Opens the file. Check isOpen() for success. */
+  explicit ReadHandle(const char* path)
+  {
+    if (tinywav_open_read(&tw_, path, TW_INTERLEAVED) == 0) {
+      dataOffset_ = ftell(tw_.f); // tinywav_open_read() leaves the file at the start of the data chunk
+    }
+  }
+
+  ~ReadHandle() { close(); }
+
+  ReadHandle(const ReadHandle&) = delete;
+  ReadHandle& operator=(const ReadHandle&) = delete;
+
+  ReadHandle(ReadHandle&& other) noexcept { moveFrom(other); }
+
+  ReadHandle& operator=(ReadHandle&& other) noexcept
+  {
+    if (this != &other) {
+      close();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  bool isOpen() const { return tw_.f != nullptr; }
+
+  void close()
+  {
+#if TINYWAV_HAS_MMAP
+    if (map_ != nullptr) {
+      munmap(map_, mapSize_);
+    }
+#endif
+    map_ = nullptr;
+    mapSize_ = 0;
+    tinywav_close_read(&tw_);
+  }
+
+  /**
+   * Reads up to maxFrames frames as interleaved float samples.
+   * @return A view of numChannels * frames read samples. Empty at the end of the file or on error.
+   */
+  Span<const float> read(int maxFrames)
+  {
+    if (!isOpen() || maxFrames <= 0) {
+      return {};
+    }
+    const int numChannels = numUserChannels();
+    const bool canMap = isUncompressed() && !hasRawOptions() && !detail::hasCallOptions(tw_);
+    const Span<const uint8_t> raw = canMap ? readMapped(maxFrames) : Span<const uint8_t>();
+    if (canMap && (!raw.empty() || mapState_ == MapState::Mapped)) {
+      const size_t numSamples = raw.size() / static_cast<size_t>(tw_.sampFmt);
+      if (tw_.sampFmt == TW_FLOAT32 && reinterpret_cast<uintptr_t>(raw.data()) % alignof(float) == 0) {
+        return { reinterpret_cast<const float*>(raw.data()), numSamples }; // zero-copy
+      }
+      reserve(numSamples);
+      for (size_t i = 0; i < numSamples; ++i) {
+        buffer_[i] = (tw_.sampFmt == TW_INT16) ? static_cast<float>(readInt16(raw.data() + 2*i)) / INT16_MAX
+                                                : readFloat(raw.data() + 4*i);
+      }
+      return { buffer_.data(), numSamples };
+    }
+    reserve(static_cast<size_t>(maxFrames * numChannels));
+    const int frames = tinywav_read_f(&tw_, buffer_.data(), maxFrames);
+    return { buffer_.data(), (frames > 0) ? static_cast<size_t>(frames * numChannels) : 0 };
+  }
+
+  /**
+   * Reads up to maxFrames frames exactly as they are stored in the file (uncompressed files only).
+   * @return A view of frames read * BlockAlign bytes. Empty at the end of the file or on error.
+   */
+  Span<const uint8_t> readRaw(int maxFrames)
+  {
+    if (!isOpen() || maxFrames <= 0 || !isUncompressed()) {
+      return {};
+    }
+    const Span<const uint8_t> raw = hasRawOptions() ? Span<const uint8_t>() : readMapped(maxFrames);
+    if (!raw.empty() || (mapState_ == MapState::Mapped && !hasRawOptions())) {
+      return raw;
+    }
+    const size_t numBytes = static_cast<size_t>(maxFrames) * tw_.h.BlockAlign;
+    reserve((numBytes + sizeof(float) - 1) / sizeof(float));
+    const int frames = tinywav_read_raw(&tw_, buffer_.data(), maxFrames);
+    return { reinterpret_cast<const uint8_t*>(buffer_.data()),
+             (frames > 0) ? static_cast<size_t>(frames) * tw_.h.BlockAlign : 0 };
+  }
+
+  int numChannels() const { return tw_.numChannels; }
+  int32_t sampleRate() const { return static_cast<int32_t>(tw_.h.SampleRate); }
+  int32_t numFrames() const { return tw_.numFramesInHeader; }
+
+  /** The underlying TinyWav struct, e.g. to query the header */
+  const TinyWav& handle() const { return tw_; }
+  TinyWav& handle() { return tw_; }
+
+private:
+  enum class MapState { Unknown, Mapped, Unavailable };
+
+  bool isUncompressed() const { return tw_.h.BlockAlign == tw_.numChannels * tw_.sampFmt; }
+
+  /** @returns true if options are set which tinywav_read_raw() applies, and which the mapped reads would bypass */
+  bool hasRawOptions() const { return tw_.hash != nullptr || tw_.ioStats != nullptr || tw_.trace != nullptr; }
+
+  /** @returns the number of channels delivered by tinywav_read_f(), after channel selection or mixing */
+  int numUserChannels() const
+  {
+    if (tw_.mixMatrix != nullptr) {
+      return tw_.numMixOutputs;
+    }
+    return (tw_.selectedChannels != nullptr) ? tw_.numSelectedChannels : tw_.numChannels;
+  }
+
+  void reserve(size_t numSamples)
+  {
+    if (buffer_.size() < numSamples) {
+      buffer_.resize(numSamples); // grows to the largest block size, then stays allocated
+    }
+  }
+
+  static int16_t readInt16(const uint8_t* p) { return static_cast<int16_t>(p[0] | (p[1] << 8)); }
+
+  static float readFloat(const uint8_t* p)
+  {
+    float x;
+    std::memcpy(&x, p, sizeof(float));
+    return x;
+  }
+
+  /** @returns the next frames from the mapped file. Empty if the file cannot be mapped (or at the end). */
+  Span<const uint8_t> readMapped(int maxFrames)
+  {
+#if TINYWAV_HAS_MMAP
+    if (mapState_ == MapState::Unknown) {
+      mapState_ = MapState::Unavailable;
+      struct stat st;
+      if (dataOffset_ >= 0 && fstat(fileno(tw_.f), &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fileno(tw_.f), 0);
+        if (map != MAP_FAILED) {
+          map_ = map;
+          mapSize_ = static_cast<size_t>(st.st_size);
+          mapState_ = MapState::Mapped;
+        }
+      }
+    }
+    if (mapState_ == MapState::Mapped) {
+      const size_t blockAlign = tw_.h.BlockAlign;
+      const size_t dataEnd = std::min(mapSize_, static_cast<size_t>(dataOffset_) + tw_.h.Subchunk2Size);
+      const size_t position = static_cast<size_t>(dataOffset_) + tw_.totalFramesReadWritten * blockAlign;
+      const size_t framesRemaining = (position < dataEnd) ? (dataEnd - position) / blockAlign : 0;
+      const size_t frames = std::min(static_cast<size_t>(maxFrames), framesRemaining);
+      tw_.totalFramesReadWritten += static_cast<uint32_t>(frames);
+      // keep the file position in step, so reads with the C API on handle() continue from here
+      fseek(tw_.f, static_cast<long>(position + frames * blockAlign), SEEK_SET);
+      return { static_cast<const uint8_t*>(map_) + position, frames * blockAlign };
+    }
+#else
+    (void) maxFrames;
+    mapState_ = MapState::Unavailable;
+#endif
+    return {};
+  }
+
+  void moveFrom(ReadHandle& other)
+  {
+    tw_ = other.tw_;
+    other.tw_.f = nullptr;
+    buffer_ = std::move(other.buffer_);
+    map_ = other.map_;
+    mapSize_ = other.mapSize_;
+    mapState_ = other.mapState_;
+    dataOffset_ = other.dataOffset_;
+    other.map_ = nullptr;
+    other.mapSize_ = 0;
+  }
+
+  TinyWav tw_ = {};
+  std::vector<float> buffer_;
+  void* map_ = nullptr;
+  size_t mapSize_ = 0;
+  MapState mapState_ = MapState::Unknown;
+  long dataOffset_ = -1;
+};
+
+// MARK: WriteHandle
+
+/** Owns a TinyWav struct opened for writing. The header is finalized and the file closed on destruction. */
+class WriteHandle
+{
+public:
+  WriteHandle() = default;
+
+  /** Opens the file. Check isOpen() for success. See tinywav_open_write() for the parameters. */
+  WriteHandle(const char* path, int16_t numChannels, int32_t sampleRate, TinyWavSampleFormat sampFmt,
+              TinyWavChannelFormat chanFmt = TW_INTERLEAVED)
+  {
+    if (tinywav_open_write(&tw_, numChannels, sampleRate, sampFmt, chanFmt, path) != 0) {
+      tinywav_close_write(&tw_);
+    }
+  }
+
+  ~WriteHandle() { close(); }
+
+  WriteHandle(const WriteHandle&) = delete;
+  WriteHandle& operator=(const WriteHandle&) = delete;
+
+  WriteHandle(WriteHandle&& other) noexcept : tw_(other.tw_) { other.tw_.f = nullptr; }
+
+  WriteHandle& operator=(WriteHandle&& other) noexcept
+  {
+    if (this != &other) {
+      close();
+      tw_ = other.tw_;
+      other.tw_.f = nullptr;
+    }
+    return *this;
+  }
+
+  bool isOpen() const { return tw_.f != nullptr; }
+
+  /** Finalizes the header and closes the file. */
+  void close() { tinywav_close_write(&tw_); }
+
+  /** Writes frames in the channel format given when opening. See tinywav_write_f(). */
+  int write(const void* data, int frames) { return tinywav_write_f(&tw_, const_cast<void*>(data), frames); }
+
+  /** Writes all samples of an interleaved (or inline) buffer */
+  int write(Span<const float> samples)
+  {
+    if (tw_.chanFmt == TW_SPLIT || tw_.numChannels <= 0) {
+      return -1;
+    }
+    return write(samples.data(), static_cast<int>(samples.size() / static_cast<size_t>(tw_.numChannels)));
+  }
+
+  /** The underlying TinyWav struct, e.g. to query the header */
+  const TinyWav& handle() const { return tw_; }
+  TinyWav& handle() { return tw_; }
+
+private:
+  TinyWav tw_ = {};
+};
+
+// MARK: Reader
+
+/**
+ * Reads a file with a channel count known at compile time.
+ *
+ * @tparam SampleT   Sample type delivered to the caller: float (normalized to [-1,1]) or int16_t.
+ * @tparam Layout    Channel layout of the destination buffers.
+ * @tparam Channels  Number of channels. Files with a different channel count fail to open.
+ */
+template <typename SampleT, TinyWavChannelFormat Layout, int Channels>
+class Reader
+{
+  static_assert(detail::isSupportedSampleType<SampleT>(), "SampleT must be float or int16_t");
+  static_assert(Channels > 0, "Channels must be positive");
+
+public:
+  using Buffer = typename detail::LayoutTraits<SampleT, Layout>::Pointer;
+
+  /** Opens the file. Check isOpen() for success. */
+  explicit Reader(const char* path) : file_(path)
+  {
+    if (file_.isOpen() && file_.numChannels() != Channels) {
+      file_.close();
+    }
+  }
+
+  bool isOpen() const { return file_.isOpen(); }
+
+  /**
+   * Reads up to len frames into dst.
+   * @return The number of frames read, -1 on error or if options of the C API are set, see above.
+   */
+  int read(Buffer dst, int len)
+  {
+    if (!isOpen() || dst == nullptr || len < 0) {
+      return -1;
+    }
+    TinyWav& tw = file_.handle();
+    if (detail::hasCallOptions(tw)) {
+      return -1;
+    }
+    if (tw.sampFmt == TW_INT16) {
+      // 16-bit int files as they are, G.711 and ADPCM files decoded to their exact 16-bit values
+      rawInt16_.resize(static_cast<size_t>(len * Channels));
+      const int frames = tinywav_read_int16(&tw, rawInt16_.data(), len);
+      if (frames > 0) {
+        detail::Deinterleave<SampleT, Layout, Channels>::run(rawInt16_.data(), frames, dst);
+      }
+      return frames;
+    }
+    // 32-bit float files, and the formats which tinywav_read_f() reads as float
+    const bool isUncompressed = (tw.h.BlockAlign == tw.numChannels * tw.sampFmt);
+    rawFloat_.resize(static_cast<size_t>(len * Channels));
+    const int frames = isUncompressed ? tinywav_read_raw(&tw, rawFloat_.data(), len)
+                                      : tinywav_read_f(&tw, rawFloat_.data(), len);
+    if (frames > 0) {
+      detail::Deinterleave<SampleT, Layout, Channels>::run(rawFloat_.data(), frames, dst);
+    }
+    return frames;
+  }
+
+  /** Closes the file. Also done by the destructor. */
+  void close() { file_.close(); }
+
+  /** The underlying TinyWav struct, e.g. to query the header */
+  const TinyWav& handle() const { return file_.handle(); }
+
+private:
+  ReadHandle file_;
+  std::vector<int16_t> rawInt16_;
+  std::vector<float> rawFloat_;
+};
+
+// MARK: Writer
+
+/**
+ * Writes a file with a channel count known at compile time.
+ *
+ * @tparam SampleT   Sample type provided by the caller: float (normalized to [-1,1]) or int16_t.
+ * @tparam Layout    Channel layout of the source buffers.
+ * @tparam Channels  Number of channels.
+ */
+template <typename SampleT, TinyWavChannelFormat Layout, int Channels>
+class Writer
+{
+  static_assert(detail::isSupportedSampleType<SampleT>(), "SampleT must be float or int16_t");
+  static_assert(Channels > 0, "Channels must be positive");
+
+public:
+  using ConstBuffer = typename detail::LayoutTraits<SampleT, Layout>::ConstPointer;
+
+  /** Opens the file. Check isOpen() for success. */
+  Writer(const char* path, int32_t sampleRate, TinyWavSampleFormat sampFmt)
+    : file_(path, Channels, sampleRate, sampFmt, TW_INTERLEAVED)
+  {}
+
+  bool isOpen() const { return file_.isOpen(); }
+
+  /**
+   * Writes len frames from src.
+   * @return The number of frames written, -1 on error or if options of the C API are set, see above.
+   */
+  int write(ConstBuffer src, int len)
+  {
+    if (!isOpen() || src == nullptr || len < 0) {
+      return -1;
+    }
+    TinyWav& tw = file_.handle();
+    if (detail::hasCallOptions(tw)) {
+      return -1; // dither, peaks, levl and statistics would silently be missing from the file
+    }
+    if (tw.sampFmt == TW_INT16) {
+      rawInt16_.resize(static_cast<size_t>(len * Channels));
+      detail::Interleave<SampleT, Layout, Channels>::run(src, len, rawInt16_.data());
+      return tinywav_write_raw(&tw, rawInt16_.data(), len);
+    }
+    rawFloat_.resize(static_cast<size_t>(len * Channels));
+    detail::Interleave<SampleT, Layout, Channels>::run(src, len, rawFloat_.data());
+    return tinywav_write_raw(&tw, rawFloat_.data(), len);
+  }
+
+  /** Finalizes the header and closes the file. Also done by the destructor. */
+  void close() { file_.close(); }
+
+  /** The underlying TinyWav struct, e.g. to query the header */
+  const TinyWav& handle() const { return file_.handle(); }
+
+private:
+  WriteHandle file_;
+  std::vector<int16_t> rawInt16_;
+  std::vector<float> rawFloat_;
+};
+
+} // namespace tinywav
+
+#endif // _TINY_WAV_HPP_